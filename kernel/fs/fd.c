@@ -1,6 +1,7 @@
 #include <types.h>
 #include <stddef.h>
 #include <string.h>
+#include <fcntl.h>
 #include "fd.h"
 #include "fs.h"
 #include "proc/process.h"
@@ -53,11 +54,56 @@ int fd_detach(struct process *p, int fd)
 	}
 
 	p->fds->nodes[fd] = NULL;
+	p->fds->flags[fd] = 0;
 
 out:
 	return rc;
 }
 
+int fd_get_flags(struct process *p, int fd)
+{
+	if (!p) {
+		p = CURR_PROC;
+	}
+
+	if ((fd < 0) || (fd >= p->fds->slots_count) || !p->fds->nodes[fd]) {
+		return -1;
+	}
+
+	return p->fds->flags[fd];
+}
+
+int fd_set_flags(struct process *p, int fd, int flags)
+{
+	if (!p) {
+		p = CURR_PROC;
+	}
+
+	if ((fd < 0) || (fd >= p->fds->slots_count) || !p->fds->nodes[fd]) {
+		return -1;
+	}
+
+	p->fds->flags[fd] = flags;
+	return 0;
+}
+
+/**
+ * Close the descriptors marked close-on-exec, called when the process
+ * image is replaced
+ */
+void fd_close_on_exec(struct process *p)
+{
+	size_t i;
+
+	for (i = 0; i < p->fds->slots_count; i++) {
+		if (p->fds->nodes[i] && FLAG_ON(p->fds->flags[i], FD_CLOEXEC)) {
+			vfs_close(p->fds->nodes[i]);
+			p->fds->nodes[i] = NULL;
+			p->fds->flags[i] = 0;
+		}
+	}
+}
+
 fd_table_t *fd_table_create()
 {
 	fd_table_t *t;
@@ -73,12 +119,20 @@ fd_table_t *fd_table_create()
 	
 	nodes_len = t->slots_count * sizeof(struct vfs_node *);
 	t->nodes = (struct vfs_node **)kmalloc(nodes_len, 0);
-	if (!t->nodes) {
+	t->flags = (int *)kmalloc(t->slots_count * sizeof(int), 0);
+	if (!t->nodes || !t->flags) {
+		if (t->nodes) {
+			kfree(t->nodes);
+		}
+		if (t->flags) {
+			kfree(t->flags);
+		}
 		kfree(t);
 		t = NULL;
 		goto out;
 	}
 	memset(t->nodes, 0, nodes_len);
+	memset(t->flags, 0, t->slots_count * sizeof(int));
 	
 out:
 	return t;
@@ -99,6 +153,10 @@ void fd_table_destroy(fd_table_t *table)
 	if (table->nodes) {
 		kfree(table->nodes);
 	}
+
+	if (table->flags) {
+		kfree(table->flags);
+	}
 	
 	kfree(table);
 }
@@ -118,12 +176,20 @@ fd_table_t *fd_table_clone(fd_table_t *src)
 
 	nodes_len = t->slots_count * sizeof(struct vfs_node *);
 	t->nodes = (struct vfs_node **)kmalloc(nodes_len, 0);
-	if (!t->nodes) {
+	t->flags = (int *)kmalloc(t->slots_count * sizeof(int), 0);
+	if (!t->nodes || !t->flags) {
+		if (t->nodes) {
+			kfree(t->nodes);
+		}
+		if (t->flags) {
+			kfree(t->flags);
+		}
 		kfree(t);
 		t = NULL;
 		goto out;
 	}
 	memset(t->nodes, 0, nodes_len);
+	memset(t->flags, 0, t->slots_count * sizeof(int));
 
 	/* Inherit all inheritable file descriptors in the parent table */
 	if (src) {
@@ -133,6 +199,7 @@ fd_table_t *fd_table_clone(fd_table_t *src)
 			}
 			
 			t->nodes[i] = vfs_node_clone(src->nodes[i]);
+			t->flags[i] = src->flags[i];
 		}
 	}
 
@@ -1,14 +1,35 @@
 #include <types.h>
 #include <stddef.h>
 #include <string.h>
+#include <stdio.h>
 #include <errno.h>
 #include "matrix/matrix.h"
+#include "list.h"
+#include "mutex.h"
+#include "mm/page.h"
 #include "mm/malloc.h"
+#include "multiboot.h"
 #include "fs.h"
 #include "dirent.h"
+#include "procfs.h"
 #include "debug.h"
 
-int _nr_procfs_nodes = 1;
+struct procfs_entry {
+	struct list link;
+	char name[32];
+	ino_t ino;
+	procfs_read_t read;
+};
+
+/* Entries registered to the process file system */
+static struct list _procfs_entries = {
+	.prev = &_procfs_entries,
+	.next = &_procfs_entries
+};
+static struct mutex _procfs_lock;
+static boolean_t _procfs_lock_init = FALSE;
+
+int _nr_procfs_nodes = 0;
 
 static int procfs_mount(struct vfs_mount *mnt, int flags, const void *data);
 
@@ -43,6 +64,8 @@ static int procfs_close(struct vfs_node *node)
 static int procfs_readdir(struct vfs_node *node, uint32_t index, struct dirent **dentry)
 {
 	int rc = -1;
+	struct list *l;
+	struct procfs_entry *e = NULL;
 	struct dirent *new_dentry = NULL;
 
 	ASSERT(dentry != NULL);
@@ -59,8 +82,25 @@ static int procfs_readdir(struct vfs_node *node, uint32_t index, struct dirent *
 	}
 
 	memset(new_dentry, 0, sizeof(struct dirent));
-	strncpy(new_dentry->d_name, "cmdline", 128);
-	new_dentry->d_ino = 1;
+
+	mutex_acquire(&_procfs_lock);
+	LIST_FOR_EACH(l, &_procfs_entries) {
+		if (index-- == 0) {
+			e = LIST_ENTRY(l, struct procfs_entry, link);
+			break;
+		}
+	}
+	if (e) {
+		strncpy(new_dentry->d_name, e->name, 128);
+		new_dentry->d_ino = e->ino;
+	}
+	mutex_release(&_procfs_lock);
+
+	if (!e) {
+		kfree(new_dentry);
+		goto out;
+	}
+	
 	*dentry = new_dentry;
 	rc = 0;
 
@@ -71,14 +111,67 @@ static int procfs_readdir(struct vfs_node *node, uint32_t index, struct dirent *
 static int procfs_finddir(struct vfs_node *node, const char *name, ino_t *id)
 {
 	int rc = -1;
+	struct list *l;
+	struct procfs_entry *e;
 
 	ASSERT(id != NULL);
 
+	mutex_acquire(&_procfs_lock);
+	LIST_FOR_EACH(l, &_procfs_entries) {
+		e = LIST_ENTRY(l, struct procfs_entry, link);
+		if (strcmp(e->name, name) == 0) {
+			*id = e->ino;
+			rc = 0;
+			break;
+		}
+	}
+	mutex_release(&_procfs_lock);
+
+	return rc;
+}
+
+/*
+ * The content of an entry is generated on every read, so the readers will
+ * always see the latest statistics.
+ */
+static int procfs_read(struct vfs_node *node, uint32_t offset,
+		       uint32_t size, uint8_t *buffer)
+{
+	int rc = -1, len;
+	char *data;
+	struct procfs_entry *e;
+
+	e = (struct procfs_entry *)node->data;
+	if (!e) {
+		rc = EINVAL;
+		goto out;
+	}
+
+	data = kmalloc(PAGE_SIZE, 0);
+	if (!data) {
+		rc = ENOMEM;
+		goto out;
+	}
+
+	len = e->read(data, PAGE_SIZE);
+	if (len < 0 || offset >= len) {
+		rc = 0;
+	} else {
+		if (offset + size > len) {
+			size = len - offset;
+		}
+		memcpy(buffer, data + offset, size);
+		rc = size;
+	}
+
+	kfree(data);
+
+ out:
 	return rc;
 }
 
 static struct vfs_node_ops _procfs_node_ops = {
-	.read = NULL,
+	.read = procfs_read,
 	.write = NULL,
 	.create = procfs_create,
 	.close = procfs_close,
@@ -89,9 +182,36 @@ static struct vfs_node_ops _procfs_node_ops = {
 static int procfs_read_node(struct vfs_mount *mnt, ino_t id, struct vfs_node **np)
 {
 	int rc = -1;
+	struct list *l;
+	struct vfs_node *n;
+	struct procfs_entry *e;
 
 	ASSERT(np != NULL);
 
+	mutex_acquire(&_procfs_lock);
+	LIST_FOR_EACH(l, &_procfs_entries) {
+		e = LIST_ENTRY(l, struct procfs_entry, link);
+		if (e->ino != id) {
+			continue;
+		}
+		
+		n = vfs_node_alloc(mnt, VFS_FILE, &_procfs_node_ops, e);
+		if (!n) {
+			rc = ENOMEM;
+			break;
+		}
+
+		n->ino = id;
+		n->length = 0;
+		n->mask = 0444;
+		strncpy(n->name, e->name, 128);
+
+		*np = n;
+		rc = 0;
+		break;
+	}
+	mutex_release(&_procfs_lock);
+
 	return rc;
 }
 
@@ -126,10 +246,70 @@ int procfs_mount(struct vfs_mount *mnt, int flags, const void *data)
 	return rc;
 }
 
+static void procfs_lock_init()
+{
+	if (!_procfs_lock_init) {
+		mutex_init(&_procfs_lock, "procfs-mutex", 0);
+		_procfs_lock_init = TRUE;
+	}
+}
+
+/**
+ * Register an entry to the process file system, the subsystems may register
+ * their entries before procfs was mounted.
+ */
+int procfs_register(const char *name, procfs_read_t read)
+{
+	int rc = -1;
+	struct procfs_entry *e;
+
+	if (!name || !read) {
+		rc = EINVAL;
+		goto out;
+	}
+
+	e = kmalloc(sizeof(struct procfs_entry), 0);
+	if (!e) {
+		rc = ENOMEM;
+		goto out;
+	}
+
+	LIST_INIT(&e->link);
+	strncpy(e->name, name, sizeof(e->name) - 1);
+	e->name[sizeof(e->name) - 1] = 0;
+	e->read = read;
+
+	procfs_lock_init();
+	
+	mutex_acquire(&_procfs_lock);
+	e->ino = ++_nr_procfs_nodes;
+	list_add_tail(&e->link, &_procfs_entries);
+	mutex_release(&_procfs_lock);
+
+	DEBUG(DL_DBG, ("registered procfs entry(%s:%d).\n", e->name, e->ino));
+	rc = 0;
+
+ out:
+	return rc;
+}
+
+static int procfs_cmdline_read(char *buf, size_t size)
+{
+	const char *cmdline = "";
+
+	if (FLAG_ON(_mbi->flags, MULTIBOOT_FLAG_CMDLINE) && _mbi->cmdline) {
+		cmdline = (const char *)_mbi->cmdline;
+	}
+
+	return snprintf(buf, size, "%s\n", cmdline);
+}
+
 int procfs_init(void)
 {
 	int rc = -1;
 
+	procfs_register("cmdline", procfs_cmdline_read);
+	
 	rc = vfs_type_register(&_procfs_type);
 	if (rc != 0) {
 		DEBUG(DL_DBG, ("module procfs initialize failed.\n"));
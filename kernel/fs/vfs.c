@@ -4,7 +4,9 @@
 #include "matrix/matrix.h"
 #include "mm/malloc.h"
 #include "mm/slab.h"
+#include "mm/icache.h"
 #include "mutex.h"
+#include "rwlock.h"
 #include "proc/process.h"
 #include "rtl/fsrtl.h"
 #include "fs.h"
@@ -18,12 +20,14 @@ static struct list _fs_list = {
 };
 static struct mutex _fs_list_lock;
 
-/* List of all mounts */
+/* List of all mounts, path lookups hold the lock for reading so that the
+ * mount points do not change under them.
+ */
 static struct list _mount_list = {
 	.prev = &_mount_list,
 	.next = &_mount_list
 };
-static struct mutex _mount_list_lock;
+static struct rwlock _mount_list_lock;
 
 /* Cache of Virtual File System node structure */
 static slab_cache_t _vfs_node_cache;
@@ -157,6 +161,10 @@ int vfs_write(struct vfs_node *node, uint32_t offset, uint32_t size, uint8_t *bu
 
 	if (node->ops->write != NULL) {
 		rc = node->ops->write(node, offset, size, buffer);
+		/* Cached pages of an executable are out of date now */
+		if ((rc > 0) && (node->type == VFS_FILE)) {
+			icache_invalidate(node);
+		}
 	} else {
 		rc = 0;
 	}
@@ -457,7 +465,9 @@ struct vfs_node *vfs_lookup(const char *path, int type)
 	}
 
 	/* Look up the path string */
+	rwlock_read_acquire(&_mount_list_lock);
 	n = vfs_lookup_internal(c, dup);
+	rwlock_read_release(&_mount_list_lock);
 	if (n) {
 		if ((type >= 0) && (n->type != type)) {
 			DEBUG(DL_DBG, ("node(%s) type mismatch, n->type(%d), type(%d).\n",
@@ -572,24 +582,29 @@ int vfs_mount(const char *dev, const char *path, const char *type, const void *d
 		return rc;
 	}
 
-	mutex_acquire(&_mount_list_lock);
+	/* Look up the destination directory before we lock the mount list,
+	 * the lookup takes the lock for reading.
+	 */
+	if (_root_mount) {
+		n = vfs_lookup(path, VFS_DIRECTORY);
+		if (!n) {
+			rc = ENOENT;
+			DEBUG(DL_DBG, ("vfs_lookup(%s) not found.\n", path));
+			return rc;
+		}
+	}
+
+	rwlock_write_acquire(&_mount_list_lock);
 
 	/* If the root File System is not mounted yet, the only place we can
 	 * mount is root
 	 */
-	if (!_root_mount) {
+	if (!n) {
 		ASSERT(CURR_PROC == _kernel_proc);
 		if (strcmp(path, "/") != 0) {
 			PANIC("Non-root mount before root FS mounted");
 		}
 	} else {
-		/* Look up the destination directory */
-		n = vfs_lookup(path, VFS_DIRECTORY);
-		if (!n) {
-			rc = ENOENT;
-			DEBUG(DL_DBG, ("vfs_lookup(%s) not found.\n", path));
-			goto out;
-		}
 		ASSERT(n->type == VFS_DIRECTORY);
 
 		/* Check whether it is being used as a mount point already */
@@ -668,7 +683,7 @@ int vfs_mount(const char *dev, const char *path, const char *type, const void *d
 			vfs_node_deref(n);
 		}
 	}
-	mutex_release(&_mount_list_lock);
+	rwlock_write_release(&_mount_list_lock);
 
 	return rc;
 }
@@ -698,18 +713,15 @@ int vfs_umount(const char *path)
 		goto out;
 	}
 
-	/* Acquire the mount lock first */
-	mutex_acquire(&_mount_list_lock);
-
+	/* The lookup takes the mount lock for reading, so do it first */
 	n = vfs_lookup(path, VFS_DIRECTORY);
 	if (n) {
+		rwlock_write_acquire(&_mount_list_lock);
 		rc = vfs_umount_internal(n->mount, n);
+		rwlock_write_release(&_mount_list_lock);
 	} else {
 		DEBUG(DL_DBG, ("vfs_lookup(%s) not found.\n", path));
 	}
-
-	/* Release the mount lock */
-	mutex_release(&_mount_list_lock);
 	
  out:
 	return rc;
@@ -720,7 +732,7 @@ void init_fs()
 {
 	/* Initialize the fs list lock and mount list lock */
 	mutex_init(&_fs_list_lock, "fs-mutex", 0);
-	mutex_init(&_mount_list_lock, "mnt-mutex", 0);
+	rwlock_init(&_mount_list_lock, "mnt-rwlock");
 
 	/* Initialize the vfs node cache */
 	slab_cache_init(&_vfs_node_cache, "vfs-cache", sizeof(struct vfs_node),
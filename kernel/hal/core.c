@@ -3,7 +3,9 @@
 #include "hal/hal.h"
 #include "hal/lapic.h"
 #include "hal/core.h"
+#include "hal/fpu.h"
 #include "pit.h"
+#include "timer.h"
 #include "debug.h"
 #include "mm/mlayout.h"
 #include "mm/page.h"
@@ -68,6 +70,12 @@ static void core_ctor(struct core *c, core_id_t id, int state)
 	spinlock_init(&c->timer_lock, "tmr-lock");
 	LIST_INIT(&c->timers);
 	c->timer_enabled = FALSE;
+	c->tick_stopped = FALSE;
+	c->timer_deadline = TIMER_NEVER;
+
+	/* Initialize kernel stack cache */
+	LIST_INIT(&c->kstacks);
+	c->nr_kstacks = 0;
 }
 
 void dump_core(struct core *c)
@@ -207,6 +215,9 @@ static void arch_preinit_core_percore(struct core *c)
 	/* Set NE/MP in CR0 (Numeric Error, Monitor Coprocessor) and clear EM (Emulation). */
 	x86_write_cr0((x86_read_cr0() | X86_CR0_NE | X86_CR0_MP) & ~X86_CR0_EM);
 
+	/* Enable SSE, the FPU state will be switched lazily */
+	init_fpu(c);
+
 	/* Configure the TSC offset for sys_time() */
 	tsc_init_target();
 }
@@ -299,6 +310,8 @@ struct core *core_register(core_id_t id, int state)
 		memset(cores, 0, s);
 		s = sizeof(struct core *) * (_highest_core_id + 1);
 		memcpy(cores, _cores, s);
+		kfree(_cores);
+		_cores = cores;
 		
 		_highest_core_id = id;
 	}
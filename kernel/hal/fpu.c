@@ -0,0 +1,114 @@
+/*
+ * fpu.c
+ *
+ * Lazy FPU/SSE context switching. CR0.TS is set when switching threads, so
+ * the first FPU or SSE instruction of the new thread traps into #NM and its
+ * state is restored there. The state area of a thread is allocated the
+ * first time it uses the FPU, threads never touching the FPU pay nothing.
+ */
+
+#include <types.h>
+#include <stddef.h>
+#include <string.h>
+#include "matrix/matrix.h"
+#include "hal/hal.h"
+#include "hal/core.h"
+#include "hal/fpu.h"
+#include "mm/malloc.h"
+#include "proc/thread.h"
+#include "debug.h"
+
+/* State loaded for a thread the first time it uses the FPU */
+static uint8_t _fpu_init_state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+/* FXSAVE/FXRSTOR require a 16 byte aligned area */
+static INLINE void *fpu_area(struct thread *t)
+{
+	return (void *)ROUND_UP((ptr_t)t->arch.fpu, 16);
+}
+
+static INLINE void fpu_fxsave(void *area)
+{
+	asm volatile("fxsave (%0)" :: "r"(area) : "memory");
+}
+
+static INLINE void fpu_fxrstor(void *area)
+{
+	asm volatile("fxrstor (%0)" :: "r"(area));
+}
+
+/**
+ * Save the FPU state of the previous thread if it used the FPU in its last
+ * time slice, and arm the trap for the next thread. Called with interrupts
+ * disabled.
+ */
+void fpu_switch(struct thread *prev)
+{
+	uint32_t cr0;
+
+	cr0 = x86_read_cr0();
+
+	/* TS is cleared only by the #NM handler */
+	if (!FLAG_ON(cr0, X86_CR0_TS)) {
+		if (prev && prev->arch.fpu) {
+			fpu_fxsave(fpu_area(prev));
+		}
+		x86_write_cr0(cr0 | X86_CR0_TS);
+	}
+}
+
+/**
+ * Restore the FPU state of the current thread, called from the #NM handler
+ */
+int fpu_restore()
+{
+	struct thread *t;
+
+	t = CURR_THREAD;
+	if (!t) {
+		return -1;
+	}
+
+	if (!t->arch.fpu) {
+		t->arch.fpu = kmalloc(FPU_STATE_SIZE + 15, 0);
+		if (!t->arch.fpu) {
+			DEBUG(DL_WRN, ("thread(%s:%d) no memory for FPU state.\n",
+				       t->name, t->id));
+			return -1;
+		}
+		memcpy(fpu_area(t), _fpu_init_state, FPU_STATE_SIZE);
+	}
+
+	asm volatile("clts");
+	fpu_fxrstor(fpu_area(t));
+
+	return 0;
+}
+
+void fpu_free(struct thread *t)
+{
+	if (t->arch.fpu) {
+		kfree(t->arch.fpu);
+		t->arch.fpu = NULL;
+	}
+}
+
+/**
+ * Enable FXSAVE and SSE on current CORE. The boot CORE also records the
+ * initial FPU state here.
+ */
+void init_fpu(struct core *c)
+{
+	uint32_t mxcsr = 0x1F80;	// All SSE exceptions masked
+
+	x86_write_cr4(x86_read_cr4() | X86_CR4_OSFXSR | X86_CR4_OSXMMEXCPT);
+	x86_write_cr0(x86_read_cr0() & ~X86_CR0_TS);
+
+	if (c == &_boot_core) {
+		asm volatile("fninit");
+		asm volatile("ldmxcsr %0" :: "m"(mxcsr));
+		fpu_fxsave(_fpu_init_state);
+	}
+
+	x86_write_cr0(x86_read_cr0() | X86_CR0_TS);
+}
@@ -192,6 +192,8 @@ void init_idt()
 	idt_set_gate(240, (uint32_t)irq240, 0x08, 0x8E);
 	idt_set_gate(241, (uint32_t)irq241, 0x08, 0x8E);
 	idt_set_gate(242, (uint32_t)irq242, 0x08, 0x8E);
+	idt_set_gate(243, (uint32_t)irq243, 0x08, 0x8E);
+	idt_set_gate(244, (uint32_t)irq244, 0x08, 0x8E);
 
 	/* The following interrupt number is for system call */
 	idt_set_gate(128, (uint32_t)isr128, 0x08, 0x8E);
@@ -235,7 +237,7 @@ void init_gdt(struct core *c)
 	struct gdt_ptr ptr;
 	struct gdt *d = c->arch.gdt;
 	
-	/* 5 GDT entry and a TSS entry */
+	/* 5 GDT entry, a TSS entry, the CORE data and the user TLS */
 	ptr.limit = (sizeof(c->arch.gdt)) - 1;
 	ptr.base = (uint32_t)&c->arch.gdt;
 
@@ -249,21 +251,38 @@ void init_gdt(struct core *c)
 
 	write_tss(&d[5], &c->arch.tss);
 
-	gdt_flush((uint32_t)&ptr);
-
-	/* Although once the thread system is up the OS base is pointed at the
-	 * architecture thread data, we need _curr_core to work before that. Our
-	 * CORE data has a pointer at the start which we can use, so point the GS
-	 * base at that for later use by core_get_pointer()
+	/* Our arch CORE data has a pointer to the CORE at the start, base the
+	 * kernel FS segment there for core_get_pointer(). GS is left to the
+	 * user threads for their TLS.
 	 */
 	c->arch.parent = c;
-	x86_write_msr(X86_MSR_GS_BASE, (uint64_t)c);	// FixMe: the GS register will be overridden
-	x86_write_msr(X86_MSR_K_GS_BASE, 0);
+	c->arch.tls_base = 0;
+	gdt_set_gate(&d[GDT_CORE_ENTRY], (uint32_t)&c->arch, 0xFFFFFFFF, 0x92, 0xCF);
+	gdt_set_gate(&d[GDT_TLS_ENTRY], 0, 0xFFFFFFFF, 0xF2, 0xCF);
+
+	gdt_flush((uint32_t)&ptr);
+
+	asm volatile("mov %0, %%fs" :: "r"(GDT_CORE_SEL));
 	ASSERT(CURR_CORE == c);
 	
 	kprintf("core:%d gdt initialized.\n", c->id);
 }
 
+/**
+ * Point the TLS segment of the CORE at base and reload GS, the segment
+ * register has to be reloaded for the new base to take effect.
+ */
+void gdt_set_tls(struct core *c, ptr_t base)
+{
+	if (c->arch.tls_base != base) {
+		gdt_set_gate(&c->arch.gdt[GDT_TLS_ENTRY], base, 0xFFFFFFFF,
+			     0xF2, 0xCF);
+		c->arch.tls_base = base;
+	}
+
+	asm volatile("mov %0, %%gs" :: "r"(GDT_TLS_SEL));
+}
+
 void init_tss(struct core *c)
 {
 	/* Ensure the descriptor is initially zero */
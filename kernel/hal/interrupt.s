@@ -1,6 +1,11 @@
 ;
 ; interrupt.s
 ;
+
+; Selector of the per CORE data segment, keep in sync with GDT_CORE_SEL
+; in include/hal/hal.h
+%define GDT_CORE_SEL	0x30
+
 %macro ISR_NOERRCODE 1
 	global isr%1
 	isr%1:
@@ -87,6 +92,8 @@ IRQ	15, 47
 IRQ	240, 240	; The following 3 were used by APIC
 IRQ	241, 241
 IRQ	242, 242
+IRQ	243, 243	; Reschedule IPI
+IRQ	244, 244	; TLB shootdown IPI
  
 ; In isr.c
 extern isr_handler
@@ -102,6 +109,7 @@ isr_common_stub:
 	mov ax, 0x10  		; load the kernel data segment descriptor
 	mov ds, ax
 	mov es, ax
+	mov ax, GDT_CORE_SEL	; FS points to the CORE data
 	mov fs, ax
 
 	call isr_handler
@@ -127,6 +135,7 @@ irq_common_stub:
 	mov ax, 0x10		; Load the kernel data segment
 	mov ds, ax
 	mov es, ax
+	mov ax, GDT_CORE_SEL	; FS points to the CORE data
 	mov fs, ax
 
 	call irq_handler
@@ -8,11 +8,21 @@
 #include "hal/hal.h"
 #include "hal/spinlock.h"
 #include "hal/core.h"
+#include "hal/fpu.h"
+#include "proc/sched.h"
+#include "proc/thread.h"
 #include "util.h"
+#include "rcu.h"
 #include "debug.h"
 
+/* The chains are walked without the lock. The hardware interrupt handlers
+ * run with interrupts disabled, so a CORE cannot pass a quiescent state
+ * while it is on one of their chains. The exception and system call
+ * handlers may enable interrupts and sleep, so their hooks must never be
+ * unregistered, and the walk loads the next hook before it calls one.
+ */
 struct irq_chain {
-	struct spinlock lock;
+	struct spinlock lock;		// Serializes the changes of the chain
 	struct irq_hook *head;
 };
 typedef struct irq_chain irq_chain_t;
@@ -32,7 +42,7 @@ static struct irq_hook _exceptn_hooks[17];
  */
 void isr_handler(struct registers regs)
 {
-	struct irq_hook *hook;
+	struct irq_hook *hook, *next;
 	boolean_t processed = FALSE;
 	uint8_t int_no;
 	
@@ -41,21 +51,29 @@ void isr_handler(struct registers regs)
 	 */
 	int_no = (uint8_t)regs.int_no;
 
+	rcu_irq_enter();
+
 	/* Call each handler on the ISR hook chain */
-	hook = _irq_chains[int_no].head;
+	hook = rcu_dereference(_irq_chains[int_no].head);
 	while (hook) {
 		isr_t handler = hook->handler;
+		next = rcu_dereference(hook->next);
 		if (handler) {
 			handler(&regs);
 			processed = TRUE;
 		}
-		hook = hook->next;
+		hook = next;
 	}
 
 	if (!processed) {
 		kprintf("ISR %d not handled\n", int_no);
 		for (; ; ) ;
 	}
+
+	/* Leave here if we were killed in a system call or a fault */
+	if (regs.cs & 0x3) {
+		thread_check_killed();
+	}
 }
 
 /*
@@ -72,15 +90,18 @@ void irq_handler(struct registers regs)
 	 */
 	int_no = (uint8_t)regs.int_no;
 
+	/* The hook chains are read under RCU, we may have woken up idle */
+	rcu_irq_enter();
+
 	/* Call each handler on the IRQ hook chain */
-	hook = _irq_chains[int_no].head;
+	hook = rcu_dereference(_irq_chains[int_no].head);
 	while (hook) {
 		isr_t handler = hook->handler;
 		if (handler) {
 			handler(&regs);
 			processed = TRUE;
 		}
-		hook = hook->next;
+		hook = rcu_dereference(hook->next);
 	}
 
 	/* Notify the PIC that we have done so we can accept >= priority
@@ -93,6 +114,14 @@ void irq_handler(struct registers regs)
 		DEBUG(DL_DBG, ("IRQ %d not handled\n", int_no));
 #endif
 	}
+
+	/* Switch to the thread woken up by the handler if it should run */
+	sched_preempt();
+
+	/* A killed thread interrupted in user mode must not return there */
+	if (regs.cs & 0x3) {
+		thread_check_killed();
+	}
 }
 
 void register_irq_handler(uint8_t irq, struct irq_hook *hook, isr_t handler)
@@ -105,7 +134,7 @@ void register_irq_handler(uint8_t irq, struct irq_hook *hook, isr_t handler)
 	while (*line) {
 		/* Check if the hook has been registered already */
 		if (hook == (*line)) {
-			local_irq_enable();
+			spinlock_release(&_irq_chains[irq].lock);
 			return;
 		}
 		line = &((*line)->next);
@@ -114,16 +143,23 @@ void register_irq_handler(uint8_t irq, struct irq_hook *hook, isr_t handler)
 	hook->next = NULL;
 	hook->handler = handler;
 	hook->irq = irq;
-	*line = hook;
+	rcu_assign_pointer(*line, hook);
 
 	spinlock_release(&_irq_chains[irq].lock);
 }
 
+/**
+ * Remove a hook from its chain, the hook may be reused once we return as
+ * the handlers running on other COREs are waited for.
+ */
 void unregister_irq_handler(struct irq_hook *hook)
 {
 	int irq = hook->irq;
 	struct irq_hook **line;
 
+	/* Exception and system call handlers may sleep on the chain */
+	ASSERT((irq >= IRQ0) && (irq != 0x80));
+
 	spinlock_acquire(&_irq_chains[irq].lock);
 
 	line = &_irq_chains[irq].head;
@@ -137,6 +173,8 @@ void unregister_irq_handler(struct irq_hook *hook)
 	}
 
 	spinlock_release(&_irq_chains[irq].lock);
+
+	synchronize_rcu();
 }
 
 void dump_registers(struct registers *regs)
@@ -194,8 +232,11 @@ void invalid_opcode_fault(struct registers *regs)
 
 void no_device_fault(struct registers *regs)
 {
-	dump_registers(regs);
-	PANIC("Device not found");
+	/* CR0.TS was set at thread switch, load the FPU state of the thread */
+	if (fpu_restore() != 0) {
+		dump_registers(regs);
+		PANIC("Device not found");
+	}
 }
 
 void double_fault_abort(struct registers *regs)
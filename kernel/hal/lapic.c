@@ -10,6 +10,7 @@
 #include "smp.h"
 
 #define LAPIC_TIMER_PERIODIC	0x20000
+#define LAPIC_TIMER_ONESHOT	0x00000
 
 extern void timer_tick();
 
@@ -19,7 +20,7 @@ static volatile uint8_t *_lapic_mapping = NULL;
 /* Local APIC base address */
 static phys_addr_t _lapic_base = 0;
 
-static struct irq_hook _lapic_hook[3];
+static struct irq_hook _lapic_hook[5];
 
 static INLINE uint32_t lapic_read(uint32_t reg)
 {
@@ -36,11 +37,16 @@ static INLINE void lapic_eoi()
 	lapic_write(LAPIC_REG_EOI, 0);
 }
 
+/**
+ * Arm the one-shot timer to fire in us microseconds, 0 stops the timer
+ */
 void lapic_timer_prepare(useconds_t us)
 {
 	uint32_t cnt = (CURR_CORE->arch.lapic_tmr_cv * us) >> 32;
 
+#ifdef _DEBUG_SCHED
 	DEBUG(DL_DBG, ("us:%lld, cnt:%d\n", us, cnt));
+#endif	/* _DEBUG_SCHED */
 	lapic_write(LAPIC_REG_TIMER_INITIAL, (cnt == 0 && us != 0) ? 1 : cnt);
 }
 
@@ -61,6 +67,18 @@ void lapic_ipi_handler(struct registers *regs)
 	lapic_eoi();
 }
 
+void lapic_resched_handler(struct registers *regs)
+{
+	lapic_eoi();
+	smp_resched_handler();
+}
+
+void lapic_tlb_handler(struct registers *regs)
+{
+	smp_tlb_handler();
+	lapic_eoi();
+}
+
 boolean_t lapic_enabled()
 {
 	return _lapic_mapping != NULL;
@@ -145,6 +163,10 @@ void init_lapic()
 				     lapic_timer_handler);
 		register_irq_handler(LAPIC_VECT_IPI, &_lapic_hook[2],
 				     lapic_ipi_handler);
+		register_irq_handler(LAPIC_VECT_RESCHED, &_lapic_hook[3],
+				     lapic_resched_handler);
+		register_irq_handler(LAPIC_VECT_TLB, &_lapic_hook[4],
+				     lapic_tlb_handler);
 
 		/* Hardware enable the local APIC if it wasn't enabled */
 		base = x86_read_msr(X86_MSR_APIC_BASE);
@@ -181,17 +203,15 @@ void init_lapic()
 	 */
 	lapic_write(LAPIC_REG_SPURIOUS, LAPIC_VECT_SPURIOUS | (1<<8));
 
-	/* Set the initial count, it's a magic number. I just get it by several
-	 * tests and it works.
-	 */
-	lapic_write(LAPIC_REG_TIMER_INITIAL, 10240);
-	
-	/* Map APIC timer to an interrupt vector, we are setting it in periodic
-	 * mode. For effiency we should use one-shot mode.
+	/* Map APIC timer to an interrupt vector in one-shot mode. The timer
+	 * is armed for the next event only, see timer_reprogram().
 	 */
 	lapic_write(LAPIC_REG_LVT_TIMER,
-		    LAPIC_VECT_TIMER | LAPIC_TIMER_PERIODIC);
+		    LAPIC_VECT_TIMER | LAPIC_TIMER_ONESHOT);
 
 	/* Setup divider to 8 */
 	lapic_write(LAPIC_REG_TIMER_DIVIDER, LAPIC_TIMER_DIV8);
+
+	/* Keep the timer stopped until the scheduler starts */
+	lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
 }
@@ -7,29 +7,84 @@
 #include "hal/spinlock.h"
 #include "debug.h"
 
-static INLINE void spinlock_lock_internal(struct spinlock *lock)
+#ifdef _DEBUG_SPINLOCK
+/* Spins before we complain about a lock that is never released */
+#define SPINLOCK_SPIN_WARN	100000000
+#endif	/* _DEBUG_SPINLOCK */
+
+static INLINE void spinlock_lock_internal(struct spinlock *lock, ptr_t ip)
 {
-	/* Attempt to take the lock. */
-	if (atomic_dec(&lock->value) != 1) {
+	uint32_t ticket;
+#ifdef _LOCKSTAT
+	boolean_t contended = FALSE;
+	uint64_t start = x86_rdtsc();
+#endif	/* _LOCKSTAT */
+#ifdef _DEBUG_SPINLOCK
+	uint32_t spins = 0;
+
+	if (lock->holder && (lock->holder == CURR_CORE)) {
+		PANIC("spinlock_lock_internal: recursive locking.");
+	}
+#endif	/* _DEBUG_SPINLOCK */
+
+	/* Take a ticket and wait for our turn */
+	ticket = (uint32_t)atomic_inc(&lock->next);
+	if (ticket != lock->serving) {
 		/* When running on a UP system we don't need to spin as there should
 		 * only be on thing at any time, so just die.
 		 */
-		if (_nr_cores > 1) {
-			while (TRUE) {
-				/* Wait for the lock to be released */
-				while (lock->value != 1) {
-					core_spin_hint();
-				}
-
-				/* Try to acquire it */
-				if (atomic_dec(&lock->value) == 1) {
-					break;
-				}
-			}
-		} else {
+		if (_nr_cores <= 1) {
 			PANIC("spinlock_lock_internal: lock value invalid.");
 		}
+
+#ifdef _DEBUG_SPINLOCK
+		lock->nr_contended++;
+#endif	/* _DEBUG_SPINLOCK */
+#ifdef _LOCKSTAT
+		contended = TRUE;
+#endif	/* _LOCKSTAT */
+
+		/* Only the holder writes the ticket being served, the waiters
+		 * just read their cached copy until it changes.
+		 */
+		while (ticket != lock->serving) {
+			core_spin_hint();
+#ifdef _DEBUG_SPINLOCK
+			if (++spins == SPINLOCK_SPIN_WARN) {
+				DEBUG(DL_WRN, ("lock(%s) held by core(%d) too long.\n",
+					       lock->name, lock->holder ?
+					       lock->holder->id : -1));
+			}
+#endif	/* _DEBUG_SPINLOCK */
+		}
 	}
+
+#ifdef _DEBUG_SPINLOCK
+	lock->holder = CURR_CORE;
+#endif	/* _DEBUG_SPINLOCK */
+#ifdef _LOCKSTAT
+	lockstat_acquired(&lock->stat, lock->name, LOCKSTAT_SPINLOCK, ip,
+			  start, contended);
+#endif	/* _LOCKSTAT */
+}
+
+static INLINE void spinlock_unlock_internal(struct spinlock *lock)
+{
+#ifdef _DEBUG_SPINLOCK
+	if (lock->holder != CURR_CORE) {
+		PANIC("spinlock_unlock_internal: release from incorrect core.");
+	}
+	if (local_irq_state()) {
+		PANIC("spinlock_unlock_internal: interrupts enabled while locked.");
+	}
+	lock->holder = NULL;
+#endif	/* _DEBUG_SPINLOCK */
+#ifdef _LOCKSTAT
+	lockstat_released(&lock->stat);
+#endif	/* _LOCKSTAT */
+
+	leave_cs_barrier();
+	lock->serving = lock->serving + 1;
 }
 
 /**
@@ -44,7 +99,7 @@ void spinlock_acquire(struct spinlock *lock)
 	 */
 	state = local_irq_disable();
 
-	spinlock_lock_internal(lock);
+	spinlock_lock_internal(lock, LOCK_CALLER);
 	lock->state = state;
 	enter_cs_barrier();
 }
@@ -65,8 +120,7 @@ void spinlock_release(struct spinlock *lock)
 	 */
 	state = lock->state;
 
-	leave_cs_barrier();
-	lock->value = 1;
+	spinlock_unlock_internal(lock);
 	local_irq_restore(state);
 }
 
@@ -74,9 +128,36 @@ void spinlock_acquire_noirq(struct spinlock *lock)
 {
 	ASSERT(!local_irq_state());
 
-	spinlock_lock_internal(lock);
+	spinlock_lock_internal(lock, LOCK_CALLER);
+
+	enter_cs_barrier();
+}
+
+/**
+ * Acquire a spinlock only if it is free, return FALSE instead of spinning
+ */
+boolean_t spinlock_try_acquire_noirq(struct spinlock *lock)
+{
+	uint32_t ticket;
+
+	ASSERT(!local_irq_state());
+
+	/* The lock is free if nobody holds a ticket beyond the one served */
+	ticket = lock->serving;
+	if (!atomic_tas(&lock->next, ticket, ticket + 1)) {
+		return FALSE;
+	}
+
+#ifdef _DEBUG_SPINLOCK
+	lock->holder = CURR_CORE;
+#endif	/* _DEBUG_SPINLOCK */
+#ifdef _LOCKSTAT
+	lockstat_acquired(&lock->stat, lock->name, LOCKSTAT_SPINLOCK,
+			  LOCK_CALLER, x86_rdtsc(), FALSE);
+#endif	/* _LOCKSTAT */
 
 	enter_cs_barrier();
+	return TRUE;
 }
 
 void spinlock_release_noirq(struct spinlock *lock)
@@ -85,8 +166,7 @@ void spinlock_release_noirq(struct spinlock *lock)
 		PANIC("spinlock_release_noirq: release a lock not held.");
 	}
 
-	leave_cs_barrier();
-	lock->value = 1;
+	spinlock_unlock_internal(lock);
 }
 
 /**
@@ -94,7 +174,85 @@ void spinlock_release_noirq(struct spinlock *lock)
  */
 void spinlock_init(struct spinlock *lock, const char *name)
 {
-	lock->value = 1;
+	lock->next = 0;
+	lock->serving = 0;
 	lock->name = name;
 	lock->state = FALSE;
+#ifdef _DEBUG_SPINLOCK
+	lock->holder = NULL;
+	lock->nr_contended = 0;
+#endif	/* _DEBUG_SPINLOCK */
+#ifdef _LOCKSTAT
+	lock->stat.site = NULL;
+#endif	/* _LOCKSTAT */
+}
+
+/**
+ * Acquire a reader-writer spinlock for reading, returns the interrupt state
+ * to pass to rwspinlock_read_release().
+ */
+boolean_t rwspinlock_read_acquire(struct rwspinlock *lock)
+{
+	boolean_t state;
+
+	state = local_irq_disable();
+
+	/* The writer raises its count before it checks the readers, and we
+	 * raise ours before we check the writer, so one of us backs off.
+	 */
+	while (TRUE) {
+		while (lock->writers) {
+			core_spin_hint();
+		}
+
+		atomic_inc(&lock->readers);
+		if (!lock->writers) {
+			break;
+		}
+		atomic_dec(&lock->readers);
+	}
+
+	enter_cs_barrier();
+	return state;
+}
+
+void rwspinlock_read_release(struct rwspinlock *lock, boolean_t state)
+{
+	ASSERT(lock->readers > 0);
+
+	leave_cs_barrier();
+	atomic_dec(&lock->readers);
+	local_irq_restore(state);
+}
+
+/**
+ * Acquire a reader-writer spinlock for writing, new readers are held off
+ * while we wait for the current ones to leave.
+ */
+void rwspinlock_write_acquire(struct rwspinlock *lock)
+{
+	spinlock_acquire(&lock->wlock);
+
+	atomic_inc(&lock->writers);
+	while (lock->readers) {
+		core_spin_hint();
+	}
+
+	enter_cs_barrier();
+}
+
+void rwspinlock_write_release(struct rwspinlock *lock)
+{
+	ASSERT(lock->writers == 1);
+
+	leave_cs_barrier();
+	atomic_dec(&lock->writers);
+	spinlock_release(&lock->wlock);
+}
+
+void rwspinlock_init(struct rwspinlock *lock, const char *name)
+{
+	lock->readers = 0;
+	lock->writers = 0;
+	spinlock_init(&lock->wlock, name);
 }
@@ -9,4 +9,10 @@
 /* Barrier for leaving a critical section */
 #define leave_cs_barrier()	asm volatile("" ::: "memory")
 
+/* Full barrier, orders the stores before it against the loads after it */
+#define smp_mb()		asm volatile("lock; addl $0, 0(%%esp)" ::: "memory")
+
+/* Write barrier, x86 does not reorder stores against other stores */
+#define smp_wmb()		asm volatile("" ::: "memory")
+
 #endif	/* __BARRIER_H__ */
@@ -3,6 +3,7 @@
 
 #include <types.h>
 #include "list.h"
+#include "atomic.h"
 
 #define MINORBITS	20
 #define MINORMASK	((1U << MINORBITS) - 1)
@@ -28,7 +29,7 @@ struct dev {
 	
 	dev_t dev;		// ID for this device
 	
-	int ref_count;		// Reference count for this device
+	atomic_t ref_count;	// Reference count for this device
 	int flags;		// Flags for this device
 	void *data;		// Pointer to private data
 
@@ -9,12 +9,16 @@ struct fd_table {
 	size_t slots_count;		// Count of the slots in this table
 	int ref_count;			// Reference count of this table
 	struct vfs_node **nodes;	// Pointer to the VFS nodes
+	int *flags;			// Flags of each descriptor
 };
 typedef struct fd_table fd_table_t;
 
 extern struct vfs_node *fd_2_vfs_node(struct process *p, int fd);
 extern int fd_attach(struct process *p, struct vfs_node *n);
 extern int fd_detach(struct process *p, int fd);
+extern int fd_get_flags(struct process *p, int fd);
+extern int fd_set_flags(struct process *p, int fd, int flags);
+extern void fd_close_on_exec(struct process *p);
 extern fd_table_t *fd_table_create();
 extern void fd_table_destroy(fd_table_t *table);
 extern fd_table_t *fd_table_clone(fd_table_t *src);
@@ -0,0 +1,8 @@
+#ifndef __FUTEX_H__
+#define __FUTEX_H__
+
+extern int futex_wait(int32_t *uaddr, int32_t val, useconds_t timeout);
+extern int futex_wake(int32_t *uaddr, int count);
+extern void init_futex();
+
+#endif	/* __FUTEX_H__ */
@@ -33,6 +33,10 @@
 #define X86_CR0_WP		(1<<16)		// Write Protect
 #define X86_CR0_PG		(1<<31)		// Paging Enabled
 
+/* Flags in CR4 */
+#define X86_CR4_OSFXSR		(1<<9)		// FXSAVE/FXRSTOR and SSE enable
+#define X86_CR4_OSXMMEXCPT	(1<<10)		// Unmasked SSE exception support
+
 /* Flags in DR6 (Debug Status Register) */
 #define X86_DR6_B0		(1<<0)		// Breakpoint 0 condition detected
 #define X86_DR6_B1		(1<<1)		// Breakpoint 1 condition detected
@@ -181,6 +185,7 @@ struct arch_core {
 	/* Per CORE structures */
 	struct gdt gdt[NR_GDT_ENTRIES];	// Array of GDT descriptors
 	struct tss tss;			// Task State Segment
+	ptr_t tls_base;			// Base of the TLS segment in the GDT
 	void *double_fault_stack;	// Pointer to the stack for double faults
 
 	/* Time conversion factors */
@@ -200,16 +205,25 @@ struct arch_core {
 /* CORE ID */
 typedef uint32_t core_id_t;
 
+/* Position of a CORE in the CPU topology, decoded from its APIC ID */
+struct core_topology {
+	uint32_t package;		// Physical package (socket)
+	uint32_t core;			// Physical core in the package
+	uint32_t thread;		// SMT thread in the physical core
+};
+
 /* Forward declarations */
 struct va_space;
 struct thread;
 struct sched_core;
+struct rcu_core;
 
 struct core {
 	struct list link;		// Link to running COREs list
 
 	core_id_t id;			// ID of this CORE
 	struct arch_core arch;		// Architecture specific information
+	struct core_topology topo;	// Position in the CPU topology
 	
 	/* Current state of the CORE */
 	enum {
@@ -224,6 +238,22 @@ struct core {
 	struct spinlock timer_lock;	// Lock to protect timers list
 	struct list timers;		// List of active timers
 	boolean_t timer_enabled;	// Whether timer is enabled on this CORE
+	boolean_t tick_stopped;		// No periodic tick while idle
+	useconds_t timer_deadline;	// Time the timer hardware fires next
+	uint32_t timer_irqs;		// Timer interrupts received
+	uint32_t timer_window_irqs;	// Timer interrupts in current window
+	useconds_t timer_window_start;	// Start of current window
+	uint32_t timer_irq_rate;	// Timer interrupts per second
+	uint32_t resched_ipis;		// Reschedule IPIs received
+	volatile boolean_t tlb_flush;	// Another CORE asked for a TLB flush
+
+	/* RCU information */
+	struct rcu_core *rcu;		// Grace period state and queued callbacks
+	uint32_t rcu_nesting;		// Depth of read-side sections
+
+	/* Memory management information */
+	struct list kstacks;		// Kernel stacks cached on this CORE
+	size_t nr_kstacks;		// Number of cached kernel stacks
 };
 typedef struct core core_t;
 
@@ -356,6 +386,21 @@ static INLINE void x86_write_cr3(uint32_t val)
 	asm volatile("mov %0, %%cr3" :: "r"(val));
 }
 
+/* Read CR4 */
+static INLINE uint32_t x86_read_cr4()
+{
+	uint32_t r;
+
+	asm volatile("mov %%cr4, %0" : "=r"(r));
+	return r;
+}
+
+/* Write CR4 */
+static INLINE void x86_write_cr4(uint32_t val)
+{
+	asm volatile("mov %0, %%cr4" :: "r"(val));
+}
+
 /* Read an MSR */
 static INLINE uint64_t x86_read_msr(uint32_t msr)
 {
@@ -377,6 +422,14 @@ static INLINE void x86_coreid(uint32_t level, uint32_t *a, uint32_t *b, uint32_t
 	asm volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "0"(level));
 }
 
+/* Execute the COREID instruction with a sub-leaf */
+static INLINE void x86_coreid_count(uint32_t level, uint32_t count, uint32_t *a,
+				    uint32_t *b, uint32_t *c, uint32_t *d)
+{
+	asm volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+		     : "0"(level), "2"(count));
+}
+
 /* Invalidate a TLB entry */
 static INLINE void x86_invlpg(uint32_t addr)
 {
@@ -392,14 +445,15 @@ static INLINE uint64_t x86_rdtsc()
 	return ((uint64_t)high << 32) | low;
 }
 
-/* Get the current CORE pointer, the pointer was set when we initialize
- * the GDT for the CORE
+/* Get the current CORE pointer. FS in the kernel is based at the arch
+ * CORE structure which starts with a pointer to the CORE, the segment was
+ * set when we initialize the GDT for the CORE.
  */
 static INLINE struct core *core_get_pointer()
 {
 	uint32_t addr;
 
-	addr = (uint32_t)x86_read_msr(X86_MSR_GS_BASE);
+	asm volatile("mov %%fs:0, %0" : "=r"(addr));
 	ASSERT(addr == (uint32_t)&_boot_core);
 	return (struct core *)addr;
 }
@@ -418,6 +472,20 @@ static INLINE void core_idle()
 	asm volatile("sti;hlt;cli");
 }
 
+/* Arm the address monitoring hardware on the cache line of addr */
+static INLINE void core_monitor(const volatile void *addr)
+{
+	asm volatile("monitor" :: "a"(addr), "c"(0), "d"(0));
+}
+
+/* Yield the CORE until the monitored line is written or an interrupt
+ * arrives. The sti takes effect after mwait so no interrupt is lost.
+ */
+static INLINE void core_mwait()
+{
+	asm volatile("sti;mwait;cli" :: "a"(0), "c"(0));
+}
+
 /* CORE-specific spin loop hint */
 static INLINE void core_spin_hint()
 {
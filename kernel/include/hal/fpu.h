@@ -0,0 +1,15 @@
+#ifndef __FPU_H__
+#define __FPU_H__
+
+struct thread;
+struct core;
+
+/* Size of the FXSAVE area */
+#define FPU_STATE_SIZE	512
+
+extern void fpu_switch(struct thread *prev);
+extern int fpu_restore();
+extern void fpu_free(struct thread *t);
+extern void init_fpu(struct core *c);
+
+#endif	/* __FPU_H__ */
@@ -27,7 +27,17 @@
 #define ICW4_SFNM	0x10		// Special fully nested (not)
 
 
-#define NR_GDT_ENTRIES	6
+#define NR_GDT_ENTRIES	8
+
+/* Segment of the per CORE data, loaded into FS in the kernel. The selector
+ * is also defined in hal/interrupt.s.
+ */
+#define GDT_CORE_ENTRY	6
+#define GDT_CORE_SEL	(GDT_CORE_ENTRY * 8)
+
+/* Segment of the user thread local storage, loaded into GS */
+#define GDT_TLS_ENTRY	7
+#define GDT_TLS_SEL	((GDT_TLS_ENTRY * 8) | 3)
 
 /*
  * The definition of GDT entry.
@@ -142,6 +152,9 @@ extern void local_irq_restore(boolean_t state);
 extern void local_irq_done(uint32_t int_no);
 extern void set_kernel_stack(void *stack);
 
+struct core;
+extern void gdt_set_tls(struct core *c, ptr_t base);
+
 /* Declaration of the interrupt service routines */
 extern void isr0();
 extern void isr1();
@@ -196,5 +209,7 @@ extern void irq15();
 extern void irq240();	// Interrupt handler for APIC
 extern void irq241();
 extern void irq242();
+extern void irq243();
+extern void irq244();
 
 #endif	/* __HAL_H__ */
@@ -39,6 +39,8 @@
 #define LAPIC_VECT_TIMER		0xF0
 #define LAPIC_VECT_SPURIOUS		0xF1
 #define LAPIC_VECT_IPI			0xF2
+#define LAPIC_VECT_RESCHED		0xF3
+#define LAPIC_VECT_TLB			0xF4
 
 /* IPI delivery modes */
 #define LAPIC_IPI_FIXED			0x00	// Fixed (vector specified)
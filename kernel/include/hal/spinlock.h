@@ -2,27 +2,65 @@
 #define __SPINLOCK_H__
 
 #include "atomic.h"
+#include "lockstat.h"
 
+/* Forward declaration of core */
+struct core;
+
+/*
+ * Ticket lock, waiters are served in the order they arrived. The lock is
+ * free when the ticket being served equals the next ticket to hand out.
+ */
 struct spinlock {
-	atomic_t value;
+	atomic_t next;			// Next ticket to hand out
+	volatile uint32_t serving;	// Ticket of the holder
 
 	/* State of the IRQ */
 	volatile boolean_t state;
 	
 	const char *name;
+
+#ifdef _DEBUG_SPINLOCK
+	struct core *holder;		// CORE holding the lock
+	uint32_t nr_contended;		// Acquisitions that had to wait
+#endif	/* _DEBUG_SPINLOCK */
+
+#ifdef _LOCKSTAT
+	struct lockstat_hold stat;	// Call site of the holder
+#endif	/* _LOCKSTAT */
 };
 typedef struct spinlock spinlock_t;
 
+/* Static initializer of a spinlock */
+#define SPINLOCK_INITIALIZER(n)	{ .next = 0, .serving = 0, .name = n }
 
 static INLINE boolean_t spinlock_held(struct spinlock *lock)
 {
-	return lock->value != 1;
+	return (uint32_t)lock->next != lock->serving;
 }
 
+/*
+ * Spinning reader-writer lock for short read-mostly sections. The writers
+ * are serialized by a spinlock, and a reader does not enter while a writer
+ * holds the lock.
+ */
+struct rwspinlock {
+	atomic_t readers;		// Readers holding the lock
+	atomic_t writers;		// Writer holding the lock
+	struct spinlock wlock;		// Lock to serialize the writers
+};
+typedef struct rwspinlock rwspinlock_t;
+
 extern void spinlock_init(struct spinlock *lock, const char *name);
 extern void spinlock_acquire(struct spinlock *lock);
 extern void spinlock_acquire_noirq(struct spinlock *lock);
+extern boolean_t spinlock_try_acquire_noirq(struct spinlock *lock);
 extern void spinlock_release(struct spinlock *lock);
 extern void spinlock_release_noirq(struct spinlock *lock);
+extern boolean_t rwspinlock_read_acquire(struct rwspinlock *lock);
+extern void rwspinlock_read_release(struct rwspinlock *lock, boolean_t state);
+extern void rwspinlock_write_acquire(struct rwspinlock *lock);
+extern void rwspinlock_write_release(struct rwspinlock *lock);
+extern void rwspinlock_init(struct rwspinlock *lock, const char *name);
 
 #endif	/* __SPINLOCK_H__ */
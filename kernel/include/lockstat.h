@@ -0,0 +1,57 @@
+#ifndef __LOCKSTAT_H__
+#define __LOCKSTAT_H__
+
+#include <types.h>
+
+/* Address the lock function was called from */
+#define LOCK_CALLER	((ptr_t)__builtin_return_address(0))
+
+#ifdef _LOCKSTAT
+
+/* Kinds of locks */
+#define LOCKSTAT_SPINLOCK	0
+#define LOCKSTAT_MUTEX		1
+
+/*
+ * Contention statistics. A lock class is the name the lock was initialized
+ * with, the statistics of a class are also kept for each call site that
+ * takes it. Times are in TSC cycles.
+ */
+struct lockstat {
+	uint32_t acquires;		// Times the lock was taken
+	uint32_t contended;		// Acquisitions that had to wait
+	uint64_t wait_total;		// Cycles spent waiting
+	uint64_t wait_max;		// Longest wait
+	uint64_t hold_total;		// Cycles the lock was held
+	uint64_t hold_max;		// Longest hold
+};
+
+struct lockstat_class {
+	const char *name;		// Name of the locks in the class
+	int type;			// Spinlock or mutex
+	struct lockstat stat;
+};
+
+struct lockstat_site {
+	volatile ptr_t ip;		// Call site, 0 if the slot is free
+	const char *name;		// Name of the lock taken here
+	struct lockstat_class *class;	// Class of the lock taken here
+	struct lockstat stat;
+};
+
+/* Embedded in a lock, the site of the current holder */
+struct lockstat_hold {
+	struct lockstat_site *site;
+	uint64_t since;			// TSC when the lock was taken
+};
+
+extern void lockstat_acquired(struct lockstat_hold *h, const char *name,
+			      int type, ptr_t ip, uint64_t start,
+			      boolean_t contended);
+extern void lockstat_released(struct lockstat_hold *h);
+extern void lockstat_reset();
+extern void init_lockstat();
+
+#endif	/* _LOCKSTAT */
+
+#endif	/* __LOCKSTAT_H__ */
@@ -0,0 +1,17 @@
+#ifndef __ICACHE_H__
+#define __ICACHE_H__
+
+struct vfs_node;
+
+/* Tunable of the image cache */
+extern uint32_t _icache_max_pages;
+
+extern int icache_get(struct vfs_node *n, uint32_t offset, uint32_t *framep);
+extern void icache_put(struct vfs_node *n, uint32_t offset, uint32_t frame);
+extern void icache_invalidate(struct vfs_node *n);
+extern uint32_t icache_reclaim(uint32_t nr);
+extern uint32_t icache_reclaim_frames(uint32_t nr);
+extern void icache_wakeup();
+extern void init_icache();
+
+#endif	/* __ICACHE_H__ */
@@ -0,0 +1,10 @@
+#ifndef __KSM_H__
+#define __KSM_H__
+
+/* Tunables of the same page merging scanner */
+extern uint32_t _ksm_pages_to_scan;
+extern useconds_t _ksm_sleep_time;
+
+extern void init_ksm();
+
+#endif	/* __KSM_H__ */
@@ -0,0 +1,8 @@
+#ifndef __KSTACK_H__
+#define __KSTACK_H__
+
+extern void *kstack_alloc();
+extern void kstack_free(void *stack);
+extern void init_kstack();
+
+#endif	/* __KSTACK_H__ */
@@ -11,6 +11,8 @@
  * +------------+
  * | 0xC0000000 | Kernel memory pool started address
  * +------------+
+ * | 0xD0000000 | Kernel stack area
+ * +------------+
  */
 
 /* Our kernel stack size is 8192 bytes */
@@ -23,4 +25,9 @@
 /* Minimum size of the kernel memory pool */
 #define KERNEL_KMEM_SIZE	0x00800000
 
+/* Start address of the kernel stack area */
+#define KERNEL_KSTACK_START	0xD0000000
+/* Size of the kernel stack area */
+#define KERNEL_KSTACK_SIZE	0x01000000
+
 #endif	/* __MLAYOUT_H__ */
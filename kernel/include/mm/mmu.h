@@ -43,6 +43,8 @@ extern struct mmu_ctx *mmu_create_ctx();
 extern struct page *mmu_get_page(struct mmu_ctx *ctx, ptr_t addr, boolean_t make, int mmflag);
 extern int mmu_map(struct mmu_ctx *ctx, ptr_t virt, phys_addr_t phys, int flags);
 extern int mmu_unmap(struct mmu_ctx *ctx, ptr_t virt, boolean_t shared, phys_addr_t *physp);
+extern boolean_t mmu_private_ptbl(struct mmu_ctx *ctx, ptr_t virt);
+extern int mmu_unshare_page(struct mmu_ctx *ctx, ptr_t virt);
 extern void mmu_load_ctx(struct mmu_ctx *ctx);
 extern void mmu_clone_ctx(struct mmu_ctx *dst, struct mmu_ctx *src);
 extern void mmu_destroy_ctx(struct mmu_ctx *ctx);
@@ -30,13 +30,20 @@ struct page {
 	uint32_t global:1;	// Global; if CR4.PGE = 1, determines whether
 				// the translation is global
 	
-	uint32_t reserved:3;	// Reserved bits
+	uint32_t shared:1;	// Available to software; the frame is shared
+				// and write protected, copy it on write
+	
+	uint32_t reserved:2;	// Reserved bits
 	uint32_t frame:20;	// Frame address
 };
 
 extern void page_early_alloc(phys_addr_t *phys, size_t size, boolean_t align);
 extern void page_alloc(struct page *p, int flags);
 extern void page_free(struct page *p);
+extern void page_ref(uint32_t frame);
+extern uint32_t page_unref(uint32_t frame);
+extern uint32_t page_refcount(uint32_t frame);
+extern boolean_t page_low();
 extern void page_copy(phys_addr_t dst, phys_addr_t src);
 extern void phys_alloc(phys_size_t size, phys_addr_t align, phys_addr_t minaddr,
 		       phys_addr_t maxaddr, int flags, phys_addr_t *basep);
@@ -1,10 +1,31 @@
 #ifndef __VA_H__
 #define __VA_H__
 
+#include "list.h"
+#include "atomic.h"
+#include "mutex.h"
 #include "mm/mmu.h"
 
+struct vfs_node;
+
 struct va_space {
 	struct mmu_ctx *mmu;
+	atomic_t ref_count;		// The owner and the scanners pinning it
+	struct mutex lock;		// Serializes the faults and mappings
+	struct list regions;		// Regions mapped on demand
+};
+
+/* A region whose pages are allocated on first touch. The part below
+ * file_end is read from the file, the rest is zero filled.
+ */
+struct va_region {
+	struct list link;		// Link to the address space
+	ptr_t start;			// Start address
+	ptr_t end;			// End address
+	ptr_t file_end;			// End of the file backed part
+	struct vfs_node *node;		// File to read the content from
+	uint32_t offset;		// File offset of the start address
+	int flags;			// Map flags
 };
 
 /* Map flags for va_map */
@@ -12,11 +33,17 @@ struct va_space {
 #define VA_MAP_WRITE	(1<<1)
 #define VA_MAP_EXEC	(1<<2)
 #define VA_MAP_FIXED	(1<<3)
+#define VA_MAP_EXCL	(1<<4)	// Fail if any part of the range is mapped
 
 extern struct va_space *va_create();
+extern void va_ref(struct va_space *vas);
 extern void va_destroy(struct va_space *vas);
 extern int va_map(struct va_space *vas, ptr_t start, size_t size, int flags, ptr_t *addrp);
 extern int va_unmap(struct va_space *vas, ptr_t start, size_t size);
+extern int va_map_file(struct va_space *vas, ptr_t start, size_t size,
+		       int flags, struct vfs_node *n, uint32_t offset,
+		       size_t filesz);
+extern int va_fault(struct va_space *vas, ptr_t addr);
 extern void va_switch(struct va_space *vas);
 extern void init_va();
 
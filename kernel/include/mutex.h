@@ -13,12 +13,19 @@ struct mutex {
 	atomic_t value;		// Lock count
 	int flags;		// Behaviour flags for the mutex
 	struct spinlock lock;	// Lock to protect the thread list
-	struct list threads;	// List of waiting threads
+	struct list threads;	// Waiting threads, highest priority first
 	struct thread *owner;	// Owner of the lock
+	struct list pi_link;	// Link to the owner's mutexes that have waiters
 	const char *name;	// Name of the mutex
+#ifdef _LOCKSTAT
+	struct lockstat_hold stat;	// Call site of the owner
+#endif	/* _LOCKSTAT */
 };
 typedef struct mutex mutex_t;
 
+/* Times a contender polls the mutex before it sleeps */
+extern uint32_t _mutex_spin_limit;
+
 static INLINE boolean_t mutex_held(struct mutex *m) {
 	return m->value != 0;
 }
@@ -26,5 +33,6 @@ static INLINE boolean_t mutex_held(struct mutex *m) {
 extern void mutex_acquire(struct mutex *m);
 extern void mutex_release(struct mutex *m);
 extern void mutex_init(struct mutex *m, const char *name, int flags);
+extern void mutex_pi_update(struct thread *t);
 
 #endif	/* __MUTEX_H__ */
@@ -8,6 +8,9 @@
 #include "list.h"
 #include "rtl/avltree.h"
 #include "rtl/notifier.h"
+#include "rtl/bitmap.h"
+#include "mutex.h"
+#include "rcu.h"
 #include "proc/thread.h"
 #include "fs.h"
 #include "fd.h"			// File descriptors
@@ -16,6 +19,12 @@
 /* Bottom of the user stack */
 #define USTACK_BOTTOM	0x30000000
 
+/* Stacks of the threads created from user mode, each of them has a guard
+ * page below it.
+ */
+#define UTHREAD_STACK_START	0x31000000
+#define NR_UTHREAD_STACKS	64
+
 /* Forward declaration, used to pass arguments */
 struct process_creation;
 
@@ -35,6 +44,12 @@ struct process {
 
 	struct list threads;			// List of threads
 
+	/* User thread information */
+	struct mutex lock;			// Lock for the fields below
+	struct list joins;			// Join records of user threads
+	struct bitmap ustacks;			// Stack slots in use
+	u_long ustacks_buf[NR_UTHREAD_STACKS / 32];
+
 	/* Signal information */
 	sigset_t signal_mask;			// Bitmap of masked signals
 	struct sigaction signal_act[NSIG];
@@ -50,6 +65,8 @@ struct process {
 
 	/* Other process information */
 	struct avl_tree_node tree_link;		// Link to the process tree
+	struct list hash_link;			// Link to the pid hash table
+	struct rcu_head rcu;			// Frees the process after lookups
 
 	struct notifier death_notifier;		// Notifier list of this process
 
@@ -69,6 +86,7 @@ typedef struct process process_t;
 extern struct process *_kernel_proc;
 
 extern struct process *process_lookup(pid_t pid);
+extern int process_iterate(int (*func)(struct process *, void *), void *ctx);
 
 extern void process_attach(struct process *p, struct thread *t);
 extern void process_detach(struct thread *t);
@@ -77,8 +95,12 @@ extern int process_exit(int status);
 extern int process_create(const char **args, struct process *parent, int flags,
 			  int priority, struct process **procp);
 extern int process_destroy(struct process *proc);
+extern int process_replace(const char *path, const char *args[]);
+extern char **process_dup_args(const char *argv[]);
 
 extern int process_wait(struct process *p, void *sync);
+extern int process_alloc_ustack(struct process *p, ptr_t *stackp);
+extern void process_free_ustack(struct process *p, ptr_t stack);
 extern int process_getid();
 
 extern void init_process();
@@ -1,11 +1,26 @@
-#ifndef __SCHED_H__
-#define __SCHED_H__
+#ifndef __PROC_SCHED_H__
+#define __PROC_SCHED_H__
+
+#include <sched.h>
+
+/* Rank of a policy and priority, a higher rank runs first */
+static INLINE int sched_prio_rank(int policy, int priority)
+{
+	return (policy == SCHED_OTHER) ? priority :
+		(SCHED_PRIORITY_MAX + 1 + priority);
+}
 
 extern void sched_insert_thread(struct thread *t);
 extern void sched_post_switch(boolean_t state);
 extern void sched_reschedule(boolean_t state);
+extern void sched_yield();
+extern void sched_preempt();
+extern void sched_tick();
+extern int sched_set_policy(struct thread *t, int policy, int priority);
+extern int sched_set_affinity(struct thread *t, cpu_set_t *mask);
+extern boolean_t sched_set_boost(struct thread *t, int policy, int priority);
 extern void sched_enter();
 extern void init_sched_percore();
 extern void init_sched();
 
-#endif	/* __SCHED_H__ */
+#endif	/* __PROC_SCHED_H__ */
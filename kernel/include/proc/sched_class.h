@@ -0,0 +1,122 @@
+#ifndef __SCHED_CLASS_H__
+#define __SCHED_CLASS_H__
+
+#include "list.h"
+#include "hal/spinlock.h"
+#include "rtl/avltree.h"
+#include "timer.h"
+#include "proc/sched_stat.h"
+
+/* Number of real time priorities */
+#define NR_RT_PRIORITIES	32
+
+struct thread;
+struct sched_core;
+
+/* Balancing domains, from the closest COREs to the whole system */
+#define SD_SMT		0		// SMT siblings of a physical core
+#define SD_PACKAGE	1		// COREs in the same package
+#define SD_SYSTEM	2		// All the COREs
+#define NR_SCHED_DOMAINS	3
+
+/* Flags of enqueue and dequeue */
+#define SCHED_WAKEUP	(1<<0)		// Thread just became ready
+#define SCHED_SLEEP	(1<<1)		// Thread is going to sleep or die
+#define SCHED_PREEMPT	(1<<2)		// Running thread was preempted
+#define SCHED_MIGRATE	(1<<3)		// Thread is moved to another CORE
+
+/*
+ * A scheduling class owns the run queue of its threads on each CORE. All
+ * the operations are called with the lock of the CORE scheduler held, the
+ * running thread is never in the run queue.
+ */
+struct sched_class {
+	const char *name;
+
+	/* Initialize the run queue of the CORE */
+	void (*init)(struct sched_core *c);
+
+	/* Add a ready thread to the run queue */
+	void (*enqueue)(struct sched_core *c, struct thread *t, int flags);
+
+	/* Remove a thread from the run queue */
+	void (*dequeue)(struct sched_core *c, struct thread *t, int flags);
+
+	/* Remove the next thread to run from the run queue, NULL if empty */
+	struct thread *(*pick)(struct sched_core *c);
+
+	/* Account the time the running thread has run */
+	void (*charge)(struct sched_core *c, struct thread *t, useconds_t delta);
+
+	/* Time the thread may run before it is preempted */
+	useconds_t (*slice)(struct sched_core *c, struct thread *t);
+
+	/* The running thread gives up the CORE */
+	void (*yield)(struct sched_core *c, struct thread *t);
+
+	/* Whether t should preempt curr of the same class, may be NULL */
+	boolean_t (*preempt)(struct sched_core *c, struct thread *t,
+			     struct thread *curr);
+
+	/* Find a ready thread to move to CORE dst, it is left queued */
+	struct thread *(*steal)(struct sched_core *c, struct core *dst);
+};
+
+/* Run queue of the real time class */
+struct rt_queue {
+	u_long bitmap;				// Bitmap of priorities with threads
+	struct list threads[NR_RT_PRIORITIES];	// Ready threads of each priority
+	size_t nr_ready;			// Number of ready threads
+	useconds_t period_start;		// Start of the throttling period
+	useconds_t runtime;			// Time used in the period
+	boolean_t throttled;			// Runtime of the period used up
+	uint32_t nr_throttled;			// Number of times throttled
+};
+
+/* Run queue of the fair class */
+struct fair_queue {
+	struct avl_tree tree;			// Ready threads by virtual runtime
+	uint64_t min_vruntime;			// Monotonic minimum virtual runtime
+	uint32_t load;				// Total weight of the ready threads
+	size_t nr_ready;			// Number of ready threads
+};
+
+/* Per-CORE scheduling information structure */
+struct sched_core {
+	struct spinlock lock;			// Lock to protect information/queues
+	
+	struct thread *prev_thread;		// Previously executed thread
+	struct thread *idle_thread;		// Thread scheduled when no other threads runnable
+
+	struct timer timer;			// Preemption timer
+	volatile boolean_t need_resched;	// Current thread should be preempted
+	volatile boolean_t polling;		// Idle thread waits on need_resched
+	boolean_t migrate_prev;			// Previous thread moves to another CORE
+	boolean_t yielded;			// Running thread gave up the CORE
+	struct rt_queue rt;			// Run queue of the real time class
+	struct fair_queue fair;			// Run queue of the fair class
+	
+	size_t total;				// Total running/ready thread count
+
+	/* Load balancing and queue length statistics */
+	uint32_t ticks;				// Ticks since the CORE started
+	uint32_t samples;			// Number of queue length samples
+	uint64_t sum_queued;			// Sum of the sampled queue lengths
+	size_t max_queued;			// Longest queue length sampled
+	uint32_t nr_pulled[NR_SCHED_DOMAINS];	// Threads pulled in each domain
+	uint32_t nr_stolen;			// Threads stolen when idle
+	uint32_t nr_polled;			// Remote wakeups that needed no IPI
+	struct sched_stat stat;			// Latency histograms
+};
+typedef struct sched_core sched_core_t;
+
+extern struct sched_class _rt_sched_class;
+extern struct sched_class _fair_sched_class;
+
+/* Real time threads may use _rt_runtime out of every _rt_period */
+extern useconds_t _rt_period;
+extern useconds_t _rt_runtime;
+
+extern boolean_t sched_can_migrate(struct thread *t, struct core *dst);
+
+#endif	/* __SCHED_CLASS_H__ */
@@ -0,0 +1,34 @@
+#ifndef __SCHED_STAT_H__
+#define __SCHED_STAT_H__
+
+#include <types.h>
+
+/* Buckets of a latency histogram, bucket n counts samples below 2^n us */
+#define NR_SCHED_HIST_BUCKETS	24
+
+struct thread;
+struct sched_core;
+
+/* Log2 histogram of a scheduling latency */
+struct sched_hist {
+	uint32_t buckets[NR_SCHED_HIST_BUCKETS];
+	uint32_t count;			// Number of samples
+	uint64_t sum;			// Sum of the samples in microseconds
+	uint32_t max;			// Largest sample in microseconds
+};
+
+/* Per-CORE scheduling latency statistics */
+struct sched_stat {
+	struct sched_hist wakeup;	// From wake up to running
+	struct sched_hist runq;		// Time on the run queue for any reason
+	struct sched_hist slice;	// Time run between two reschedules
+};
+
+extern void sched_stat_enqueue(struct thread *t, boolean_t wakeup);
+extern void sched_stat_dequeue(struct sched_core *c, struct thread *t);
+extern void sched_stat_switch(struct sched_core *c, struct thread *prev,
+			      boolean_t voluntary);
+extern void sched_stat_slice(struct sched_core *c, useconds_t ran);
+extern void init_sched_stat();
+
+#endif	/* __SCHED_STAT_H__ */
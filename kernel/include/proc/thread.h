@@ -1,6 +1,7 @@
 #ifndef __THREAD_H__
 #define __THREAD_H__
 
+#include <sched.h>
 #include "list.h"
 #include "matrix/const.h"
 #include "hal/core.h"
@@ -9,26 +10,38 @@
 #include "rtl/notifier.h"
 #include "timer.h"
 #include "proc/signal.h"
+#include "semaphore.h"
 
 struct process;
+struct sched_class;
 
 /* Thread entry definition */
 typedef void (*thread_func_t)(void *);
 
 /* x86-specific thread structure */
 struct arch_thread {
-	void *esp;			// Stack pointer
-	void *ebp;			// Base pointer
-	void *eip;			// Instruction pointer
+	void *esp;			// Saved kernel stack pointer
+	void *fpu;			// FPU/SSE state, allocated on first use
+	ptr_t tls;			// Base of the user TLS segment
 };
 
 /* Thread creation arguments structure, for thread_uspace_wrapper() */
 struct thread_uspace_creation {
 	ptr_t entry;			// Instruction pointer
 	ptr_t esp;			// Stack pointer
+	ptr_t func;			// Function the entry should call
 	ptr_t args;			// Argument
 };
 
+/* Exit status of a user thread, kept in its owner until it is joined */
+struct thread_join {
+	struct list link;		// Link to the owner process
+	tid_t id;			// ID of the thread
+	int status;			// Exit status of the thread
+	boolean_t joining;		// Some thread is waiting for it
+	struct semaphore sem;		// Signaled when the thread exits
+};
+
 /* Definition of a thread */
 struct thread {
 	/* Architecture thread implementation */
@@ -58,15 +71,34 @@ struct thread {
 	void *args;			// Argument to thread entry function
 
 	/* Scheduling information */
-	struct list runq_link;		// Link to run queues
+	struct list runq_link;		// Link to the run queue or dead list
 	struct core *core;		// CORE that the thread runs on
+	cpu_set_t affinity;		// COREs the thread may run on
 	useconds_t quantum;		// Current quantum
+	struct sched_class *sched_class;// Scheduling class of the thread
+	int policy;			// Scheduling policy of the thread
+	int base_policy;		// Policy set by sched_set_policy()
+	int base_priority;		// Priority set by sched_set_policy()
+	int pi_policy;			// Policy inherited from mutex waiters
+	int pi_priority;		// Priority inherited from mutex waiters
+	struct avl_tree_node runq_node;	// Link to the fair run queue
+	uint64_t vruntime;		// Virtual runtime in the fair class
+	useconds_t exec_start;		// Time the thread was switched to
+	useconds_t sum_exec;		// Total time the thread has run
+	useconds_t sum_wait;		// Total time the thread was ready
+	uint64_t enqueue_tsc;		// TSC when the thread was queued
+	boolean_t woken;		// Queued by a wake up
+	uint32_t nr_voluntary;		// Switches by sleeping or yielding
+	uint32_t nr_involuntary;	// Switches by preemption
 
 	/* Sleeping information */
 	struct spinlock *wait_lock;	// Lock to acquire when perform waiting
 	struct list wait_link;		// Link to a waiting list
+	struct mutex *blocked_on;	// Mutex the thread is waiting for
+	struct list pi_mutexes;		// Owned mutexes that have waiters
 	struct timer sleep_timer;	// Sleep timeout timer
 	int sleep_status;		// Sleep status (timed out/interrupted)
+	ptr_t futex_addr;		// User address of the futex waiting on
 
 	/* Reference count for the thread
 	 * A running thread always has at least 1 reference on it.
@@ -87,6 +119,7 @@ struct thread {
 	struct list owner_link;		// Link to the owner process
 
 	struct notifier death_notifier;	// Notifier list of this thread
+	struct thread_join *join;	// Join record of a user thread
 
 	int status;			// Exit status of the thread
 };
@@ -105,10 +138,15 @@ extern void arch_thread_enter_uspace(ptr_t entry, ptr_t ustack, ptr_t ctx);
 extern void thread_uspace_wrapper(void *ctx);
 extern int thread_create(const char *name, struct process *owner, int flags,
 			 thread_func_t func, void *args, struct thread **tp);
+extern int thread_create_uspace(ptr_t entry, ptr_t func, ptr_t args,
+				tid_t *tidp);
+extern int thread_join(tid_t id, int *statusp);
+extern int thread_set_tls(ptr_t base);
 extern int thread_sleep(struct spinlock *lock, useconds_t timeout,
 			const char *name, int flags);
 extern void thread_run(struct thread *t);
 extern void thread_kill(struct thread *t);
+extern void thread_check_killed();
 extern void thread_release(struct thread *t);
 extern void thread_wake(struct thread *t);
 extern boolean_t thread_interrupt(struct thread *t);
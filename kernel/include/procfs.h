@@ -0,0 +1,9 @@
+#ifndef __PROCFS_H__
+#define __PROCFS_H__
+
+/* Fill the buffer with the content of the entry, return the length */
+typedef int (*procfs_read_t)(char *buf, size_t size);
+
+extern int procfs_register(const char *name, procfs_read_t read);
+
+#endif	/* __PROCFS_H__ */
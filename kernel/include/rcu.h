@@ -0,0 +1,86 @@
+#ifndef __RCU_H__
+#define __RCU_H__
+
+#include <types.h>
+#include "list.h"
+#include "barrier.h"
+
+/*
+ * Quiescent state based RCU. Readers only mark the CORE they run on as
+ * being in a read-side section, which keeps the thread from being
+ * preempted. A CORE passes a quiescent state when it switches threads or
+ * goes idle, and an object removed from a shared structure is freed once
+ * every CORE has passed one. Readers must not sleep.
+ */
+
+/* Callback that frees an object after a grace period */
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *);
+};
+typedef struct rcu_head rcu_head_t;
+
+/* Singly linked batch of callbacks waiting for the same grace period */
+struct rcu_batch {
+	struct rcu_head *head;
+	struct rcu_head **tail;
+	uint32_t count;
+};
+
+/* Per CORE RCU state */
+struct rcu_core {
+	struct rcu_batch next;		// Callbacks queued on this CORE
+	uint32_t gp_seen;		// Last grace period we passed a QS for
+	volatile boolean_t idle;	// CORE is in the idle loop
+	uint32_t nr_qs;			// Quiescent states reported
+	uint32_t nr_queued;		// Callbacks queued on this CORE
+};
+
+/* Publish a pointer once the object it points to is initialized */
+#define rcu_assign_pointer(p, v)	do { smp_wmb(); (p) = (v); } while (0)
+
+/* Load a pointer that may be changed by rcu_assign_pointer() */
+#define rcu_dereference(p)		(*(volatile __typeof__(p) *)&(p))
+
+/* Walk a list that writers change with the functions below */
+#define LIST_FOR_EACH_RCU(pos, head) \
+	for (pos = rcu_dereference((head)->next); pos != (head); \
+	     pos = rcu_dereference(pos->next))
+
+/**
+ * Insert a new entry before the specified head, readers see either the old
+ * list or the new entry fully linked.
+ */
+static INLINE void list_add_tail_rcu(struct list *new, struct list *head)
+{
+	new->next = head;
+	new->prev = head->prev;
+	smp_wmb();
+	head->prev->next = new;
+	head->prev = new;
+}
+
+/**
+ * Delete the specified entry from the list. The next pointer of the entry is
+ * kept for the readers still on it, it must not be reused before a grace
+ * period has passed.
+ */
+static INLINE void list_del_rcu(struct list *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	entry->prev = entry;
+}
+
+extern void rcu_read_lock();
+extern void rcu_read_unlock();
+extern void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *));
+extern void synchronize_rcu();
+extern void rcu_quiescent();
+extern void rcu_idle_enter();
+extern void rcu_idle_exit();
+extern void rcu_irq_enter();
+extern void init_rcu_percore();
+extern void init_rcu();
+
+#endif	/* __RCU_H__ */
@@ -0,0 +1,31 @@
+#ifndef __RWLOCK_H__
+#define __RWLOCK_H__
+
+#include "list.h"
+#include "hal/spinlock.h"
+
+/* Forward declaration of thread */
+struct thread;
+
+/*
+ * Sleeping reader-writer lock. Writers are preferred, a reader does not
+ * enter while a writer holds or waits for the lock, so a reader must not
+ * take the lock recursively.
+ */
+struct rwlock {
+	struct spinlock lock;		// Lock to protect the fields below
+	int readers;			// Number of readers holding the lock
+	struct thread *writer;		// Writer holding the lock
+	struct list readers_waiting;	// Sleeping readers
+	struct list writers_waiting;	// Sleeping writers
+	const char *name;		// Name of the lock
+};
+typedef struct rwlock rwlock_t;
+
+extern void rwlock_read_acquire(struct rwlock *l);
+extern void rwlock_read_release(struct rwlock *l);
+extern void rwlock_write_acquire(struct rwlock *l);
+extern void rwlock_write_release(struct rwlock *l);
+extern void rwlock_init(struct rwlock *l, const char *name);
+
+#endif	/* __RWLOCK_H__ */
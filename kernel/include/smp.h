@@ -3,6 +3,8 @@
 
 #include "hal/core.h"
 
+struct mmu_ctx;
+
 typedef int (*smp_call_func_t)(void *ctx);
 
 extern volatile uint32_t _smp_boot_status;
@@ -14,6 +16,10 @@ extern volatile uint32_t _smp_boot_status;
 #define SMP_BOOT_COMPLETE	3	// All ACs have been booted
 
 extern void smp_ipi_handler();
+extern void smp_resched_handler();
+extern void smp_send_reschedule(struct core *c);
+extern void smp_tlb_handler();
+extern void smp_tlb_shootdown(struct mmu_ctx *ctx, ptr_t virt);
 extern void init_smp();
 
 #endif
@@ -30,5 +30,7 @@ extern void set_timer(struct timer *t, useconds_t expire_time,
 extern void cancel_timer(struct timer *t);
 extern void timer_delay(uint32_t us);
 extern void timer_tick();
+extern void timer_reprogram();
+extern void init_timers();
 
 #endif	/* __TIMER_H__ */
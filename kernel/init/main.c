@@ -20,6 +20,12 @@
 #include "mm/malloc.h"
 #include "mm/slab.h"
 #include "mm/va.h"
+#include "mm/ksm.h"
+#include "mm/icache.h"
+#include "mm/kstack.h"
+#include "futex.h"
+#include "rcu.h"
+#include "lockstat.h"
 #include "timer.h"
 #include "smp.h"
 #include "proc/process.h"
@@ -111,6 +117,9 @@ int kmain(u_long addr, uint32_t initial_stack)
 	init_va();
 	kprintf("Virtual address space manager initialization... done.\n");
 
+	init_kstack();
+	kprintf("Kernel stack allocator initialization... done.\n");
+
 	/* Initialize our terminal */
 	init_terminal();
 	kprintf("Terminal initialization... done.\n");
@@ -146,9 +155,30 @@ int kmain(u_long addr, uint32_t initial_stack)
 	init_sched();
 	kprintf("Scheduler initialization... done.\n");
 
+	init_rcu_percore();
+	init_rcu();
+	kprintf("RCU initialization... done.\n");
+
+#ifdef _LOCKSTAT
+	init_lockstat();
+	kprintf("Lock statistics initialization... done.\n");
+#endif	/* _LOCKSTAT */
+
+	init_timers();
+	kprintf("Timer initialization... done.\n");
+
 	init_syscalls();
 	kprintf("System call initialization... done.\n");
 
+	init_futex();
+	kprintf("Futex initialization... done.\n");
+
+	init_ksm();
+	kprintf("Same page merging initialization... done.\n");
+
+	init_icache();
+	kprintf("Image cache initialization... done.\n");
+
 	/* Create the initialization process */
 	rc = thread_create("init", NULL, 0, sys_init_thread, NULL, NULL);
 	ASSERT(rc == 0);
@@ -168,6 +198,7 @@ void kmain_ac(struct core *c)
 	preinit_core_percore(c);
 	init_mmu_percore();
 	init_sched_percore();
+	init_rcu_percore();
 
 	/* Signal that we're up */
 	_smp_boot_status = SMP_BOOT_BOOTED;
@@ -2,8 +2,10 @@
 #include <stddef.h>
 #include <string.h>
 #include "debug.h"
+#include "matrix/process.h"
 #include "mm/page.h"
 #include "mm/malloc.h"
+#include "mm/mlayout.h"
 #include "mm/va.h"
 #include "proc/process.h"
 #include "proc/thread.h"
@@ -13,15 +15,23 @@
 #define ELF_ENDIAN	ELFDATA2LSB
 #define ELF_MACHINE	ELF_EM_386
 
-typedef Elf32_Ehdr elf_ehdr_t;
-typedef Elf32_Shdr elf_shdr_t;
+/* Load address of the position independent images */
+#define ELF_DYN_BASE	0x20000000
+#define ELF_INTERP_BASE	0x38000000
+
+/* Maximum length of the interpreter path */
+#define ELF_INTERP_MAX	64
 
 struct elf_binary {
-	elf_ehdr_t *ehdr;
+	elf_ehdr_t ehdr;
 	struct va_space *vas;
 	struct vfs_node *n;
 	ptr_t load_base;
 	size_t load_size;
+	ptr_t bias;			// Load bias of the image
+	ptr_t phdr;			// Address of the program headers
+	ptr_t interp_base;		// Load bias of the interpreter
+	ptr_t interp_entry;		// Entry of the interpreter, 0 if none
 };
 typedef struct elf_binary elf_binary_t;
 
@@ -47,8 +57,8 @@ boolean_t elf_ehdr_check(elf_ehdr_t *ehdr)
 		goto out;
 	}
 
-	/* We can only load EXEC now */
-	if (ehdr->e_type != ELF_ET_EXEC) {
+	/* We can only load EXEC and DYN now */
+	if ((ehdr->e_type != ELF_ET_EXEC) && (ehdr->e_type != ELF_ET_DYN)) {
 		DEBUG(DL_DBG, ("Type(%d) is not OK.\n", ehdr->e_type));
 		goto out;
 	}
@@ -59,58 +69,223 @@ boolean_t elf_ehdr_check(elf_ehdr_t *ehdr)
 	return ret;
 }
 
-ptr_t elf_finish_binary(void *data)
+/**
+ * The segments are read from the file when they are touched, so there is
+ * nothing to copy here. Tell the program where it was loaded and return
+ * the entry point, which is the interpreter if the program has one.
+ */
+ptr_t elf_finish_binary(void *data, struct process_args *args)
 {
-	int i = 0;
 	ptr_t entry;
 	elf_binary_t *bin;
-	elf_ehdr_t *ehdr;
-	elf_shdr_t *shdr;
-	uint32_t virt;
 
 	bin = (elf_binary_t *)data;
 
-	ehdr = bin->ehdr;
-
-	for (virt = 0; virt < (ehdr->e_shentsize * ehdr->e_shnum); virt += ehdr->e_shentsize, i++) {
-		shdr = (elf_shdr_t *)(((uint8_t *)ehdr) + (ehdr->e_shoff + virt));
-
-		if (shdr->sh_addr) {
-			switch (shdr->sh_type) {
-			case ELF_SHT_NOBITS:
-				/* Zero the .bss section */
-				memset((void *)(shdr->sh_addr), 0, shdr->sh_size);
-				DEBUG(DL_DBG, (".bss section zeroed.\n"));
-				break;	// Break out the switch
-			case ELF_SHT_PROGBITS:
-			case ELF_SHT_STRTAB:
-			case ELF_SHT_SYMTAB:
-				/* Copy the section into memory */
-				memcpy((void *)(shdr->sh_addr), (uint8_t *)ehdr + shdr->sh_offset,
-				       shdr->sh_size);
-				DEBUG(DL_DBG, ("section type %d copied.\n", shdr->sh_type));
-				break;	// Break out the switch
-			}
-		}
-	}
+	args->entry = bin->bias + bin->ehdr.e_entry;
+	args->phdr = bin->phdr;
+	args->phnum = bin->ehdr.e_phnum;
+	args->base = bin->interp_base;
 
-	entry = ehdr->e_entry;
-	DEBUG(DL_DBG, ("entry(%p).\n", entry));
+	entry = bin->interp_entry ? bin->interp_entry : args->entry;
+	DEBUG(DL_DBG, ("entry(%p) program entry(%p).\n", entry, args->entry));
 	
-	kfree(bin->ehdr);
 	kfree(bin);
 
 	return entry;
 }
 
+/*
+ * Read the ELF header and the program header table of the file, the table
+ * should be freed by the caller.
+ */
+static int elf_read_headers(struct vfs_node *n, elf_ehdr_t *ehdr,
+			    elf_phdr_t **phdrsp)
+{
+	int rc = -1;
+	size_t size;
+	elf_phdr_t *phdrs = NULL;
+
+	rc = vfs_read(n, 0, sizeof(elf_ehdr_t), (uint8_t *)ehdr);
+	if (rc != sizeof(elf_ehdr_t)) {
+		DEBUG(DL_INF, ("read file failed, err(%x).\n", rc));
+		rc = -1;
+		goto out;
+	}
+
+	/* Check whether it is valid ELF */
+	if (!elf_ehdr_check(ehdr)) {
+		DEBUG(DL_INF, ("invalid ELF file.\n"));
+		rc = -1;
+		goto out;
+	}
+
+	if ((ehdr->e_phentsize != sizeof(elf_phdr_t)) || !ehdr->e_phnum) {
+		DEBUG(DL_INF, ("phentsize(%d) phnum(%d) invalid.\n",
+			       ehdr->e_phentsize, ehdr->e_phnum));
+		rc = -1;
+		goto out;
+	}
+
+	size = ehdr->e_phentsize * ehdr->e_phnum;
+	phdrs = kmalloc(size, 0);
+	if (!phdrs) {
+		DEBUG(DL_INF, ("kmalloc program headers failed.\n"));
+		rc = -1;
+		goto out;
+	}
+
+	rc = vfs_read(n, ehdr->e_phoff, size, (uint8_t *)phdrs);
+	if (rc != size) {
+		DEBUG(DL_INF, ("read program headers failed, err(%x).\n", rc));
+		rc = -1;
+		goto out;
+	}
+
+	*phdrsp = phdrs;
+	rc = 0;
+
+ out:
+	if (rc != 0) {
+		if (phdrs) {
+			kfree(phdrs);
+		}
+	}
+
+	return rc;
+}
+
+static int elf_map_segment(struct va_space *vas, struct vfs_node *n,
+			   elf_phdr_t *phdr, ptr_t bias)
+{
+	int rc = -1, flags;
+	ptr_t start, vaddr;
+	uint32_t delta;
+
+	if (phdr->p_filesz > phdr->p_memsz) {
+		DEBUG(DL_DBG, ("filesz(%x) exceeds memsz(%x).\n",
+			       phdr->p_filesz, phdr->p_memsz));
+		goto out;
+	}
+
+	/* The file offset and the address are congruent modulo page size */
+	vaddr = bias + phdr->p_vaddr;
+	start = ROUND_DOWN(vaddr, PAGE_SIZE);
+	delta = vaddr - start;
+	if ((phdr->p_offset < delta) ||
+	    ((phdr->p_offset - delta) % PAGE_SIZE) ||
+	    ((phdr->p_offset + phdr->p_filesz) > n->length)) {
+		DEBUG(DL_DBG, ("offset(%x) not aligned to vaddr(%p).\n",
+			       phdr->p_offset, vaddr));
+		goto out;
+	}
+
+	if ((vaddr + phdr->p_memsz) > KERNEL_KMEM_START ||
+	    (vaddr + phdr->p_memsz) < vaddr) {
+		DEBUG(DL_DBG, ("segment(%p:%x) out of range.\n",
+			       vaddr, phdr->p_memsz));
+		goto out;
+	}
+
+	flags = VA_MAP_FIXED;
+	if (FLAG_ON(phdr->p_flags, ELF_PF_R)) {
+		flags |= VA_MAP_READ;
+	}
+	if (FLAG_ON(phdr->p_flags, ELF_PF_W)) {
+		flags |= VA_MAP_WRITE;
+	}
+	if (FLAG_ON(phdr->p_flags, ELF_PF_X)) {
+		flags |= VA_MAP_EXEC;
+	}
+
+	rc = va_map_file(vas, start, phdr->p_memsz + delta, flags, n,
+			 phdr->p_offset - delta, phdr->p_filesz + delta);
+	if (rc != 0) {
+		DEBUG(DL_WRN, ("va_map_file failed, err(%x).\n", rc));
+	}
+
+ out:
+	return rc;
+}
+
+/*
+ * Map the interpreter named by the PT_INTERP segment, the interpreter will
+ * get control first and link the program.
+ */
+static int elf_load_interp(elf_binary_t *bin, elf_phdr_t *interp)
+{
+	int rc = -1, i;
+	char path[ELF_INTERP_MAX];
+	struct vfs_node *n = NULL;
+	elf_ehdr_t ehdr;
+	elf_phdr_t *phdrs = NULL;
+
+	if (!interp->p_filesz || (interp->p_filesz > ELF_INTERP_MAX)) {
+		DEBUG(DL_DBG, ("interpreter path size(%x) invalid.\n",
+			       interp->p_filesz));
+		goto out;
+	}
+
+	rc = vfs_read(bin->n, interp->p_offset, interp->p_filesz,
+		      (uint8_t *)path);
+	if ((rc != interp->p_filesz) || (path[interp->p_filesz - 1] != 0)) {
+		DEBUG(DL_DBG, ("read interpreter path failed, err(%x).\n", rc));
+		rc = -1;
+		goto out;
+	}
+
+	n = vfs_lookup(path, VFS_FILE);
+	if (!n) {
+		DEBUG(DL_DBG, ("interpreter(%s) not found.\n", path));
+		rc = -1;
+		goto out;
+	}
+
+	rc = elf_read_headers(n, &ehdr, &phdrs);
+	if (rc != 0) {
+		goto out;
+	}
+
+	bin->interp_base = (ehdr.e_type == ELF_ET_DYN) ? ELF_INTERP_BASE : 0;
+
+	for (i = 0; i < ehdr.e_phnum; i++) {
+		if ((phdrs[i].p_type == ELF_PT_INTERP) ||
+		    (phdrs[i].p_type == ELF_PT_LOAD && phdrs[i].p_memsz &&
+		     elf_map_segment(bin->vas, n, &phdrs[i], bin->interp_base))) {
+			DEBUG(DL_DBG, ("interpreter(%s) not loadable.\n", path));
+			rc = -1;
+			goto out;
+		}
+	}
+
+	bin->interp_entry = bin->interp_base + ehdr.e_entry;
+	rc = 0;
+
+ out:
+	if (phdrs) {
+		kfree(phdrs);
+	}
+	if (n) {
+		/* The regions hold their own references */
+		vfs_node_deref(n);
+	}
+
+	return rc;
+}
+
+/**
+ * Map the PT_LOAD segments of the binary into the address space. Only the
+ * headers are read here, the content is paged in from the file on demand.
+ * A position independent binary is loaded at ELF_DYN_BASE, and the
+ * interpreter requested by the binary is mapped as well.
+ */
 int elf_load_binary(struct vfs_node *n, struct va_space *vas, void **datap)
 {
 	int rc = -1, i;
-	size_t size, load_cnt;
+	size_t load_cnt;
+	ptr_t start, end;
 	elf_binary_t *bin;
-	ptr_t virt, base;
-	elf_shdr_t *shdr;
 	elf_ehdr_t *ehdr;
+	elf_phdr_t *phdrs = NULL, *interp = NULL;
 
 	/* Allocate buffer to store the binary information */
 	bin = kmalloc(sizeof(elf_binary_t), 0);
@@ -120,99 +295,89 @@ int elf_load_binary(struct vfs_node *n, struct va_space *vas, void **datap)
 		goto out;
 	}
 	
+	memset(bin, 0, sizeof(elf_binary_t));
 	bin->vas = vas;
 	bin->n = n;
+	ehdr = &bin->ehdr;
 
-	/* Allocate buffer to store the file content */
-	bin->ehdr = kmalloc(n->length, 0);
-	if (!bin->ehdr) {
-		DEBUG(DL_INF, ("kmalloc buffer for file failed.\n"));
-		rc = -1;
-		goto out;
-	}
-	
-	/* Read in the executive content */
-	rc = vfs_read(n, 0, n->length, (uint8_t *)bin->ehdr);
-	if (rc == -1 || rc < sizeof(elf_ehdr_t)) {
-		DEBUG(DL_INF, ("read file failed, err(%x).\n", rc));
-		rc = -1;
+	rc = elf_read_headers(n, ehdr, &phdrs);
+	if (rc != 0) {
 		goto out;
 	}
 
-	/* Check whether it is valid ELF */
-	if (!elf_ehdr_check(bin->ehdr)) {
-		DEBUG(DL_INF, ("invalid ELF file.\n"));
-		rc = -1;
-		goto out;
+	if (ehdr->e_type == ELF_ET_DYN) {
+		bin->bias = ELF_DYN_BASE;
 	}
 
-	ehdr = bin->ehdr;
-	base = ehdr->e_entry;
-	
-	/* Load the loadable segments from the executive to the address which was
-	 * specified in the ELF. For Matrix default is 0x20000000 which was specified
-	 * in the link script.
+	/* Map the loadable segments to the address specified in the ELF. For
+	 * Matrix default is 0x20000000 which was specified in the link script.
 	 */
 	load_cnt = 0;
-	for (i = 0, virt = 0;
-	     virt < (ehdr->e_shentsize * ehdr->e_shnum);
-	     virt += ehdr->e_shentsize, i++) {
-
-		/* Read a section header */
-		shdr = (elf_shdr_t *)(((uint8_t *)ehdr) + (ehdr->e_shoff + virt));
-		DEBUG(DL_DBG, ("i(%d), sh_addr(0x%x), sh_size(0x%x), sh_type(%d)\n",
-			       i, shdr->sh_addr, shdr->sh_size, shdr->sh_type));
-		
-		if (shdr->sh_addr) {
-			size_t map_size;
-			
-			/* If this is a loadable section, load it */
-			if (shdr->sh_addr < base) {
-				/* If this is the lowest entry point, store it */
-				base = shdr->sh_addr;
-			}
-
-			/* Update the section size we may needed */
-			if ((shdr->sh_addr + shdr->sh_size - base) > size) {
-				/* We also store the total size */
-				size = shdr->sh_addr + shdr->sh_size - base;
-			}
-
-			/* Map address space for this section, this is where codes stored */
-			map_size = ROUND_UP(shdr->sh_size, PAGE_SIZE);
-			rc = va_map(vas, shdr->sh_addr, map_size,
-				    VA_MAP_READ|VA_MAP_WRITE|VA_MAP_FIXED, NULL);
-			if (rc != 0) {
-				DEBUG(DL_WRN, ("va_map failed, err(%x).\n", rc));
-				goto out;
-			}
-
-			load_cnt++;
-			DEBUG(DL_DBG, ("i(%d), address space mapped.\n", i));
+	for (i = 0; i < ehdr->e_phnum; i++) {
+		DEBUG(DL_DBG, ("i(%d), p_type(%d), p_vaddr(0x%x), p_memsz(0x%x)\n",
+			       i, phdrs[i].p_type, phdrs[i].p_vaddr,
+			       phdrs[i].p_memsz));
+
+		if (phdrs[i].p_type == ELF_PT_INTERP) {
+			interp = &phdrs[i];
+			continue;
+		} else if (phdrs[i].p_type == ELF_PT_PHDR) {
+			bin->phdr = bin->bias + phdrs[i].p_vaddr;
+			continue;
+		} else if ((phdrs[i].p_type != ELF_PT_LOAD) || !phdrs[i].p_memsz) {
+			continue;
+		}
+
+		rc = elf_map_segment(vas, n, &phdrs[i], bin->bias);
+		if (rc != 0) {
+			goto out;
+		}
+
+		/* The header table is mapped with the first page of the file */
+		if (!bin->phdr && (phdrs[i].p_offset == 0) &&
+		    (ehdr->e_phoff < phdrs[i].p_filesz)) {
+			bin->phdr = bin->bias + phdrs[i].p_vaddr + ehdr->e_phoff;
+		}
+
+		/* Track the range of the image */
+		start = ROUND_DOWN(bin->bias + phdrs[i].p_vaddr, PAGE_SIZE);
+		end = bin->bias + phdrs[i].p_vaddr + phdrs[i].p_memsz;
+		if (load_cnt) {
+			end = MAX(end, bin->load_base + bin->load_size);
+			start = MIN(start, bin->load_base);
 		}
+		bin->load_base = start;
+		bin->load_size = end - start;
+
+		load_cnt++;
 	}
 
 	/* Check whether we actually loaded anything */
 	if (!load_cnt) {
 		rc = -1;
-		DEBUG(DL_WRN, ("binary do not have any loadable sections.\n"));
+		DEBUG(DL_WRN, ("binary do not have any loadable segments.\n"));
 		goto out;
 	}
 
-	bin->load_base = base;
-	
-	/* Save the entry point to the code segment */
+	if (interp) {
+		rc = elf_load_interp(bin, interp);
+		if (rc != 0) {
+			goto out;
+		}
+	}
+
 	*datap = bin;
-	DEBUG(DL_DBG, ("base(%p), datap (%p)\n", base, *datap));
+	DEBUG(DL_DBG, ("base(%p), size(%x), interp(%p), datap (%p)\n",
+		       bin->load_base, bin->load_size, bin->interp_entry, *datap));
 
 	rc = 0;
 
 out:
+	if (phdrs) {
+		kfree(phdrs);
+	}
 	if (rc != 0) {
 		if (bin) {
-			if (bin->ehdr) {
-				kfree(bin->ehdr);
-			}
 			kfree(bin);
 		}
 	}
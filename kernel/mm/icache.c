@@ -0,0 +1,383 @@
+/*
+ * icache.c
+ *
+ * Image cache. The read only pages of the executables and the shared
+ * libraries are kept resident here, keyed by the file and the offset of
+ * the page. Every instance of the program maps the same frames, so the
+ * text is read from the file only once. Pages nobody else maps are evicted
+ * in LRU order when the cache is full or the memory runs low, the latter
+ * by the icache thread as the page allocator must not call into the heap.
+ */
+
+#include <types.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include "matrix/matrix.h"
+#include "hal/spinlock.h"
+#include "atomic.h"
+#include "list.h"
+#include "debug.h"
+#include "rtl/hashtable.h"
+#include "mm/page.h"
+#include "mm/malloc.h"
+#include "mm/icache.h"
+#include "fs.h"
+#include "procfs.h"
+#include "semaphore.h"
+#include "proc/thread.h"
+
+#define NR_ICACHE_BUCKETS	256
+
+/* Number of pages the icache thread releases at a time */
+#define ICACHE_RECLAIM_BATCH	32
+
+struct icache_page {
+	struct list link;	// Link to the hash table
+	struct list lru_link;	// Link to the LRU list
+	struct vfs_node *node;	// File of the page, we hold a reference of it
+	uint32_t offset;	// Offset of the page in the file
+	uint32_t frame;		// Page frame, we hold a reference of it
+};
+
+struct icache_key {
+	struct vfs_node *node;
+	uint32_t offset;
+};
+
+static struct hashtable _icache_table;
+static struct list _icache_buckets[NR_ICACHE_BUCKETS];
+
+/* Most recently used pages first */
+static struct list _icache_lru = {
+	.prev = &_icache_lru,
+	.next = &_icache_lru
+};
+
+/* Initialized statically, the page allocator may reclaim before us */
+static struct spinlock _icache_lock = SPINLOCK_INITIALIZER("icache-lock");
+
+/* Evicted pages whose frames were already released, the icache thread
+ * drops their file references and frees them.
+ */
+static struct list _icache_zombies = {
+	.prev = &_icache_zombies,
+	.next = &_icache_zombies
+};
+
+/* Wakes up the icache thread, set while a wake up is pending */
+static struct semaphore _icache_sem;
+static atomic_t _icache_wakeup_pending = 0;
+static boolean_t _icache_thread_ready = FALSE;
+
+/* Maximum number of pages cached */
+uint32_t _icache_max_pages = 1024;
+
+/* Statistics */
+static uint32_t _icache_hits = 0;
+static uint32_t _icache_misses = 0;
+static uint32_t _icache_evictions = 0;
+
+static uint32_t icache_hash(void *key, uint32_t nr_buckets)
+{
+	struct icache_key *k = key;
+
+	return (((uint32_t)k->node >> 4) ^ (k->offset / PAGE_SIZE)) % nr_buckets;
+}
+
+static int icache_compare(void *key, void *entry)
+{
+	struct icache_key *k = key;
+	struct icache_page *ip = entry;
+
+	return ((k->node == ip->node) && (k->offset == ip->offset)) ? 0 : -1;
+}
+
+/*
+ * Move the unused pages to the victim list, must be called with the cache
+ * locked. Pages mapped by some process are skipped.
+ */
+static uint32_t icache_evict(uint32_t nr, boolean_t all, struct vfs_node *n,
+			     struct list *victims)
+{
+	uint32_t count = 0;
+	struct list *l, *p;
+	struct icache_page *ip;
+
+	/* Walk from the least recently used end */
+	for (l = _icache_lru.prev; l != &_icache_lru; l = p) {
+		p = l->prev;
+		if (!all && (count >= nr)) {
+			break;
+		}
+
+		ip = LIST_ENTRY(l, struct icache_page, lru_link);
+		if (n && (ip->node != n)) {
+			continue;
+		} else if (!n && (page_refcount(ip->frame) > 1)) {
+			continue;
+		}
+
+		list_del(&ip->link);
+		_icache_table.nr_entries--;
+		list_del(&ip->lru_link);
+		list_add(&ip->lru_link, victims);
+		count++;
+	}
+
+	_icache_evictions += count;
+
+	return count;
+}
+
+/* Drop the file references and free the pages, the frames are gone */
+static void icache_release(struct list *victims)
+{
+	struct list *l, *p;
+	struct icache_page *ip;
+
+	LIST_FOR_EACH_SAFE(l, p, victims) {
+		ip = LIST_ENTRY(l, struct icache_page, lru_link);
+		list_del(&ip->lru_link);
+		vfs_node_deref(ip->node);
+		kfree(ip);
+	}
+}
+
+static void icache_free(struct list *victims)
+{
+	struct list *l;
+	struct icache_page *ip;
+
+	LIST_FOR_EACH(l, victims) {
+		ip = LIST_ENTRY(l, struct icache_page, lru_link);
+		page_unref(ip->frame);
+	}
+
+	icache_release(victims);
+}
+
+/**
+ * Look up a page of the file, a reference of the frame is taken for the
+ * caller on success.
+ */
+int icache_get(struct vfs_node *n, uint32_t offset, uint32_t *framep)
+{
+	int rc = -1;
+	struct icache_key key;
+	struct icache_page *ip;
+
+	key.node = n;
+	key.offset = offset;
+
+	spinlock_acquire(&_icache_lock);
+
+	if (hashtable_lookup(&_icache_table, &key, (void **)&ip) == 0) {
+		page_ref(ip->frame);
+		*framep = ip->frame;
+		list_del(&ip->lru_link);
+		list_add(&ip->lru_link, &_icache_lru);
+		_icache_hits++;
+		rc = 0;
+	} else {
+		_icache_misses++;
+	}
+
+	spinlock_release(&_icache_lock);
+
+	return rc;
+}
+
+/**
+ * Add a page of the file to the cache. The frame must be completely filled
+ * and mapped read only by the caller alone, its content must not be changed
+ * afterwards.
+ */
+void icache_put(struct vfs_node *n, uint32_t offset, uint32_t frame)
+{
+	struct icache_key key;
+	struct icache_page *ip;
+	struct list victims;
+
+	LIST_INIT(&victims);
+
+	/* Allocate before locking, the allocation may reclaim our pages */
+	ip = kmalloc(sizeof(struct icache_page), 0);
+	if (!ip) {
+		return;
+	}
+
+	LIST_INIT(&ip->link);
+	LIST_INIT(&ip->lru_link);
+	ip->node = n;
+	ip->offset = offset;
+	ip->frame = frame;
+	key.node = n;
+	key.offset = offset;
+
+	spinlock_acquire(&_icache_lock);
+
+	/* Make room for the new page */
+	if (_icache_table.nr_entries >= _icache_max_pages) {
+		icache_evict(_icache_table.nr_entries - _icache_max_pages + 1,
+			     FALSE, NULL, &victims);
+	}
+
+	if ((_icache_table.nr_entries < _icache_max_pages) &&
+	    (hashtable_insert(&_icache_table, &key, ip) == 0)) {
+		list_add(&ip->lru_link, &_icache_lru);
+		page_ref(frame);
+		vfs_node_refer(n);
+		ip = NULL;
+	}
+
+	spinlock_release(&_icache_lock);
+
+	/* Somebody cached it first or the cache is full of pages in use */
+	if (ip) {
+		kfree(ip);
+	}
+
+	icache_free(&victims);
+}
+
+/**
+ * Drop all the pages of the file, called when the file is changed. The
+ * processes mapping the pages keep their frames.
+ */
+void icache_invalidate(struct vfs_node *n)
+{
+	struct list victims;
+
+	LIST_INIT(&victims);
+
+	spinlock_acquire(&_icache_lock);
+	icache_evict(0, TRUE, n, &victims);
+	spinlock_release(&_icache_lock);
+
+	icache_free(&victims);
+}
+
+/**
+ * Release at most nr pages nobody is mapping. Return the number of pages
+ * released.
+ */
+uint32_t icache_reclaim(uint32_t nr)
+{
+	uint32_t count;
+	struct list victims;
+
+	LIST_INIT(&victims);
+
+	spinlock_acquire(&_icache_lock);
+	count = icache_evict(nr, FALSE, NULL, &victims);
+	spinlock_release(&_icache_lock);
+
+	icache_free(&victims);
+
+	return count;
+}
+
+/**
+ * Release the frames of at most nr pages nobody is mapping, called by the
+ * page allocator when it is out of frames. The rest of the pages is freed
+ * by the icache thread. Return the number of frames released.
+ */
+uint32_t icache_reclaim_frames(uint32_t nr)
+{
+	uint32_t count;
+	struct list victims, *l, *p;
+	struct icache_page *ip;
+
+	LIST_INIT(&victims);
+
+	spinlock_acquire(&_icache_lock);
+	count = icache_evict(nr, FALSE, NULL, &victims);
+	spinlock_release(&_icache_lock);
+
+	if (!count) {
+		return 0;
+	}
+
+	LIST_FOR_EACH(l, &victims) {
+		ip = LIST_ENTRY(l, struct icache_page, lru_link);
+		page_unref(ip->frame);
+	}
+
+	spinlock_acquire(&_icache_lock);
+	LIST_FOR_EACH_SAFE(l, p, &victims) {
+		list_del(l);
+		list_add_tail(l, &_icache_zombies);
+	}
+	spinlock_release(&_icache_lock);
+
+	icache_wakeup();
+
+	return count;
+}
+
+/**
+ * Ask the icache thread to shrink the cache, called by the page allocator
+ * when the free pages drop below the watermark.
+ */
+void icache_wakeup()
+{
+	if (!_icache_thread_ready) {
+		return;
+	}
+
+	if (atomic_tas(&_icache_wakeup_pending, 0, 1)) {
+		semaphore_up(&_icache_sem, 1);
+	}
+}
+
+static void icache_thread(void *ctx)
+{
+	struct list zombies, *l, *p;
+
+	while (TRUE) {
+		semaphore_down(&_icache_sem);
+		_icache_wakeup_pending = 0;
+
+		LIST_INIT(&zombies);
+		spinlock_acquire(&_icache_lock);
+		LIST_FOR_EACH_SAFE(l, p, &_icache_zombies) {
+			list_del(l);
+			list_add_tail(l, &zombies);
+		}
+		spinlock_release(&_icache_lock);
+		icache_release(&zombies);
+
+		while (page_low() && icache_reclaim(ICACHE_RECLAIM_BATCH)) {
+			;
+		}
+	}
+}
+
+static int icache_procfs_read(char *buf, size_t size)
+{
+	return snprintf(buf, size,
+			"pages %d\n"
+			"max_pages %d\n"
+			"hits %d\n"
+			"misses %d\n"
+			"evictions %d\n",
+			_icache_table.nr_entries, _icache_max_pages,
+			_icache_hits, _icache_misses, _icache_evictions);
+}
+
+void init_icache()
+{
+	int rc = -1;
+
+	hashtable_init(&_icache_table, _icache_buckets, NR_ICACHE_BUCKETS,
+		       offsetof(struct icache_page, link), icache_hash,
+		       icache_compare, 0);
+
+	procfs_register("icache", icache_procfs_read);
+
+	semaphore_init(&_icache_sem, "icache-sem", 0);
+	rc = thread_create("icache", NULL, 0, icache_thread, NULL, NULL);
+	ASSERT(rc == 0);
+	_icache_thread_ready = TRUE;
+}
@@ -0,0 +1,402 @@
+/*
+ * ksm.c
+ *
+ * Same page merging. A kernel thread scans the user pages of all processes
+ * periodically, pages with identical content are merged into one write
+ * protected page. A write to the merged page will fault and the writer gets
+ * a private copy, see mmu_unshare_page().
+ */
+
+#include <types.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include "matrix/matrix.h"
+#include "hal/hal.h"
+#include "hal/core.h"
+#include "list.h"
+#include "debug.h"
+#include "rtl/hashtable.h"
+#include "mm/mm.h"
+#include "mm/page.h"
+#include "mm/mmu.h"
+#include "mm/va.h"
+#include "mm/kmem.h"
+#include "mm/malloc.h"
+#include "mm/mlayout.h"
+#include "mm/ksm.h"
+#include "proc/process.h"
+#include "proc/thread.h"
+#include "procfs.h"
+#include "smp.h"
+
+#define NR_KSM_BUCKETS	256
+
+/* Size of the address range covered by a page table */
+#define PTBL_SPAN	(1024 * PAGE_SIZE)
+
+struct ksm_page {
+	struct list link;	// Link to the stable or unstable table
+	uint32_t checksum;	// Checksum of the page content
+	uint32_t frame;		// Page frame, we hold a reference of it
+};
+
+struct ksm_key {
+	uint32_t checksum;	// Checksum of the page being scanned
+	void *data;		// Content of the page being scanned
+};
+
+/* Merged pages, these pages are write protected */
+static struct hashtable _stable_table;
+static struct list _stable_buckets[NR_KSM_BUCKETS];
+
+/* Candidate pages found in current full scan */
+static struct hashtable _unstable_table;
+static struct list _unstable_buckets[NR_KSM_BUCKETS];
+
+/* Kernel windows used to access the physical pages */
+static void *_ksm_window[2];
+static struct page *_ksm_window_pte[2];
+static uint32_t _ksm_window_frame[2];
+
+/* Where the scanner stopped last time */
+static pid_t _ksm_cursor_pid = 0;
+static ptr_t _ksm_cursor_addr = 0;
+static uint32_t _ksm_budget = 0;
+
+/* Number of pages to scan each time the scanner wakes up */
+uint32_t _ksm_pages_to_scan = 256;
+
+/* Time the scanner sleeps between two scans */
+useconds_t _ksm_sleep_time = 200000;
+
+/* Statistics */
+static uint32_t _ksm_pages_shared = 0;	// Merged pages in use
+static uint32_t _ksm_pages_sharing = 0;	// Pages saved by merging
+static uint32_t _ksm_pages_scanned = 0;
+static uint32_t _ksm_full_scans = 0;
+
+static void ksm_map(int i, uint32_t frame)
+{
+	_ksm_window_pte[i]->frame = frame;
+	x86_invlpg((uint32_t)_ksm_window[i]);
+}
+
+static void ksm_unmap(int i)
+{
+	_ksm_window_pte[i]->frame = _ksm_window_frame[i];
+	x86_invlpg((uint32_t)_ksm_window[i]);
+}
+
+static uint32_t ksm_checksum(uint32_t *data)
+{
+	uint32_t i, sum = 0;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+		sum += data[i];
+		sum += (sum << 10);
+		sum ^= (sum >> 6);
+	}
+	sum += (sum << 3);
+	sum ^= (sum >> 11);
+	sum += (sum << 15);
+
+	return sum;
+}
+
+static uint32_t ksm_hash(void *key, uint32_t nr_buckets)
+{
+	return ((struct ksm_key *)key)->checksum % nr_buckets;
+}
+
+static int ksm_compare(void *key, void *entry)
+{
+	int rc = -1;
+	struct ksm_key *k = key;
+	struct ksm_page *kp = entry;
+
+	if (k->checksum == kp->checksum) {
+		ksm_map(1, kp->frame);
+		rc = memcmp(k->data, _ksm_window[1], PAGE_SIZE) ? -1 : 0;
+		ksm_unmap(1);
+	}
+
+	return rc;
+}
+
+/* Find a page with the same content, return the table it was found in */
+static struct hashtable *ksm_lookup(struct ksm_key *key, struct ksm_page **kpp)
+{
+	if (hashtable_lookup(&_stable_table, key, (void **)kpp) == 0) {
+		return &_stable_table;
+	} else if (hashtable_lookup(&_unstable_table, key, (void **)kpp) == 0) {
+		return &_unstable_table;
+	}
+
+	return NULL;
+}
+
+static void ksm_drop(struct hashtable *ht, struct ksm_page *kp)
+{
+	list_del(&kp->link);
+	ht->nr_entries--;
+	page_unref(kp->frame);
+	kfree(kp);
+}
+
+/*
+ * Must be called with the lock of the address space held, so no fault
+ * unshares the page under us, and with interrupts disabled, so that the
+ * owner of the page will not run on this CORE while we are changing its
+ * page table entry.
+ * The threads on the other COREs may write the page until it is write
+ * protected and their TLBs are shot down, so the content is only trusted
+ * after that.
+ */
+static void ksm_scan_page(struct mmu_ctx *ctx, ptr_t virt, struct ksm_page **sparep)
+{
+	uint32_t old;
+	struct page *p;
+	struct ksm_key key;
+	struct ksm_page *kp;
+	struct hashtable *ht;
+
+	/* Only the private writable pages are candidates */
+	p = mmu_get_page(ctx, virt, FALSE, 0);
+	if (!p || !p->present || !p->user || !p->rw || p->shared ||
+	    (page_refcount(p->frame) != 1)) {
+		return;
+	}
+
+	_ksm_pages_scanned++;
+
+	ksm_map(0, p->frame);
+	key.checksum = ksm_checksum(_ksm_window[0]);
+	key.data = _ksm_window[0];
+
+	/* A candidate is checked again when it is merged, it may stay
+	 * writable until then.
+	 */
+	if (!ksm_lookup(&key, &kp)) {
+		if (*sparep) {
+			kp = *sparep;
+			kp->checksum = key.checksum;
+			kp->frame = p->frame;
+			if (hashtable_insert(&_unstable_table, &key, kp) == 0) {
+				page_ref(kp->frame);
+				*sparep = NULL;
+			}
+		}
+		goto out;
+	}
+
+	/* Freeze the content and compare it again */
+	p->rw = 0;
+	smp_tlb_shootdown(ctx, virt);
+	key.checksum = ksm_checksum(_ksm_window[0]);
+	ht = ksm_lookup(&key, &kp);
+
+	if (ht == &_stable_table) {
+		/* Map the merged page and release our private copy once no
+		 * CORE has the old frame cached.
+		 */
+		old = p->frame;
+		page_ref(kp->frame);
+		p->frame = kp->frame;
+		p->shared = 1;
+		smp_tlb_shootdown(ctx, virt);
+		page_unref(old);
+		_ksm_pages_sharing++;
+	} else if (ht == &_unstable_table) {
+		/* This page becomes the merged page, the candidate will be
+		 * merged into it when it is scanned next time.
+		 */
+		list_del(&kp->link);
+		_unstable_table.nr_entries--;
+		page_unref(kp->frame);
+
+		p->shared = 1;
+
+		kp->frame = p->frame;
+		page_ref(kp->frame);
+		hashtable_insert(&_stable_table, &key, kp);
+		_ksm_pages_shared++;
+	} else {
+		/* Changed before we froze it, give it back to the owner */
+		p->rw = 1;
+		smp_tlb_shootdown(ctx, virt);
+	}
+
+ out:
+	ksm_unmap(0);
+}
+
+static int ksm_scan_process(struct process *p, void *ctx)
+{
+	int rc = 0;
+	ptr_t virt;
+	boolean_t state;
+	struct va_space *vas;
+	struct ksm_page *spare = NULL;
+
+	/* Skip the processes we have scanned in this round */
+	if (p->id < _ksm_cursor_pid) {
+		goto out;
+	} else if (p->id > _ksm_cursor_pid) {
+		_ksm_cursor_pid = p->id;
+		_ksm_cursor_addr = 0;
+	}
+
+	/* Pin the address space, the process may exit or replace its image
+	 * while we are scanning it.
+	 */
+	mutex_acquire(&p->lock);
+	vas = p->vas;
+	if (vas) {
+		va_ref(vas);
+	}
+	mutex_release(&p->lock);
+
+	virt = _ksm_cursor_addr;
+	while (vas && (virt < KERNEL_KMEM_START)) {
+		if (!_ksm_budget) {
+			_ksm_cursor_addr = virt;
+			rc = 1;
+			break;
+		}
+
+		if (!spare) {
+			spare = kmalloc(sizeof(struct ksm_page), 0);
+			if (!spare) {
+				break;
+			}
+			LIST_INIT(&spare->link);
+		}
+
+		/* No need to go on if the address space was dropped */
+		if (p->vas != vas) {
+			break;
+		}
+
+		/* The faults of the process change the entries as well */
+		mutex_acquire(&vas->lock);
+		state = local_irq_disable();
+
+		if (mmu_private_ptbl(vas->mmu, virt)) {
+			ksm_scan_page(vas->mmu, virt, &spare);
+			virt += PAGE_SIZE;
+			_ksm_budget--;
+		} else {
+			virt = ROUND_DOWN(virt, PTBL_SPAN) + PTBL_SPAN;
+		}
+
+		local_irq_restore(state);
+		mutex_release(&vas->lock);
+	}
+
+	if (vas) {
+		va_destroy(vas);
+	}
+
+	if (rc == 0) {
+		/* Move to the next process */
+		_ksm_cursor_pid = p->id + 1;
+		_ksm_cursor_addr = 0;
+	}
+
+	if (spare) {
+		kfree(spare);
+	}
+
+ out:
+	return rc;
+}
+
+static void ksm_end_scan()
+{
+	uint32_t i, refs, shared = 0, sharing = 0;
+	struct list *l, *n;
+	struct ksm_page *kp;
+
+	/* Candidates of this round are out of date now */
+	for (i = 0; i < NR_KSM_BUCKETS; i++) {
+		LIST_FOR_EACH_SAFE(l, n, &_unstable_buckets[i]) {
+			kp = LIST_ENTRY(l, struct ksm_page, link);
+			ksm_drop(&_unstable_table, kp);
+		}
+	}
+
+	/* Release the merged pages nobody is using and update the counts */
+	for (i = 0; i < NR_KSM_BUCKETS; i++) {
+		LIST_FOR_EACH_SAFE(l, n, &_stable_buckets[i]) {
+			kp = LIST_ENTRY(l, struct ksm_page, link);
+			refs = page_refcount(kp->frame);
+			if (refs == 1) {
+				ksm_drop(&_stable_table, kp);
+			} else {
+				shared++;
+				sharing += refs - 2;
+			}
+		}
+	}
+
+	_ksm_pages_shared = shared;
+	_ksm_pages_sharing = sharing;
+	_ksm_cursor_pid = 0;
+	_ksm_cursor_addr = 0;
+	_ksm_full_scans++;
+}
+
+static void ksm_thread(void *ctx)
+{
+	while (TRUE) {
+		thread_sleep(NULL, _ksm_sleep_time, "ksm", 0);
+
+		_ksm_budget = _ksm_pages_to_scan;
+		if (process_iterate(ksm_scan_process, NULL) == 0) {
+			/* Reached the end of the process tree */
+			ksm_end_scan();
+		}
+	}
+}
+
+static int ksm_procfs_read(char *buf, size_t size)
+{
+	return snprintf(buf, size,
+			"pages_shared %d\n"
+			"pages_sharing %d\n"
+			"pages_scanned %d\n"
+			"full_scans %d\n"
+			"pages_to_scan %d\n"
+			"sleep_time %d\n",
+			_ksm_pages_shared, _ksm_pages_sharing,
+			_ksm_pages_scanned, _ksm_full_scans,
+			_ksm_pages_to_scan, (uint32_t)_ksm_sleep_time);
+}
+
+void init_ksm()
+{
+	int i, rc = -1;
+
+	hashtable_init(&_stable_table, _stable_buckets, NR_KSM_BUCKETS,
+		       offsetof(struct ksm_page, link), ksm_hash, ksm_compare, 0);
+	hashtable_init(&_unstable_table, _unstable_buckets, NR_KSM_BUCKETS,
+		       offsetof(struct ksm_page, link), ksm_hash, ksm_compare, 0);
+
+	/* Borrow two pages from the kernel pool as the windows, the page
+	 * tables of the kernel pool are shared by all the contexts.
+	 */
+	for (i = 0; i < 2; i++) {
+		_ksm_window[i] = kmem_alloc(PAGE_SIZE, MM_ALIGN);
+		ASSERT(_ksm_window[i] != NULL);
+		_ksm_window_pte[i] = mmu_get_page(&_kernel_mmu_ctx,
+						  (ptr_t)_ksm_window[i], FALSE, 0);
+		ASSERT(_ksm_window_pte[i] != NULL);
+		_ksm_window_frame[i] = _ksm_window_pte[i]->frame;
+	}
+
+	procfs_register("ksm", ksm_procfs_read);
+
+	rc = thread_create("ksm", NULL, 0, ksm_thread, NULL, NULL);
+	ASSERT(rc == 0);
+}
@@ -0,0 +1,211 @@
+/*
+ * kstack.c
+ *
+ * Kernel stack allocator. Kernel stacks live in their own virtual area and
+ * each stack has an unmapped guard page below it, so a stack overflow will
+ * fault instead of corrupting the memory nearby. Freed stacks are kept
+ * mapped and cached on each CORE for the next thread.
+ */
+
+#include <types.h>
+#include <stddef.h>
+#include <string.h>
+#include "matrix/matrix.h"
+#include "hal/hal.h"
+#include "hal/core.h"
+#include "hal/spinlock.h"
+#include "list.h"
+#include "debug.h"
+#include "rtl/bitmap.h"
+#include "mm/page.h"
+#include "mm/mmu.h"
+#include "mm/mlayout.h"
+#include "mm/kstack.h"
+#include "smp.h"
+
+/* Each slot has a guard page followed by the stack */
+#define KSTACK_SLOT_SIZE	(KSTACK_SIZE + PAGE_SIZE)
+#define NR_KSTACK_SLOTS		(KERNEL_KSTACK_SIZE / KSTACK_SLOT_SIZE)
+
+/* Maximum number of stacks cached on a CORE */
+#define KSTACK_CACHE_SIZE	8
+
+/* Maximum number of stacks cached globally */
+#define KSTACK_POOL_SIZE	32
+
+/* Bitmap of the slots in use */
+static struct bitmap _kstack_slots;
+static u_long _kstack_slots_buf[(NR_KSTACK_SLOTS + 31) / 32];
+static size_t _kstack_next = 0;
+
+/* Stacks shared by all the COREs */
+static struct list _kstack_pool = {
+	.prev = &_kstack_pool,
+	.next = &_kstack_pool
+};
+static size_t _nr_kstack_pool = 0;
+static struct spinlock _kstack_lock;
+
+static void *kstack_map()
+{
+	size_t i, slot;
+	ptr_t base;
+	struct page *p;
+
+	spinlock_acquire(&_kstack_lock);
+
+	for (i = 0; i < NR_KSTACK_SLOTS; i++) {
+		slot = (_kstack_next + i) % NR_KSTACK_SLOTS;
+		if (!bitmap_test(&_kstack_slots, slot)) {
+			break;
+		}
+	}
+
+	if (i >= NR_KSTACK_SLOTS) {
+		spinlock_release(&_kstack_lock);
+		DEBUG(DL_WRN, ("out of kernel stack slots.\n"));
+		return NULL;
+	}
+
+	bitmap_set(&_kstack_slots, slot);
+	_kstack_next = slot + 1;
+
+	spinlock_release(&_kstack_lock);
+
+	/* Leave the first page of the slot unmapped as the guard page */
+	base = KERNEL_KSTACK_START + slot * KSTACK_SLOT_SIZE + PAGE_SIZE;
+	for (i = 0; i < KSTACK_SIZE; i += PAGE_SIZE) {
+		p = mmu_get_page(&_kernel_mmu_ctx, base + i, FALSE, 0);
+		ASSERT((p != NULL) && !p->present);
+		page_alloc(p, 0);
+		p->user = FALSE;
+		p->rw = TRUE;
+	}
+
+	return (void *)base;
+}
+
+static void kstack_unmap(void *stack)
+{
+	size_t i, slot;
+	ptr_t base;
+	boolean_t state;
+	struct page *p;
+	uint32_t frames[KSTACK_SIZE / PAGE_SIZE];
+
+	base = (ptr_t)stack;
+
+	/* The other COREs may have the stack cached, the frames and the slot
+	 * are reused only after they flushed it. The remote COREs flush the
+	 * whole TLB, so one request covers the stack.
+	 */
+	state = local_irq_disable();
+	for (i = 0; i < KSTACK_SIZE / PAGE_SIZE; i++) {
+		p = mmu_get_page(&_kernel_mmu_ctx, base + i * PAGE_SIZE, FALSE, 0);
+		ASSERT((p != NULL) && p->present);
+		frames[i] = p->frame;
+		p->frame = 0;
+		p->present = 0;
+		x86_invlpg(base + i * PAGE_SIZE);
+	}
+	smp_tlb_shootdown(&_kernel_mmu_ctx, base);
+	local_irq_restore(state);
+
+	for (i = 0; i < KSTACK_SIZE / PAGE_SIZE; i++) {
+		page_unref(frames[i]);
+	}
+
+	slot = (base - PAGE_SIZE - KERNEL_KSTACK_START) / KSTACK_SLOT_SIZE;
+
+	spinlock_acquire(&_kstack_lock);
+	bitmap_clear(&_kstack_slots, slot);
+	spinlock_release(&_kstack_lock);
+}
+
+/**
+ * Allocate a kernel stack, return the bottom of the stack. The content of
+ * the stack is not cleared.
+ */
+void *kstack_alloc()
+{
+	boolean_t state;
+	struct list *l = NULL;
+
+	/* Try the cache of current CORE first, no lock is needed */
+	state = local_irq_disable();
+	if (!LIST_EMPTY(&CURR_CORE->kstacks)) {
+		l = CURR_CORE->kstacks.next;
+		list_del(l);
+		CURR_CORE->nr_kstacks--;
+	}
+	local_irq_restore(state);
+
+	if (!l) {
+		spinlock_acquire(&_kstack_lock);
+		if (!LIST_EMPTY(&_kstack_pool)) {
+			l = _kstack_pool.next;
+			list_del(l);
+			_nr_kstack_pool--;
+		}
+		spinlock_release(&_kstack_lock);
+	}
+
+	/* Map a new stack if there is no cached one */
+	return l ? (void *)l : kstack_map();
+}
+
+void kstack_free(void *stack)
+{
+	boolean_t state;
+	struct list *l;
+
+	ASSERT(((ptr_t)stack >= KERNEL_KSTACK_START) &&
+	       ((ptr_t)stack < (KERNEL_KSTACK_START + KERNEL_KSTACK_SIZE)));
+
+	/* Free stack keeps the link at its bottom */
+	l = (struct list *)stack;
+	LIST_INIT(l);
+
+	state = local_irq_disable();
+	if (CURR_CORE->nr_kstacks < KSTACK_CACHE_SIZE) {
+		list_add(l, &CURR_CORE->kstacks);
+		CURR_CORE->nr_kstacks++;
+		l = NULL;
+	}
+	local_irq_restore(state);
+
+	if (!l) {
+		return;
+	}
+
+	spinlock_acquire(&_kstack_lock);
+	if (_nr_kstack_pool < KSTACK_POOL_SIZE) {
+		list_add(l, &_kstack_pool);
+		_nr_kstack_pool++;
+		l = NULL;
+	}
+	spinlock_release(&_kstack_lock);
+
+	/* Too many stacks cached, give the pages back */
+	if (l) {
+		kstack_unmap(stack);
+	}
+}
+
+void init_kstack()
+{
+	ptr_t addr;
+
+	spinlock_init(&_kstack_lock, "kstack-lock");
+	bitmap_init(&_kstack_slots, _kstack_slots_buf, NR_KSTACK_SLOTS);
+	memset(_kstack_slots_buf, 0, sizeof(_kstack_slots_buf));
+
+	/* Create the page tables of the stack area in the kernel context now,
+	 * so they will be shared by all the contexts created later.
+	 */
+	for (addr = KERNEL_KSTACK_START;
+	     addr < (KERNEL_KSTACK_START + KERNEL_KSTACK_SIZE);
+	     addr += (1024 * PAGE_SIZE)) {
+		mmu_get_page(&_kernel_mmu_ctx, addr, TRUE, 0);
+	}
+}
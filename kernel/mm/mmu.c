@@ -11,9 +11,11 @@
 #include "mm/mm.h"
 #include "mm/mlayout.h"
 #include "mm/mmu.h"
+#include "mm/va.h"
 #include "mm/kmem.h"
 #include "mm/malloc.h"
 #include "debug.h"
+#include "smp.h"
 #include "proc/process.h"
 #include "proc/thread.h"
 
@@ -96,7 +98,7 @@ static struct ptbl *clone_ptbl(struct ptbl *src, phys_addr_t *phys_addr)
 
 			/* Clone the flags from source to destination */
 			if (src->pte[i].present) ptbl->pte[i].present = 1;
-			if (src->pte[i].rw) ptbl->pte[i].rw = 1;
+			if (src->pte[i].rw || src->pte[i].shared) ptbl->pte[i].rw = 1;
 			if (src->pte[i].user) ptbl->pte[i].user = 1;
 			if (src->pte[i].accessed) ptbl->pte[i].accessed = 1;
 			if (src->pte[i].dirty) ptbl->pte[i].dirty = 1;
@@ -228,6 +230,80 @@ int mmu_unmap(struct mmu_ctx *ctx, ptr_t virt, boolean_t shared, phys_addr_t *ph
 	return rc;
 }
 
+/**
+ * Check whether the page table of the address was owned by the context,
+ * page tables of the kernel are shared with every context.
+ */
+boolean_t mmu_private_ptbl(struct mmu_ctx *ctx, ptr_t virt)
+{
+	uint32_t dir_idx;
+
+	dir_idx = (virt / PAGE_SIZE) / 1024;
+
+	return ctx->pdir->ptbl[dir_idx] &&
+		(ctx->pdir->ptbl[dir_idx] != _kernel_mmu_ctx.pdir->ptbl[dir_idx]);
+}
+
+/**
+ * Give the context a private copy of a shared page, the page will be
+ * writable afterwards. The lock of the address space must be held, the
+ * other threads of the process and the KSM scanner change the entry too.
+ */
+int mmu_unshare_page(struct mmu_ctx *ctx, ptr_t virt)
+{
+	int rc = -1;
+	uint32_t frame;
+	boolean_t state;
+	struct page *p, np;
+
+	virt = ROUND_DOWN(virt, PAGE_SIZE);
+
+	p = mmu_get_page(ctx, virt, FALSE, 0);
+	if (!p || !p->present) {
+		goto out;
+	}
+
+	/* Another thread unshared it before we got the lock, our TLB may
+	 * still have the read only entry.
+	 */
+	if (p->rw && p->user && !p->shared) {
+		x86_invlpg(virt);
+		rc = 0;
+		goto out;
+	}
+
+	if (!p->shared) {
+		goto out;
+	}
+
+	frame = p->frame;
+
+	/* Copy the content if somebody else still use this page */
+	if (page_refcount(frame) > 1) {
+		memset(&np, 0, sizeof(np));
+		page_alloc(&np, 0);
+		page_copy(np.frame * PAGE_SIZE, frame * PAGE_SIZE);
+		p->frame = np.frame;
+	}
+
+	p->shared = 0;
+	p->rw = 1;
+
+	/* The other COREs running the context may have the old frame */
+	state = local_irq_disable();
+	smp_tlb_shootdown(ctx, virt);
+	local_irq_restore(state);
+
+	if (p->frame != frame) {
+		page_unref(frame);
+	}
+
+	rc = 0;
+
+ out:
+	return rc;
+}
+
 void mmu_load_ctx(struct mmu_ctx *ctx)
 {
 	ASSERT((ctx->pdbr % PAGE_SIZE) == 0);
@@ -243,6 +319,7 @@ void mmu_load_ctx(struct mmu_ctx *ctx)
 void page_fault(struct registers *regs)
 {
 	uint32_t faulting_addr;
+	int rc;
 	int present;
 	int rw;
 	int us;
@@ -258,6 +335,23 @@ void page_fault(struct registers *regs)
 	us = regs->err_code & 0x4;
 	reserved = regs->err_code & 0x8;
 
+	/* Write to a shared page, give the faulting context its own copy */
+	if (present && rw && (faulting_addr < KERNEL_KMEM_START) && CURR_ASPACE) {
+		mutex_acquire(&CURR_ASPACE->lock);
+		rc = mmu_unshare_page(CURR_ASPACE->mmu, faulting_addr);
+		mutex_release(&CURR_ASPACE->lock);
+		if (rc == 0) {
+			return;
+		}
+	}
+
+	/* Page of a demand mapped region, bring it in */
+	if (!present && (faulting_addr < KERNEL_KMEM_START) && CURR_ASPACE) {
+		if (va_fault(CURR_ASPACE, faulting_addr) == 0) {
+			return;
+		}
+	}
+
 	dump_registers(regs);
 
 	/* Print an error message */
@@ -335,8 +429,27 @@ struct mmu_ctx *mmu_create_ctx()
 
 void mmu_destroy_ctx(struct mmu_ctx *ctx)
 {
+	int i, j;
+	struct ptbl *ptbl;
+
 	ASSERT(!IS_KERNEL_CTX(ctx));
 
+	/* Drop the frames and the page tables owned by the context, frames
+	 * shared with others are freed by the last user.
+	 */
+	for (i = 0; i < 1024; i++) {
+		ptbl = ctx->pdir->ptbl[i];
+		if (!ptbl || (ptbl == _kernel_mmu_ctx.pdir->ptbl[i])) {
+			continue;
+		}
+		for (j = 0; j < 1024; j++) {
+			if (ptbl->pte[j].frame) {
+				page_free(&ptbl->pte[j]);
+			}
+		}
+		kmem_free(ptbl);
+	}
+
 	kmem_free(ctx->pdir);
 	kmem_free(ctx);
 }
@@ -346,8 +459,8 @@ void init_mmu_percore()
 	/* Load kernel mmu context into this core */
 	mmu_load_ctx(&_kernel_mmu_ctx);
 	
-	/* Enable paging */
-	x86_write_cr0(x86_read_cr0() | X86_CR0_PG);
+	/* Enable paging, supervisor writes to shared pages should fault too */
+	x86_write_cr0(x86_read_cr0() | X86_CR0_PG | X86_CR0_WP);
 }
 
 void init_mmu()
@@ -379,11 +492,11 @@ void init_mmu()
 	 * have used.
 	 */
 	for (i = 0; i < (_placement_addr + PAGE_SIZE); i += PAGE_SIZE) {
-		/* Kernel code is readable but not writable from user-mode */
+		/* Kernel code is not accessible from user-mode */
 		page = mmu_get_page(&_kernel_mmu_ctx, i, TRUE, 0);
 		page_alloc(page, 0);
 		page->user = FALSE;
-		page->rw = FALSE;
+		page->rw = TRUE;
 	}
 
 	/* Allocate those pages we mapped for kernel pool area */
@@ -394,7 +507,7 @@ void init_mmu()
 		ASSERT(page != NULL);
 		page_alloc(page, 0);
 		page->user = FALSE;
-		page->rw = FALSE;
+		page->rw = TRUE;
 	}
 
 	/* Before we enable paging, we must register our page fault handler */
@@ -405,6 +518,8 @@ void init_mmu()
 	 */
 	mmu_load_ctx(&_kernel_mmu_ctx);
 
-	/* Enable paging */
-	x86_write_cr0(x86_read_cr0() | X86_CR0_PG);
+	/* Enable paging. Write protect is enabled so that the kernel will not
+	 * write to the shared pages of user space directly.
+	 */
+	x86_write_cr0(x86_read_cr0() | X86_CR0_PG | X86_CR0_WP);
 }
@@ -3,6 +3,7 @@
 #include <string.h>
 #include "mm/page.h"
 #include "mm/kmem.h"
+#include "mm/icache.h"
 #include "multiboot.h"
 #include "debug.h"
 
@@ -15,10 +16,26 @@ phys_addr_t _placement_addr = 0;
 /* Total physical pages */
 static page_num_t _nr_total_pages = 0;
 
+/* Free physical pages */
+static page_num_t _nr_free_pages = 0;
+
+/* Number of cached pages to release when we are out of frames */
+#define PAGE_RECLAIM_BATCH	32
+
+/* The image cache is shrunk when fewer pages than this are free */
+#define PAGE_LOW_WATERMARK	(_nr_total_pages / 32)
+
 /* Bitmap for all pages */
 static uint32_t *_pages = NULL;
 static struct spinlock _pages_lock;
 
+/* Reference count for each page, a page may be mapped by several page
+ * table entries if it was merged. KSM merges any number of identical pages
+ * into one, so the count must hold more references than there can be page
+ * table entries.
+ */
+static uint32_t *_page_refs = NULL;
+
 static void set_frame(uint32_t frame_addr)
 {
 	uint32_t frame = frame_addr / 0x1000;
@@ -41,7 +58,7 @@ static uint32_t first_frame()
 {
 	uint32_t i, j, frame;
 
-	frame = 0;
+	frame = (uint32_t)(-1);
 
 	for (i = 0; i < INDEX_FROM_BIT(_nr_total_pages); i++) {
 		if (_pages[i] != 0xFFFFFFFF) {
@@ -78,6 +95,7 @@ void page_early_alloc(phys_addr_t *phys, size_t size, boolean_t align)
 void page_alloc(struct page *p, int flags)
 {
 	uint32_t idx;
+	boolean_t low;
 	
 	ASSERT(p != NULL);
 
@@ -86,18 +104,37 @@ void page_alloc(struct page *p, int flags)
 			       p, p->frame, flags));
 		PANIC("alloc page in use");
 	} else {
-		spinlock_acquire(&_pages_lock);
-		/* Get the first free frame from our global frame set */
-		idx = first_frame();
-		if (idx == (uint32_t)(-1)) {
-			PANIC("No free frames!\n");
+		while (TRUE) {
+			spinlock_acquire(&_pages_lock);
+			/* Get the first free frame from our global frame set */
+			idx = first_frame();
+			if (idx != (uint32_t)(-1)) {
+				break;
+			}
+			spinlock_release(&_pages_lock);
+
+			/* Take the frames of the cached images before giving
+			 * up, the heap may be in the middle of a change so the
+			 * rest is freed by the icache thread.
+			 */
+			if (!icache_reclaim_frames(PAGE_RECLAIM_BATCH)) {
+				PANIC("No free frames!\n");
+			}
 		}
 		/* Mark the frame address as being used */
 		set_frame(idx * PAGE_SIZE);
+		_page_refs[idx] = 1;
+		_nr_free_pages--;
+		low = _nr_free_pages < PAGE_LOW_WATERMARK;
 		spinlock_release(&_pages_lock);
 
 		p->present = 1;
 		p->frame = idx;
+
+		/* Shrink the image cache before we run out of memory */
+		if (low) {
+			icache_wakeup();
+		}
 	}
 
 #ifdef _DEBUG_MM
@@ -119,15 +156,55 @@ void page_free(struct page *p)
 		DEBUG(DL_WRN, ("free page(%p) not allocated.\n", p));
 		PANIC("free page not allocated");
 	} else {
-		spinlock_acquire(&_pages_lock);
-		clear_frame(frame);
-		spinlock_release(&_pages_lock);
+		page_unref(frame);
 		
 		p->frame = 0;
 		p->present = 0;
+		p->shared = 0;
 	}
 }
 
+void page_ref(uint32_t frame)
+{
+	spinlock_acquire(&_pages_lock);
+	ASSERT((_page_refs[frame] != 0) && (_page_refs[frame] != 0xFFFFFFFF));
+	_page_refs[frame]++;
+	spinlock_release(&_pages_lock);
+}
+
+/**
+ * Drop a reference of the page, the page will be freed when the last
+ * reference was dropped. Return the number of remaining references.
+ */
+uint32_t page_unref(uint32_t frame)
+{
+	uint32_t refs;
+	
+	spinlock_acquire(&_pages_lock);
+	ASSERT(_page_refs[frame] != 0);
+	refs = --_page_refs[frame];
+	if (!refs) {
+		clear_frame(frame * PAGE_SIZE);
+		_nr_free_pages++;
+	}
+	spinlock_release(&_pages_lock);
+
+	return refs;
+}
+
+uint32_t page_refcount(uint32_t frame)
+{
+	return _page_refs[frame];
+}
+
+/**
+ * Whether the free pages dropped below the low watermark
+ */
+boolean_t page_low()
+{
+	return _nr_free_pages < PAGE_LOW_WATERMARK;
+}
+
 void phys_alloc(phys_size_t size, phys_addr_t align, phys_addr_t minaddr,
 		phys_addr_t maxaddr, int flags, phys_addr_t *basep)
 {
@@ -166,6 +243,7 @@ void init_page()
 
 	/* Calculate how many pages we have in the system */
 	_nr_total_pages = mem_size / PAGE_SIZE;
+	_nr_free_pages = _nr_total_pages;
 
 	/* Allocate the bitmap for the physical pages */
 	page_early_alloc(&addr, _nr_total_pages/(4*8), FALSE);
@@ -178,4 +256,11 @@ void init_page()
 	 * here.
 	 */
 	memset(_pages, 0, _nr_total_pages/(4*8));
+
+	/* Allocate the reference count for the physical pages */
+	page_early_alloc(&addr, _nr_total_pages * sizeof(uint32_t), FALSE);
+	ASSERT(addr != 0);
+
+	_page_refs = (uint32_t *)addr;
+	memset(_page_refs, 0, _nr_total_pages * sizeof(uint32_t));
 }
@@ -1,11 +1,14 @@
 #include <types.h>
 #include <stddef.h>
+#include <string.h>
 #include "debug.h"
 #include "hal/core.h"
 #include "mm/page.h"
 #include "mm/kmem.h"
 #include "mm/malloc.h"
 #include "mm/va.h"
+#include "mm/icache.h"
+#include "fs.h"
 
 struct va_space *va_create()
 {
@@ -13,6 +16,9 @@ struct va_space *va_create()
 
 	vas = kmalloc(sizeof(struct va_space), 0);
 	if (vas) {
+		vas->ref_count = 1;
+		mutex_init(&vas->lock, "va-mutex", 0);
+		LIST_INIT(&vas->regions);
 		vas->mmu = mmu_create_ctx();
 		if (!vas->mmu) {
 			kfree(vas);
@@ -50,13 +56,15 @@ int va_map(struct va_space *vas, ptr_t start, size_t size, int flags, ptr_t *add
 	}
 
 	DEBUG(DL_DBG, ("vas(%p) start(%p), size(%x).\n", vas, start, size));
+
+	mutex_acquire(&vas->lock);
 	
 	for (virt = start; virt < (start + size); virt += PAGE_SIZE) {
 		p = mmu_get_page(vas->mmu, virt, TRUE, 0);
 		if (!p) {
 			DEBUG(DL_DBG, ("mmu_get_page failed, addr(%p).\n", virt));
 			rc = -1;
-			goto out;
+			goto unlock;
 		}
 		
 		DEBUG(DL_DBG, ("mmu(%p) page(%p) frame(%x).\n", vas->mmu, p, p->frame));
@@ -66,6 +74,9 @@ int va_map(struct va_space *vas, ptr_t start, size_t size, int flags, ptr_t *add
 	}
 
 	rc = 0;
+
+ unlock:
+	mutex_release(&vas->lock);
 	
  out:
 	return rc;
@@ -82,11 +93,13 @@ int va_unmap(struct va_space *vas, ptr_t start, size_t size)
 		goto out;
 	}
 
+	mutex_acquire(&vas->lock);
+
 	for (virt = start; virt < start + size; virt += PAGE_SIZE) {
 		p = mmu_get_page(vas->mmu, virt, FALSE, 0);
 		if (!p) {
 			rc = -1;
-			goto out;
+			goto unlock;
 		}
 		
 		DEBUG(DL_DBG, ("mmu(%p) page(%p) frame(%x).\n", vas->mmu, p, p->frame));
@@ -95,10 +108,239 @@ int va_unmap(struct va_space *vas, ptr_t start, size_t size)
 
 	rc = 0;
 
+ unlock:
+	mutex_release(&vas->lock);
+
+ out:
+	return rc;
+}
+
+/**
+ * Map a region of a file, no memory is allocated until the pages are
+ * touched. The size may exceed the file size, the exceeded part is zero
+ * filled.
+ */
+/*
+ * Check whether any part of the range is mapped, either by a region or by
+ * pages mapped at once. The lock of the address space must be held.
+ */
+static boolean_t va_range_busy(struct va_space *vas, ptr_t start, ptr_t end)
+{
+	ptr_t virt;
+	struct list *l;
+	struct page *p;
+	struct va_region *r;
+
+	LIST_FOR_EACH(l, &vas->regions) {
+		r = LIST_ENTRY(l, struct va_region, link);
+		if ((start < r->end) && (end > r->start)) {
+			return TRUE;
+		}
+	}
+
+	for (virt = ROUND_DOWN(start, PAGE_SIZE); virt < end; virt += PAGE_SIZE) {
+		p = mmu_get_page(vas->mmu, virt, FALSE, 0);
+		if (p && p->present) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * Add a region mapped on demand. The segments of an image may share a page
+ * at their boundary, other callers pass VA_MAP_EXCL to refuse overlaps.
+ */
+int va_map_file(struct va_space *vas, ptr_t start, size_t size, int flags,
+		struct vfs_node *n, uint32_t offset, size_t filesz)
+{
+	int rc = -1;
+	struct va_region *r;
+
+	if (!size || (filesz > size) || (!n && filesz)) {
+		DEBUG(DL_DBG, ("size(%x) filesz(%x) invalid.\n", size, filesz));
+		goto out;
+	}
+
+	r = kmalloc(sizeof(struct va_region), 0);
+	if (!r) {
+		DEBUG(DL_INF, ("kmalloc region failed.\n"));
+		goto out;
+	}
+
+	LIST_INIT(&r->link);
+	r->start = start;
+	r->end = start + size;
+	r->file_end = start + filesz;
+	r->node = n;
+	r->offset = offset;
+	r->flags = flags;
+	if (n) {
+		vfs_node_refer(n);
+	}
+
+	mutex_acquire(&vas->lock);
+	if (FLAG_ON(flags, VA_MAP_EXCL) && va_range_busy(vas, r->start, r->end)) {
+		mutex_release(&vas->lock);
+		DEBUG(DL_DBG, ("vas(%p) range(%p-%p) in use.\n", vas, r->start,
+			       r->end));
+		if (n) {
+			vfs_node_deref(n);
+		}
+		kfree(r);
+		goto out;
+	}
+	list_add_tail(&r->link, &vas->regions);
+	mutex_release(&vas->lock);
+	rc = 0;
+
+	DEBUG(DL_DBG, ("vas(%p) region(%p-%p) file(%p) offset(%x).\n",
+		       vas, r->start, r->end, r->file_end, r->offset));
+
  out:
 	return rc;
 }
 
+/*
+ * Fill the part of the page covered by the region into buf, which holds
+ * the content of the page until it is mapped.
+ */
+static int va_fill_page(struct va_region *r, ptr_t page, uint8_t *buf)
+{
+	int rc;
+	ptr_t start, end;
+
+	start = MAX(page, r->start);
+	end = MIN(page + PAGE_SIZE, r->file_end);
+	if (start >= end) {
+		return 0;
+	}
+
+	rc = vfs_read(r->node, r->offset + (start - r->start), end - start,
+		      buf + (start - page));
+	if (rc != (end - start)) {
+		DEBUG(DL_WRN, ("vfs_read at %p failed, err(%x).\n", start, rc));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Handle a non-present fault in a demand mapped region of the address
+ * space, the address space must be the current one. The page is filled
+ * before it is mapped, so the other threads never see it half filled.
+ */
+int va_fault(struct va_space *vas, ptr_t addr)
+{
+	int rc = -1, nr_regions = 0;
+	boolean_t writable = FALSE;
+	ptr_t page;
+	uint32_t offset = 0, frame;
+	uint8_t *buf = NULL;
+	struct list *l;
+	struct page *p, np, *bp;
+	struct va_region *r, *cached = NULL;
+
+	ASSERT(vas == CURR_ASPACE);
+
+	page = ROUND_DOWN(addr, PAGE_SIZE);
+
+	mutex_acquire(&vas->lock);
+
+	/* Segments may share a page at their boundary */
+	LIST_FOR_EACH(l, &vas->regions) {
+		r = LIST_ENTRY(l, struct va_region, link);
+		if ((page < r->end) && ((page + PAGE_SIZE) > r->start)) {
+			nr_regions++;
+			cached = r;
+			if (FLAG_ON(r->flags, VA_MAP_WRITE)) {
+				writable = TRUE;
+			}
+		}
+	}
+
+	if (!nr_regions) {
+		goto out;
+	}
+
+	/* A read only page filled from the file alone can be shared with
+	 * the other instances through the image cache.
+	 */
+	if ((nr_regions != 1) || writable || !cached->node ||
+	    (page < cached->start) || ((page + PAGE_SIZE) > cached->file_end)) {
+		cached = NULL;
+	} else {
+		offset = cached->offset + (page - cached->start);
+	}
+
+	p = mmu_get_page(vas->mmu, page, TRUE, 0);
+	if (!p) {
+		goto out;
+	}
+
+	/* Another thread brought it in while we waited for the lock */
+	if (p->present) {
+		rc = 0;
+		goto out;
+	}
+
+	if (cached && (icache_get(cached->node, offset, &frame) == 0)) {
+		p->frame = frame;
+		p->present = TRUE;
+		p->user = TRUE;
+		p->rw = FALSE;
+		x86_invlpg(page);
+		rc = 0;
+		goto out;
+	}
+
+	/* Fill a kernel page and copy it to the new frame */
+	buf = kmem_alloc(PAGE_SIZE, MM_ALIGN);
+	if (!buf) {
+		DEBUG(DL_INF, ("kmem_alloc fill buffer failed.\n"));
+		goto out;
+	}
+	memset(buf, 0, PAGE_SIZE);
+
+	LIST_FOR_EACH(l, &vas->regions) {
+		r = LIST_ENTRY(l, struct va_region, link);
+		if ((page < r->end) && ((page + PAGE_SIZE) > r->start) &&
+		    (va_fill_page(r, page, buf) != 0)) {
+			goto out;
+		}
+	}
+
+	memset(&np, 0, sizeof(np));
+	page_alloc(&np, 0);
+	bp = mmu_get_page(&_kernel_mmu_ctx, (ptr_t)buf, FALSE, 0);
+	ASSERT((bp != NULL) && bp->present);
+	page_copy(np.frame * PAGE_SIZE, bp->frame * PAGE_SIZE);
+
+	/* Map it with its final permissions in one go */
+	np.user = TRUE;
+	np.rw = writable;
+	*p = np;
+	x86_invlpg(page);
+
+	/* Only a complete frame nobody else maps may be shared through the
+	 * image cache, the fault lock kept the other threads off it.
+	 */
+	if (cached && (page_refcount(np.frame) == 1)) {
+		icache_put(cached->node, offset, np.frame);
+	}
+
+	rc = 0;
+
+ out:
+	mutex_release(&vas->lock);
+	if (buf) {
+		kmem_free(buf);
+	}
+	return rc;
+}
+
 void va_switch(struct va_space *vas)
 {
 	boolean_t state;
@@ -132,8 +374,44 @@ void va_clone(struct va_space *dst, struct va_space *src)
 	;
 }
 
+void va_ref(struct va_space *vas)
+{
+	atomic_inc(&vas->ref_count);
+}
+
+/**
+ * Drop a reference of the address space, it is freed with the last one.
+ */
 void va_destroy(struct va_space *vas)
 {
+	boolean_t state;
+	struct list *l, *n;
+	struct va_region *r;
+
+	/* atomic_dec() returns the count before the decrement */
+	if (atomic_dec(&vas->ref_count) != 1) {
+		return;
+	}
+
+	/* A kernel thread may still run on the address space, leave it as
+	 * its pages are going away.
+	 */
+	state = local_irq_disable();
+	if (CURR_ASPACE == vas) {
+		CURR_ASPACE = NULL;
+		mmu_load_ctx(&_kernel_mmu_ctx);
+	}
+	local_irq_restore(state);
+
+	LIST_FOR_EACH_SAFE(l, n, &vas->regions) {
+		r = LIST_ENTRY(l, struct va_region, link);
+		list_del(&r->link);
+		if (r->node) {
+			vfs_node_deref(r->node);
+		}
+		kfree(r);
+	}
+
 	mmu_destroy_ctx(vas->mmu);
 	kfree(vas);
 }
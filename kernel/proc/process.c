@@ -23,10 +23,13 @@
 #include "debug.h"
 #include "elf.h"
 #include "semaphore.h"
+#include "rwlock.h"
+#include "rcu.h"
 
 struct process_creation {
 	struct semaphore sem;	// Semaphore for synchronize
 
+	const char *path;	// Path of the executable
 	int argc;		// Argument count
 	const char **argv;	// Arguments
 	const char **env;	// Environments
@@ -46,9 +49,17 @@ static pid_t _next_pid = 1;
 /* Process structure cache */
 static slab_cache_t _proc_cache;
 
+/* Number of buckets in the pid hash table */
+#define NR_PID_BUCKETS	64
+
 /* Tree of all processes */
 static struct avl_tree _proc_tree;
-static struct mutex _proc_tree_lock;
+static struct rwlock _proc_tree_lock;
+
+/* Processes hashed by pid, lookups walk the buckets without a lock and
+ * changes are made with the process tree lock held for writing.
+ */
+static struct list _pid_hash[NR_PID_BUCKETS];
 
 /* kernel process */
 struct process *_kernel_proc = NULL;
@@ -143,6 +154,8 @@ static void process_ctor(void *obj)
 	p->ref_count = 0;
 
 	LIST_INIT(&p->threads);
+	LIST_INIT(&p->joins);
+	mutex_init(&p->lock, "p-mutex", 0);
 
 	/* Initialize the death notifier */
 	init_notifier(&p->death_notifier);
@@ -167,9 +180,16 @@ static void process_release(struct process *p)
 
 static void process_cleanup(struct process *p)
 {
-	if (p->vas) {
-		va_destroy(p->vas);
-		p->vas = NULL;
+	struct va_space *vas;
+
+	/* The KSM scanner looks the address space up under the lock */
+	mutex_acquire(&p->lock);
+	vas = p->vas;
+	p->vas = NULL;
+	mutex_release(&p->lock);
+
+	if (vas) {
+		va_destroy(vas);
 	}
 	
 	if (p->fds) {
@@ -213,6 +233,9 @@ static int process_alloc(const char *name, struct process *parent, struct va_spa
 	p->priority = priority;
 	p->flags = flags;
 	p->status = 0;
+
+	bitmap_init(&p->ustacks, p->ustacks_buf, NR_UTHREAD_STACKS);
+	bitmap_clear_all(&p->ustacks);
 	
 	io_init_ctx(&p->ioctx, parent ? &parent->ioctx : NULL);
 	
@@ -240,9 +263,10 @@ static int process_alloc(const char *name, struct process *parent, struct va_spa
 	}
 
 	/* Insert this process into process tree */
-	mutex_acquire(&_proc_tree_lock);
+	rwlock_write_acquire(&_proc_tree_lock);
 	avl_tree_insert_node(&_proc_tree, &p->tree_link, p->id, p);
-	mutex_release(&_proc_tree_lock);
+	list_add_tail_rcu(&p->hash_link, &_pid_hash[p->id % NR_PID_BUCKETS]);
+	rwlock_write_release(&_proc_tree_lock);
 
 	p->state = PROCESS_RUNNING;
 	*procp = p;
@@ -261,19 +285,55 @@ out:
 }
 
 /**
- * Lookup a process of the specified pid
+ * Lookup a process of the specified pid. No lock is taken, the structure
+ * of a process that exits is freed after a grace period.
  */
 struct process *process_lookup(pid_t pid)
 {
-	struct process *proc;
+	struct list *l;
+	struct process *p, *proc = NULL;
+
+	rcu_read_lock();
+
+	LIST_FOR_EACH_RCU(l, &_pid_hash[pid % NR_PID_BUCKETS]) {
+		p = LIST_ENTRY(l, struct process, hash_link);
+		if (p->id == pid) {
+			proc = p;
+			break;
+		}
+	}
 
-	mutex_acquire(&_proc_tree_lock);
-	proc = avl_tree_lookup(&_proc_tree, pid);
-	mutex_release(&_proc_tree_lock);
+	rcu_read_unlock();
 
 	return proc;
 }
 
+/**
+ * Call the function on each process in the process tree until it returns
+ * non-zero. The processes will not be destroyed during the iteration, the
+ * function must not take the process tree lock again.
+ */
+int process_iterate(int (*func)(struct process *, void *), void *ctx)
+{
+	int rc = 0;
+	struct process *p;
+	struct avl_tree_node *node;
+
+	rwlock_read_acquire(&_proc_tree_lock);
+	
+	AVL_TREE_FOR_EACH(node, &_proc_tree) {
+		p = AVL_TREE_ENTRY(node, struct process);
+		rc = func(p, ctx);
+		if (rc != 0) {
+			break;
+		}
+	}
+	
+	rwlock_read_release(&_proc_tree_lock);
+
+	return rc;
+}
+
 /**
  * Attach a thread to a process
  */
@@ -281,7 +341,9 @@ void process_attach(struct process *p, struct thread *t)
 {
 	t->owner = p;
 	ASSERT(p->state != PROCESS_DEAD);
+	mutex_acquire(&p->lock);
 	list_add_tail(&t->owner_link, &p->threads);
+	mutex_release(&p->lock);
 	atomic_inc(&p->ref_count);
 }
 
@@ -291,12 +353,17 @@ void process_attach(struct process *p, struct thread *t)
 void process_detach(struct thread *t)
 {
 	struct process *p;
+	boolean_t last;
 
+	/* The thread list is walked by process_exit() to kill the others */
 	p = t->owner;
+	mutex_acquire(&p->lock);
 	list_del(&t->owner_link);
+	last = LIST_EMPTY(&p->threads);
+	mutex_release(&p->lock);
 
 	/* Move the process to the dead state if no threads is alive */
-	if (LIST_EMPTY(&p->threads)) {
+	if (last) {
 		ASSERT(p->state != PROCESS_DEAD);
 		p->state = PROCESS_DEAD;
 		process_cleanup(p);
@@ -315,6 +382,10 @@ int process_exit(int status)
 	struct list *l;
 	size_t n = 0;
 
+	/* The killed threads exit on their way back to user mode, they are
+	 * not detached before the reaper gets them so the walk is safe.
+	 */
+	mutex_acquire(&CURR_PROC->lock);
 	LIST_FOR_EACH(l, &CURR_PROC->threads) {
 		t = LIST_ENTRY(l, struct thread, owner_link);
 		if (t != CURR_THREAD) {
@@ -322,6 +393,7 @@ int process_exit(int status)
 		}
 		n++;
 	}
+	mutex_release(&CURR_PROC->lock);
 
 	DEBUG(DL_DBG, ("process(%s:%d), thread number(%d).\n", CURR_PROC->name,
 		       CURR_PROC->id, n));
@@ -353,9 +425,9 @@ static int create_aspace(struct process_creation *info)
 	mmu_clone_ctx(vas->mmu, &_kernel_mmu_ctx);
 
 	/* Lookup the file from the file system */
-	n = vfs_lookup(info->argv[0], VFS_FILE);
+	n = vfs_lookup(info->path, VFS_FILE);
 	if (!n) {
-		DEBUG(DL_DBG, ("file(%s) not found.\n", info->argv[0]));
+		DEBUG(DL_DBG, ("file(%s) not found.\n", info->path));
 		rc = -1;
 		goto out;
 	}
@@ -428,6 +500,28 @@ static void copy_process_args(const char *src[], size_t count, ptr_t dst)
 	}
 }
 
+/*
+ * Copy the arguments and finish loading the image, must be called in the
+ * address space of the image. Return the entry point.
+ */
+static ptr_t process_finish_image(struct process_creation *info)
+{
+	ptr_t entry;
+
+	ASSERT(CURR_ASPACE == info->vas);
+
+	/* Copy the arguments */
+	copy_process_args(info->argv, info->argc, info->args);
+
+	/* Get the entry pointer, the program learns its layout from args */
+	entry = elf_finish_binary(info->data, (struct process_args *)info->args);
+
+	CURR_THREAD->ustack = (void *)info->ustack;
+	CURR_THREAD->ustack_size = USTACK_SIZE;
+
+	return entry;
+}
+
 static void process_entry_thread(void *ctx)
 {
 	ptr_t ustack, entry, args;
@@ -435,20 +529,11 @@ static void process_entry_thread(void *ctx)
 
 	info = (struct process_creation *)ctx;
 
-	ASSERT(CURR_ASPACE == info->vas);
-
 	/* We use a fixed user stack address for now */
 	ustack = info->ustack + USTACK_SIZE - 1;
 	args = (ptr_t)info->args;
 
-	/* Copy the arguments */
-	copy_process_args(info->argv, info->argc, args);
-
-	/* Get the ELF loader to clear BSS and get the entry pointer */
-	entry = elf_finish_binary(info->data);
-
-	CURR_THREAD->ustack = (void *)info->ustack;
-	CURR_THREAD->ustack_size = USTACK_SIZE;
+	entry = process_finish_image(info);
 
 	DEBUG(DL_DBG, ("ustack(%p), args(%p).\n", ustack, args));
 	
@@ -476,6 +561,7 @@ int process_create(const char **args, struct process *parent, int flags,
 
 	memset(&info, 0, sizeof(struct process_creation));
 	
+	info.path = args[0];
 	info.argv = args;
 	info.env = NULL;
 
@@ -524,21 +610,42 @@ int process_create(const char **args, struct process *parent, int flags,
 	return rc;
 }
 
+static void process_free(struct rcu_head *head)
+{
+	struct process *proc;
+
+	proc = LIST_ENTRY(head, struct process, rcu);
+
+	kfree(proc->name);
+	
+	/* Free this process to our process cache */
+	slab_cache_free(&_proc_cache, proc);
+}
+
 int process_destroy(struct process *proc)
 {
+	struct list *l, *n;
+	struct thread_join *j;
+
 	ASSERT(LIST_EMPTY(&proc->threads));
+
+	/* Free the exit status of the threads nobody joined */
+	LIST_FOR_EACH_SAFE(l, n, &proc->joins) {
+		j = LIST_ENTRY(l, struct thread_join, link);
+		list_del(&j->link);
+		kfree(j);
+	}
 	
 	/* Remove this process from the process tree */
-	mutex_acquire(&_proc_tree_lock);
+	rwlock_write_acquire(&_proc_tree_lock);
 	avl_tree_remove_node(&_proc_tree, &proc->tree_link);
-	mutex_release(&_proc_tree_lock);
+	list_del_rcu(&proc->hash_link);
+	rwlock_write_release(&_proc_tree_lock);
 
 	notifier_clear(&proc->death_notifier);
 
-	kfree(proc->name);
-	
-	/* Free this process to our process cache */
-	slab_cache_free(&_proc_cache, proc);
+	/* Lookups may still be looking at the process */
+	call_rcu(&proc->rcu, process_free);
 
 	return 0;
 }
@@ -569,9 +676,206 @@ int process_wait(struct process *p, void *sync)
 	return rc;
 }
 
+/**
+ * Allocate a stack slot for a user thread and map the stack
+ */
+int process_alloc_ustack(struct process *p, ptr_t *stackp)
+{
+	int rc = -1;
+	u_long i;
+	ptr_t stack;
+
+	mutex_acquire(&p->lock);
+	for (i = 0; i < NR_UTHREAD_STACKS; i++) {
+		if (!bitmap_test(&p->ustacks, i)) {
+			bitmap_set(&p->ustacks, i);
+			break;
+		}
+	}
+	mutex_release(&p->lock);
+
+	if (i >= NR_UTHREAD_STACKS) {
+		DEBUG(DL_DBG, ("process(%s:%d) out of stack slots.\n",
+			       p->name, p->id));
+		goto out;
+	}
+
+	/* Leave the first page of the slot non-allocated as the guard page */
+	stack = UTHREAD_STACK_START + i * (USTACK_SIZE + PAGE_SIZE) + PAGE_SIZE;
+	rc = va_map(p->vas, stack, USTACK_SIZE,
+		    VA_MAP_READ|VA_MAP_WRITE|VA_MAP_FIXED, NULL);
+	if (rc != 0) {
+		DEBUG(DL_DBG, ("va_map for ustack failed, err(%x).\n", rc));
+		mutex_acquire(&p->lock);
+		bitmap_clear(&p->ustacks, i);
+		mutex_release(&p->lock);
+		goto out;
+	}
+
+	*stackp = stack;
+
+ out:
+	return rc;
+}
+
+/**
+ * Release the stack slot, the stack should have been unmapped
+ */
+void process_free_ustack(struct process *p, ptr_t stack)
+{
+	u_long i;
+
+	/* The stack of the main thread is not in a slot */
+	if (stack < UTHREAD_STACK_START) {
+		return;
+	}
+
+	i = (stack - UTHREAD_STACK_START) / (USTACK_SIZE + PAGE_SIZE);
+	if (i < NR_UTHREAD_STACKS) {
+		mutex_acquire(&p->lock);
+		bitmap_clear(&p->ustacks, i);
+		mutex_release(&p->lock);
+	}
+}
+
+/**
+ * Copy the argument array to a single kernel buffer, free it with kfree()
+ */
+char **process_dup_args(const char *argv[])
+{
+	char **ret = NULL;
+	size_t i, size, count;
+	char *ptr;
+
+	for (i = 0, size = 0; argv[i] != NULL; i++) {
+		size += strlen(argv[i]) + 1;
+	}
+
+	/* All the strings plus pointers to them and a NULL pointer */
+	count = i;
+	size += (sizeof(char *) * (count + 1));
+
+	ret = kmalloc(size, 0);
+	if (!ret) {
+		goto out;
+	}
+
+	for (i = 0, ptr = (char *)&ret[count + 1]; i < count; i++) {
+		strcpy(ptr, argv[i]);
+		ret[i] = ptr;
+		ptr += strlen(ptr) + 1;
+	}
+	ret[i] = NULL;
+
+ out:
+	return ret;
+}
+
+/**
+ * Replace the image of current process with a new executable. The process
+ * keeps its ID and file descriptors except those marked close-on-exec.
+ * Does not return on success.
+ */
 int process_replace(const char *path, const char *args[])
 {
-	return -1;
+	int rc = -1;
+	boolean_t state;
+	ptr_t entry, ustack, uargs;
+	char *name = NULL;
+	char **kargs = NULL;
+	struct list *l, *n;
+	struct thread_join *j;
+	struct va_space *old;
+	struct process *p;
+	struct process_creation info;
+
+	p = CURR_PROC;
+	if (!path || !args || !args[0] || (p == _kernel_proc)) {
+		DEBUG(DL_DBG, ("invalid parameter.\n"));
+		goto out;
+	}
+
+	/* The other threads would lose their address space */
+	if (p->threads.next != p->threads.prev) {
+		DEBUG(DL_DBG, ("process(%s:%d) has other threads.\n",
+			       p->name, p->id));
+		goto out;
+	}
+
+	/* The path and arguments may be in the address space we are going
+	 * to destroy, copy them to kernel memory first.
+	 */
+	name = kstrdup(path, 0);
+	kargs = process_dup_args(args);
+	if (!name || !kargs) {
+		DEBUG(DL_INF, ("allocate args failed.\n"));
+		goto out;
+	}
+
+	memset(&info, 0, sizeof(struct process_creation));
+	info.path = name;
+	info.argv = (const char **)kargs;
+
+	/* Load the new image into a new address space */
+	rc = create_aspace(&info);
+	if (rc != 0) {
+		DEBUG(DL_DBG, ("create_aspace failed, err(%x).\n", rc));
+		goto out;
+	}
+
+	/* Nothing can fail from here. Reset the state belongs to the old
+	 * image.
+	 */
+	fd_close_on_exec(p);
+	memset(p->signal_act, 0, sizeof(p->signal_act));
+
+	mutex_acquire(&p->lock);
+	LIST_FOR_EACH_SAFE(l, n, &p->joins) {
+		j = LIST_ENTRY(l, struct thread_join, link);
+		list_del(&j->link);
+		kfree(j);
+	}
+	bitmap_clear_all(&p->ustacks);
+	mutex_release(&p->lock);
+
+	kfree(p->name);
+	p->name = name;
+	name = NULL;
+
+	/* Switch to the new address space and drop the old one */
+	mutex_acquire(&p->lock);
+	state = local_irq_disable();
+	old = p->vas;
+	p->vas = info.vas;
+	va_switch(p->vas);
+	local_irq_restore(state);
+	mutex_release(&p->lock);
+	va_destroy(old);
+
+	ustack = info.ustack + USTACK_SIZE - 1;
+	uargs = (ptr_t)info.args;
+	entry = process_finish_image(&info);
+	kfree(kargs);
+
+	/* The TLS of the old image is gone with its address space */
+	thread_set_tls(0);
+
+	DEBUG(DL_DBG, ("process(%s:%d) replaced, entry(%p).\n",
+		       p->name, p->id, entry));
+
+	arch_thread_enter_uspace(entry, ustack, uargs);
+
+	PANIC("Failed to enter user space");
+
+ out:
+	if (name) {
+		kfree(name);
+	}
+	if (kargs) {
+		kfree(kargs);
+	}
+
+	return rc;
 }
 
 int process_getid()
@@ -584,7 +888,7 @@ int process_getid()
  */
 void init_process()
 {
-	int rc = -1;
+	int i, rc = -1;
 	
 	/* Relocate the stack so we know where it is, the stack size is 8KB. Note
 	 * that this was done in the context of kernel mmu.
@@ -595,9 +899,12 @@ void init_process()
 	slab_cache_init(&_proc_cache, "proc-cache", sizeof(struct process),
 			process_ctor, process_dtor, 0);
 
-	/* Initialize the process avl tree and its lock */
+	/* Initialize the process avl tree, the pid hash table and the lock */
 	avl_tree_init(&_proc_tree);
-	mutex_init(&_proc_tree_lock, "ptree-mutex", 0);
+	for (i = 0; i < NR_PID_BUCKETS; i++) {
+		LIST_INIT(&_pid_hash[i]);
+	}
+	rwlock_init(&_proc_tree_lock, "ptree-rwlock");
 
 	/* Create the kernel process. Note that kernel process doesn't need virtual
 	 * address space.
@@ -621,17 +928,19 @@ void shutdown_process()
 	/* At least kernel process should be alive */
 	ASSERT(!AVL_TREE_EMPTY(&_proc_tree));
 	
-	mutex_acquire(&_proc_tree_lock);
+	rwlock_read_acquire(&_proc_tree_lock);
 	
 	AVL_TREE_FOR_EACH(node, &_proc_tree) {
 		p = AVL_TREE_ENTRY(node, struct process);
 		if (p != _kernel_proc) {
+			mutex_acquire(&p->lock);
 			LIST_FOR_EACH(l, &p->threads) {
 				t = LIST_ENTRY(l, struct thread, owner_link);
 				thread_kill(t);
 			}
+			mutex_release(&p->lock);
 		}
 	}
 	
-	mutex_release(&_proc_tree_lock);
+	rwlock_read_release(&_proc_tree_lock);
 }
@@ -2,49 +2,52 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdio.h>
+#include <sched.h>
 #include "matrix/const.h"
 #include "hal/hal.h"
 #include "hal/core.h"
 #include "hal/spinlock.h"
-#include "bitops.h"
 #include "mm/malloc.h"
 #include "mm/mmu.h"
 #include "mm/va.h"
 #include "sys/time.h"
 #include "debug.h"
+#include "div64.h"
 #include "timer.h"
+#include "pit.h"
 #include "proc/process.h"
 #include "proc/sched.h"
+#include "proc/sched_class.h"
+#include "procfs.h"
 #include "semaphore.h"
-
-/* Number of priority levels */
-#define NR_PRIORITIES	32
-
-/* Time quantum to give to threads */
-#define THREAD_QUANTUM	4000
-
-/* Run queue structure */
-struct sched_queue {
-	u_long bitmap;				// Bitmap of queues with data
-	struct list threads[NR_PRIORITIES];	// Queues of runnable threads
+#include "smp.h"
+#include "mutex.h"
+#include "barrier.h"
+#include "rcu.h"
+
+/* Scheduling classes in the order they are picked from */
+static struct sched_class *_sched_classes[] = {
+	&_rt_sched_class,
+	&_fair_sched_class,
+	NULL
 };
-typedef struct sched_queue sched_queue_t;
 
-/* Per-CORE scheduling information structure */
-struct sched_core {
-	struct spinlock lock;			// Lock to protect information/queues
-	
-	struct thread *prev_thread;		// Previously executed thread
-	struct thread *idle_thread;		// Thread scheduled when no other threads runnable
+/* A level of the balancing hierarchy */
+struct sched_domain {
+	const char *name;
+	uint32_t interval;	// Ticks between two periodic balancing
+	size_t imbalance;	// Minimum imbalance worth moving threads
+	boolean_t idle_steal;	// Whether an idle CORE steals in the domain
+};
 
-	struct timer timer;			// Preemption timer
-	struct sched_queue *active;		// Active queue
-	struct sched_queue *expired;		// Expired queue
-	struct sched_queue queues[2];		// Active and expired queues
-	
-	size_t total;				// Total running/ready thread count
+/* Balancing is frequent among the COREs sharing caches and rare across
+ * packages, an idle CORE never steals from another package.
+ */
+static struct sched_domain _sched_domains[NR_SCHED_DOMAINS] = {
+	{"smt", HZ / 15, 2, TRUE},
+	{"package", HZ / 4, 2, TRUE},
+	{"system", HZ, 3, FALSE},
 };
-typedef struct sched_core sched_core_t;
 
 /* Total number of running or ready threads across all COREs */
 static int _nr_running_threads = 0;
@@ -57,33 +60,99 @@ static struct list _dead_threads = {
 static struct spinlock _dead_threads_lock;
 static struct semaphore _dead_threads_sem;
 
-/* Allocate a CORE for a thread to run on */
+/* Whether the affinity of the thread allows it to run on the CORE */
+static INLINE boolean_t sched_allowed(struct thread *t, struct core *c)
+{
+	return (c->id < CPU_SETSIZE) && CPU_ISSET(c->id, &t->affinity);
+}
+
+/* Whether two COREs are in the same balancing domain */
+static boolean_t sched_same_domain(struct core *a, struct core *b, int level)
+{
+	switch (level) {
+	case SD_SMT:
+		return (a->topo.package == b->topo.package) &&
+			(a->topo.core == b->topo.core);
+	case SD_PACKAGE:
+		return a->topo.package == b->topo.package;
+	default:
+		return TRUE;
+	}
+}
+
+/**
+ * Placement cost of a CORE, lower is better. An idle CORE whose SMT
+ * siblings are busy costs more than one on an idle physical core.
+ */
+static size_t sched_core_cost(struct core *core)
+{
+	size_t cost;
+	struct core *other;
+	struct list *l;
+
+	cost = core->sched->total * 2;
+
+	LIST_FOR_EACH(l, &_running_cores) {
+		other = LIST_ENTRY(l, struct core, link);
+		if ((other != core) && other->sched && other->sched->total &&
+		    sched_same_domain(core, other, SD_SMT)) {
+			cost++;
+			break;
+		}
+	}
+
+	return cost;
+}
+
+/**
+ * Allocate a CORE for a thread to run on. A thread that ran before stays
+ * in the package of its last CORE to keep its cache warm, a new thread may
+ * be placed anywhere.
+ */
 static struct core *sched_alloc_core(struct thread *t)
 {
-	size_t load, average, total;
+	int level;
+	size_t cost, best;
 	struct core *core, *other;
 	struct list *l;
 
-	core = CURR_CORE;
+	core = t->core ? t->core : CURR_CORE;
+	level = t->core ? SD_PACKAGE : SD_SYSTEM;
 	
 	/* On UP systems, the only choice is current CORE */
 	if (_nr_cores == 1) {
 		goto out;
 	}
 
-	/* Add 1 to the total number of threads to account for the thread we
-	 * are adding.
-	 */
-	total = _nr_running_threads + 1;
-	ASSERT(_nr_cores != 0);
-	average = total / _nr_cores;
+	/* Start from any allowed CORE if the thread may not run here */
+	if (!sched_allowed(t, core)) {
+		LIST_FOR_EACH(l, &_running_cores) {
+			other = LIST_ENTRY(l, struct core, link);
+			if (other->sched && sched_allowed(t, other)) {
+				core = other;
+				break;
+			}
+		}
+		ASSERT(sched_allowed(t, core));
+		level = SD_SYSTEM;
+	}
+
+	best = sched_core_cost(core);
 
 	LIST_FOR_EACH(l, &_running_cores) {
+		if (!best) {
+			break;
+		}
 		other = LIST_ENTRY(l, struct core, link);
-		load = other->sched->total;
-		if (load < average) {
+		if ((other == core) || !other->sched ||
+		    !sched_allowed(t, other) ||
+		    !sched_same_domain(core, other, level)) {
+			continue;
+		}
+		cost = sched_core_cost(other);
+		if (cost < best) {
 			core = other;
-			break;
+			best = cost;
 		}
 	}
 
@@ -92,78 +161,78 @@ static struct core *sched_alloc_core(struct thread *t)
 }
 
 /**
- * Add `p' to one of the queues of runnable processes. This function is responsible
- * for inserting a process into one of the scheduling queues. `p' must not in the
- * scheduling queues before enqueue.
+ * Add a ready thread to the run queue of its scheduling class. The thread
+ * must not be in the run queue.
  */
-static INLINE void sched_enqueue(struct sched_queue *queue, struct thread *t)
+static INLINE void sched_insert(struct sched_core *c, struct thread *t, int flags)
 {
-	int q;
-#ifdef _DEBUG_SCHED
-	struct thread *thrd;
-	struct list *l;
-#endif	/* _DEBUG_SCHED */
+	ASSERT(t->sched_class != NULL);
+	t->sched_class->enqueue(c, t, flags);
+}
+
+/**
+ * Remove a thread from the run queue of its scheduling class. With
+ * SCHED_SLEEP the thread is the running thread which is going to sleep.
+ */
+static INLINE void sched_remove(struct sched_core *c, struct thread *t, int flags)
+{
+	t->sched_class->dequeue(c, t, flags);
+}
 
-	/* Determine where to insert the process */
-	q = t->priority;
+static int sched_class_rank(struct sched_class *class)
+{
+	int i;
 
-#ifdef _DEBUG_SCHED
-	LIST_FOR_EACH(l, &queue->threads[q]) {
-		thrd = LIST_ENTRY(l, struct thread, runq_link);
-		if (thrd == t) {
-			ASSERT(FALSE);
+	for (i = 0; _sched_classes[i]; i++) {
+		if (_sched_classes[i] == class) {
+			break;
 		}
 	}
-#endif	/* _DEBUG_SCHED */
-	
-	/* Now add the process to the tail of the queue. */
-	ASSERT((q < NR_PRIORITIES) && (q >= 0));
-	list_add_tail(&t->runq_link, &queue->threads[q]);
-	queue->bitmap |= (1 << q);
+
+	return i;
 }
 
 /**
- * A process must be removed from the scheduling queues, for example, because it has
- * been blocked.
+ * Whether a thread just made ready on a CORE should preempt the thread
+ * running there. A higher class always preempts a lower one.
  */
-static INLINE void sched_dequeue(struct sched_queue *queue, struct thread *t)
+static boolean_t sched_should_preempt(struct core *core, struct thread *t)
 {
-	int q;
-#ifdef _DEBUG_SCHED
-	size_t found_times = 0;
-	struct thread *thrd;
-	struct list *l;
-#endif	/* _DEBUG_SCHED */
-
-	q = t->priority;
+	struct sched_core *c = core->sched;
+	struct thread *curr = core->thread;
 
-	/* Now make sure that the process is not in its ready queue. Remove the process
-	 * if it was found.
-	 */
-	ASSERT((q < NR_PRIORITIES) && (q >= 0));
-	list_del(&t->runq_link);
-	if (LIST_EMPTY(&queue->threads[q])) {
-		queue->bitmap &= ~(1 << q);
+	if (curr == c->idle_thread) {
+		return TRUE;
 	}
-	
-#ifdef _DEBUG_SCHED
-	/* You can also just remove the specified process, but I just make sure it is
-	 * really in our ready queue.
-	 */
-	LIST_FOR_EACH(l, &queue->threads[q]) {
-		thrd = LIST_ENTRY(l, struct thread, runq_link);
-		if (thrd == t) {
-			found_times++;
-		}
+
+	if (t->sched_class != curr->sched_class) {
+		return sched_class_rank(t->sched_class) <
+			sched_class_rank(curr->sched_class);
 	}
 
-	ASSERT(found_times == 0);		// The process should not be found
-#endif	/* _DEBUG_SCHED */
+	return t->sched_class->preempt ?
+		t->sched_class->preempt(c, t, curr) : FALSE;
 }
 
-static void sched_adjust_priority(struct sched_core *c, struct thread *t)
+/**
+ * Tell a CORE its need_resched flag was set, the lock of its scheduler must
+ * be held. An idle CORE waiting in MWAIT on the flag wakes up by itself,
+ * the others get a reschedule IPI.
+ */
+static void sched_kick(struct core *core)
 {
-	;
+	if (core == CURR_CORE) {
+		return;
+	}
+
+	/* Pairs with the barrier in sched_idle_wait() */
+	smp_mb();
+	if (core->sched->polling) {
+		core->sched->nr_polled++;
+		return;
+	}
+
+	smp_send_reschedule(core);
 }
 
 static void sched_timer_func(void *ctx)
@@ -174,29 +243,117 @@ static void sched_timer_func(void *ctx)
 }
 
 /**
- * Pick a new process from the queue to run
+ * Pick a new thread to run from the highest scheduling class that has
+ * ready threads.
  */
-static struct thread *sched_pick_thread(struct sched_core *c)
+static struct thread *sched_pick(struct sched_core *c)
 {
-	int q;
-	struct list *l;
-	struct thread *t;
+	int i;
+	struct thread *t = NULL;
 
-	t = NULL;
-	
-	if (c->active->bitmap) {
-		q = bitops_fls(c->active->bitmap);
-		ASSERT(!LIST_EMPTY(&c->active->threads[q]));
-		l = c->active->threads[q].next;
-		t = LIST_ENTRY(l, struct thread, runq_link);
-		sched_dequeue(c->active, t);
-	} else {
-		ASSERT(c->total == 0);
+	for (i = 0; _sched_classes[i]; i++) {
+		t = _sched_classes[i]->pick(c);
+		if (t) {
+			break;
+		}
+	}
+
+	if (!t) {
+		ASSERT((c->total == 0) || c->rt.throttled);
 	}
 	
 	return t;
 }
 
+/**
+ * Whether a ready thread may be moved to CORE dst. The lock of the previous
+ * thread is held until its CORE has switched away from it, so a thread with
+ * its lock held may still be running.
+ */
+boolean_t sched_can_migrate(struct thread *t, struct core *dst)
+{
+	return sched_allowed(t, dst) && !spinlock_held(&t->lock);
+}
+
+/* Find the CORE in the domain with the most running/ready threads */
+static struct core *sched_find_busiest(struct core *this, int level)
+{
+	struct list *l;
+	struct core *c, *busiest = NULL;
+
+	LIST_FOR_EACH(l, &_running_cores) {
+		c = LIST_ENTRY(l, struct core, link);
+		if ((c == this) || !c->sched ||
+		    !sched_same_domain(this, c, level)) {
+			continue;
+		}
+		if (!busiest || (c->sched->total > busiest->sched->total)) {
+			busiest = c;
+		}
+	}
+
+	return busiest;
+}
+
+/**
+ * Pull ready threads from the busiest CORE of the domain to this CORE. An
+ * idle CORE takes one thread, otherwise half of the imbalance is moved if it
+ * is large enough for the domain. The lock of this
+ * CORE must be held, the lock of the busiest CORE is only tried so that two
+ * COREs pulling from each other cannot deadlock. Return the number of
+ * threads moved.
+ */
+static size_t sched_balance(struct core *this, int level, boolean_t idle)
+{
+	int i;
+	size_t nr, threshold, moved = 0;
+	struct core *src;
+	struct thread *t;
+
+	src = sched_find_busiest(this, level);
+	threshold = idle ? 2 : _sched_domains[level].imbalance;
+	if (!src || (src->sched->total < (this->sched->total + threshold))) {
+		goto out;
+	}
+
+	nr = idle ? 1 : (src->sched->total - this->sched->total) / 2;
+
+	if (!spinlock_try_acquire_noirq(&src->sched->lock)) {
+		goto out;
+	}
+
+	while (moved < nr) {
+		t = NULL;
+		for (i = 0; _sched_classes[i] && !t; i++) {
+			if (_sched_classes[i]->steal) {
+				t = _sched_classes[i]->steal(src->sched, this);
+			}
+		}
+		if (!t) {
+			break;
+		}
+
+		sched_remove(src->sched, t, SCHED_MIGRATE);
+		src->sched->total--;
+		t->core = this;
+		sched_insert(this->sched, t, SCHED_MIGRATE);
+		this->sched->total++;
+		moved++;
+
+		if (sched_should_preempt(this, t)) {
+			this->sched->need_resched = TRUE;
+		}
+
+		DEBUG(DL_DBG, ("thread(%s:%d) core(%d) -> core(%d).\n",
+			       t->name, t->id, src->id, this->id));
+	}
+
+	spinlock_release_noirq(&src->sched->lock);
+
+ out:
+	return moved;
+}
+
 void sched_insert_thread(struct thread *t)
 {
 	sched_core_t *sched;
@@ -209,8 +366,19 @@ void sched_insert_thread(struct thread *t)
 	
 	spinlock_acquire(&sched->lock);
 	
-	sched_enqueue(sched->active, t);
+	sched_insert(sched, t, SCHED_WAKEUP);
+	sched_stat_enqueue(t, TRUE);
 	sched->total++;
+	atomic_inc(&_nr_running_threads);
+
+	/* The running thread is preempted when we get out of the interrupt
+	 * or system call, see sched_preempt(). A remote CORE is kicked so it
+	 * does not wait for its next tick.
+	 */
+	if (sched_should_preempt(t->core, t)) {
+		sched->need_resched = TRUE;
+		sched_kick(t->core);
+	}
 
 	spinlock_release(&sched->lock);
 
@@ -226,9 +394,15 @@ void sched_reschedule(boolean_t state)
 {
 	struct sched_core *c;
 	struct thread *next;
+	useconds_t now, wait = 0;
+	boolean_t voluntary, stop_tick;
+	int i, flags;
 
 	/* We need interrupt disabled so we don't get bothered by interrupts */
 	ASSERT(local_irq_state() == FALSE);
+
+	/* RCU readers must not sleep or yield */
+	ASSERT(!CURR_CORE->rcu_nesting);
 	
 	/* Get current schedule CORE */
 	c = CURR_CORE->sched;
@@ -238,17 +412,37 @@ void sched_reschedule(boolean_t state)
 	/* Thread cannot be in ready state if we are running it now */
 	ASSERT(CURR_THREAD->state != THREAD_READY);
 
-	/* Adjust the priority of the thread based on whether it used up its quantum */
+	flags = c->need_resched ? SCHED_PREEMPT : 0;
+	c->need_resched = FALSE;
+	voluntary = c->yielded || (CURR_THREAD->state != THREAD_RUNNING);
+	c->yielded = FALSE;
+
+	/* Charge the time the thread has run to its scheduling class */
+	now = sys_time();
 	if (CURR_THREAD != c->idle_thread) {
-		sched_adjust_priority(c, CURR_THREAD);
+		CURR_THREAD->sum_exec += now - CURR_THREAD->exec_start;
+		CURR_THREAD->sched_class->charge(c, CURR_THREAD,
+						 now - CURR_THREAD->exec_start);
+		sched_stat_slice(c, now - CURR_THREAD->exec_start);
 	}
 
 	/* Enqueue and dequeue the current process to update the thread queue */
 	if (CURR_THREAD->state == THREAD_RUNNING) {
 		/* The thread hasn't gone to sleep, re-queue it */
 		CURR_THREAD->state = THREAD_READY;
-		if (CURR_THREAD != c->idle_thread) {
-			sched_enqueue(c->active, CURR_THREAD);
+		if (CURR_THREAD == c->idle_thread) {
+			;
+		} else if (!sched_allowed(CURR_THREAD, CURR_CORE)) {
+			/* The affinity was changed, the thread is queued on
+			 * another CORE once we switched away from it.
+			 */
+			sched_remove(c, CURR_THREAD, SCHED_SLEEP);
+			c->total--;
+			atomic_dec(&_nr_running_threads);
+			c->migrate_prev = TRUE;
+		} else {
+			sched_insert(c, CURR_THREAD, flags);
+			sched_stat_enqueue(CURR_THREAD, FALSE);
 		}
 	} else {
 		/* The thread has gone sleep or dead */
@@ -256,6 +450,7 @@ void sched_reschedule(boolean_t state)
 			       CURR_PROC->name, CURR_THREAD->name,
 			       CURR_THREAD->id, CURR_THREAD->state));
 		ASSERT(CURR_THREAD != c->idle_thread);
+		sched_remove(c, CURR_THREAD, SCHED_SLEEP);
 		c->total--;
 		atomic_dec(&_nr_running_threads);
 	}
@@ -263,9 +458,21 @@ void sched_reschedule(boolean_t state)
 	/* Find a new thread to run. A NULL return value means no threads are
 	 * ready, so we schedule the idle thread in this case.
 	 */
-	next = sched_pick_thread(c);
+	next = sched_pick(c);
+	if (!next && (_nr_cores > 1)) {
+		/* Steal work from the closest busy CORE instead of going idle */
+		for (i = 0; i < NR_SCHED_DOMAINS; i++) {
+			if (_sched_domains[i].idle_steal &&
+			    sched_balance(CURR_CORE, i, TRUE)) {
+				c->nr_stolen++;
+				next = sched_pick(c);
+				break;
+			}
+		}
+	}
 	if (next) {
-		next->quantum = THREAD_QUANTUM;
+		next->quantum = next->sched_class->slice(c, next);
+		sched_stat_dequeue(c, next);
 	} else {
 		next = c->idle_thread;
 		if (next != CURR_THREAD) {
@@ -276,7 +483,22 @@ void sched_reschedule(boolean_t state)
 		next->quantum = 0;
 	}
 
+	/* Stop the periodic tick only if there is nothing to run. Ready RT
+	 * threads of a throttled CORE are picked again at the next period.
+	 */
+	stop_tick = (next == c->idle_thread) && !c->total;
+	if ((next == c->idle_thread) && c->total && c->rt.throttled) {
+		wait = c->rt.period_start + _rt_period - now;
+		if ((wait == 0) || (wait > _rt_period)) {
+			wait = 1;
+		}
+	}
+
 	ASSERT(next->core == CURR_CORE);
+	next->exec_start = now;
+	if (next != CURR_THREAD) {
+		sched_stat_switch(c, CURR_THREAD, voluntary);
+	}
 
 	/* Move the next thread to running state and set it as the current */
 	c->prev_thread = CURR_THREAD;
@@ -286,10 +508,17 @@ void sched_reschedule(boolean_t state)
 	/* Finished with the scheduler queues, release the lock */
 	spinlock_release_noirq(&c->lock);
 
-	/* Set off the timer if necessary */
+	/* The one-shot timer is armed for the end of the quantum or of the
+	 * throttling period, the periodic tick is stopped while idle.
+	 */
+	CURR_CORE->tick_stopped = stop_tick;
 	if (CURR_THREAD->quantum > 0) {
 		set_timer(&c->timer, CURR_THREAD->quantum, sched_timer_func,
 			  CURR_THREAD);
+	} else if (wait) {
+		set_timer(&c->timer, wait, sched_timer_func, CURR_THREAD);
+	} else {
+		cancel_timer(&c->timer);
 	}
 	
 	/* Perform the thread switch if current thread is not the same as
@@ -317,10 +546,347 @@ void sched_reschedule(boolean_t state)
 		sched_post_switch(state);
 	} else {
 		spinlock_release_noirq(&CURR_THREAD->lock);
+		rcu_quiescent();
 		local_irq_restore(state);
 	}
 }
 
+/**
+ * Give up the CORE to other ready threads of the same or higher priority
+ */
+void sched_yield()
+{
+	boolean_t state;
+	struct sched_core *c;
+
+	state = local_irq_disable();
+
+	c = CURR_CORE->sched;
+	if (CURR_THREAD != c->idle_thread) {
+		spinlock_acquire_noirq(&c->lock);
+		if (CURR_THREAD->sched_class->yield) {
+			CURR_THREAD->sched_class->yield(c, CURR_THREAD);
+		}
+		c->yielded = TRUE;
+		spinlock_release_noirq(&c->lock);
+	}
+
+	spinlock_acquire_noirq(&CURR_THREAD->lock);
+	sched_reschedule(state);
+}
+
+/**
+ * Reschedule if a thread that should preempt the running thread was made
+ * ready on this CORE. Called on the way out of an interrupt or system call.
+ */
+void sched_preempt()
+{
+	boolean_t state;
+	struct sched_core *c;
+
+	state = local_irq_disable();
+
+	/* An RCU reader holds off preemption until rcu_read_unlock() */
+	c = CURR_CORE->sched;
+	if (!c || !c->need_resched || !CURR_CORE->timer_enabled ||
+	    CURR_CORE->rcu_nesting) {
+		local_irq_restore(state);
+		return;
+	}
+
+	spinlock_acquire_noirq(&CURR_THREAD->lock);
+	sched_reschedule(state);
+}
+
+/**
+ * Lock the scheduler of the CORE a thread is on, the lock of the thread must
+ * be held. A ready thread may be pulled to another CORE until we get the
+ * lock of its CORE, the lock of the thread stops further moves.
+ */
+static struct sched_core *sched_lock_core(struct thread *t)
+{
+	struct sched_core *c;
+
+	while (TRUE) {
+		c = t->core ? t->core->sched : NULL;
+		if (!c) {
+			break;
+		}
+		spinlock_acquire_noirq(&c->lock);
+		if (t->core->sched == c) {
+			break;
+		}
+		spinlock_release_noirq(&c->lock);
+	}
+
+	return c;
+}
+
+/*
+ * Move a thread to a new effective policy and priority, the lock of the
+ * thread must be held. The thread is moved to the run queue of the new
+ * class if it is ready.
+ */
+static void sched_change(struct thread *t, int policy, int priority)
+{
+	boolean_t ready;
+	struct sched_core *c;
+	struct sched_class *class;
+
+	class = (policy == SCHED_OTHER) ? &_fair_sched_class : &_rt_sched_class;
+
+	c = sched_lock_core(t);
+
+	ready = (t->state == THREAD_READY) && c;
+	if (ready) {
+		sched_remove(c, t, 0);
+	}
+
+	/* The virtual runtime means nothing to the other classes, a thread
+	 * joining the fair class starts at the minimum of the queue.
+	 */
+	if ((class == &_fair_sched_class) && (t->sched_class != class)) {
+		t->vruntime = (ready || (t->state == THREAD_RUNNING)) ?
+			c->fair.min_vruntime : 0;
+	}
+
+	t->sched_class = class;
+	t->policy = policy;
+	t->priority = priority;
+
+	if (ready) {
+		sched_insert(c, t, 0);
+	}
+
+	/* Let the scheduler of the thread's CORE pick again */
+	if (c) {
+		c->need_resched = TRUE;
+		sched_kick(t->core);
+		spinlock_release_noirq(&c->lock);
+	}
+
+	DEBUG(DL_DBG, ("thread(%s:%d) policy(%d) priority(%d).\n",
+		       t->name, t->id, policy, priority));
+}
+
+/*
+ * Run the thread at the higher of its base priority and the priority it
+ * inherited from the waiters of its mutexes, the lock of the thread must
+ * be held. Returns TRUE if the effective priority changed.
+ */
+static boolean_t sched_update_priority(struct thread *t)
+{
+	int policy, priority;
+
+	policy = t->base_policy;
+	priority = t->base_priority;
+	if ((t->pi_policy >= 0) &&
+	    (sched_prio_rank(t->pi_policy, t->pi_priority) >
+	     sched_prio_rank(policy, priority))) {
+		policy = t->pi_policy;
+		priority = t->pi_priority;
+	}
+
+	if ((policy == t->policy) && (priority == t->priority)) {
+		return FALSE;
+	}
+
+	sched_change(t, policy, priority);
+
+	return TRUE;
+}
+
+/**
+ * Change the scheduling policy and priority of a thread. A thread boosted
+ * by priority inheritance keeps the boost until it releases its mutexes.
+ */
+int sched_set_policy(struct thread *t, int policy, int priority)
+{
+	int rc = -1;
+
+	if ((priority < SCHED_PRIORITY_MIN) || (priority > SCHED_PRIORITY_MAX)) {
+		DEBUG(DL_DBG, ("invalid priority(%d).\n", priority));
+		goto out;
+	}
+
+	if ((policy != SCHED_OTHER) && (policy != SCHED_FIFO) &&
+	    (policy != SCHED_RR)) {
+		DEBUG(DL_DBG, ("invalid policy(%d).\n", policy));
+		goto out;
+	}
+
+	spinlock_acquire(&t->lock);
+	t->base_policy = policy;
+	t->base_priority = priority;
+	sched_update_priority(t);
+	spinlock_release(&t->lock);
+
+	/* A waiter moves in the wait queue and may change the boost of the
+	 * owner of the mutex.
+	 */
+	mutex_pi_update(t);
+	rc = 0;
+
+ out:
+	return rc;
+}
+
+/**
+ * Set the priority a thread inherits from the waiters of its mutexes, a
+ * negative policy removes the boost. Returns TRUE if the effective priority
+ * of the thread changed.
+ */
+boolean_t sched_set_boost(struct thread *t, int policy, int priority)
+{
+	boolean_t changed;
+
+	spinlock_acquire(&t->lock);
+	t->pi_policy = policy;
+	t->pi_priority = priority;
+	changed = sched_update_priority(t);
+	spinlock_release(&t->lock);
+
+	return changed;
+}
+
+/**
+ * Called on every timer tick. Samples the length of the run queue and
+ * balances the load in each domain periodically, starting from the closest
+ * COREs.
+ */
+/*
+ * Wake up an idle CORE of the domain whose tick is stopped, it steals from
+ * the busiest CORE when it reschedules.
+ */
+static void sched_kick_idle(struct core *this, int level)
+{
+	struct list *l;
+	struct core *c;
+
+	LIST_FOR_EACH(l, &_running_cores) {
+		c = LIST_ENTRY(l, struct core, link);
+		if ((c == this) || !c->sched || !c->tick_stopped ||
+		    !sched_same_domain(this, c, level)) {
+			continue;
+		}
+
+		spinlock_acquire_noirq(&c->sched->lock);
+		c->sched->need_resched = TRUE;
+		sched_kick(c);
+		spinlock_release_noirq(&c->sched->lock);
+		break;
+	}
+}
+
+void sched_tick()
+{
+	int i;
+	size_t moved;
+	boolean_t state, busy;
+	struct sched_core *c;
+
+	state = local_irq_disable();
+
+	c = CURR_CORE->sched;
+	if (!c) {
+		goto out;
+	}
+
+	spinlock_acquire_noirq(&c->lock);
+
+	c->samples++;
+	c->sum_queued += c->total;
+	if (c->total > c->max_queued) {
+		c->max_queued = c->total;
+	}
+
+	c->ticks++;
+	for (i = 0; (i < NR_SCHED_DOMAINS) && (_nr_cores > 1); i++) {
+		if (c->ticks % _sched_domains[i].interval) {
+			continue;
+		}
+		moved = sched_balance(CURR_CORE, i, FALSE);
+		if (moved) {
+			c->nr_pulled[i] += moved;
+			break;
+		}
+	}
+
+	/* Enough threads for an idle CORE to steal one */
+	busy = c->total >= 2;
+
+	spinlock_release_noirq(&c->lock);
+
+	/* Idle COREs have no tick to balance on, so we kick one of them */
+	for (i = 0; busy && (i < NR_SCHED_DOMAINS) && (_nr_cores > 1); i++) {
+		if (_sched_domains[i].idle_steal &&
+		    !(c->ticks % _sched_domains[i].interval)) {
+			sched_kick_idle(CURR_CORE, i);
+			break;
+		}
+	}
+
+ out:
+	local_irq_restore(state);
+}
+
+/**
+ * Change the COREs a thread may run on. A ready thread on a CORE it may not
+ * use any more is queued on another CORE now, a running one when it is
+ * switched out.
+ */
+int sched_set_affinity(struct thread *t, cpu_set_t *mask)
+{
+	int rc = -1;
+	boolean_t allowed = FALSE;
+	struct sched_core *c;
+	struct core *core;
+	struct list *l;
+
+	/* The thread must be able to run somewhere */
+	LIST_FOR_EACH(l, &_running_cores) {
+		core = LIST_ENTRY(l, struct core, link);
+		if ((core->id < CPU_SETSIZE) && CPU_ISSET(core->id, mask)) {
+			allowed = TRUE;
+			break;
+		}
+	}
+	if (!allowed) {
+		DEBUG(DL_DBG, ("no running CORE in the mask.\n"));
+		goto out;
+	}
+
+	spinlock_acquire(&t->lock);
+
+	t->affinity = *mask;
+
+	c = sched_lock_core(t);
+	if (c && !sched_allowed(t, t->core)) {
+		if (t->state == THREAD_READY) {
+			sched_remove(c, t, SCHED_MIGRATE);
+			c->total--;
+			atomic_dec(&_nr_running_threads);
+			spinlock_release_noirq(&c->lock);
+			c = NULL;
+			sched_insert_thread(t);
+		} else if (t->state == THREAD_RUNNING) {
+			c->need_resched = TRUE;
+			sched_kick(t->core);
+		}
+	}
+	if (c) {
+		spinlock_release_noirq(&c->lock);
+	}
+
+	spinlock_release(&t->lock);
+
+	DEBUG(DL_DBG, ("thread(%s:%d) affinity changed.\n", t->name, t->id));
+	rc = 0;
+
+ out:
+	return rc;
+}
+
 void sched_post_switch(boolean_t state)
 {
 	struct thread *t;
@@ -331,6 +897,14 @@ void sched_post_switch(boolean_t state)
 	t = CURR_CORE->sched->prev_thread;
 	if (t) {
 
+		/* The thread is not running anymore, queue it on a CORE its
+		 * affinity allows before others may touch it.
+		 */
+		if (CURR_CORE->sched->migrate_prev) {
+			CURR_CORE->sched->migrate_prev = FALSE;
+			sched_insert_thread(t);
+		}
+
 		/* Release the previous thread. We have performed switch if
 		 * prev_thread is not NULL
 		 */
@@ -351,6 +925,9 @@ void sched_post_switch(boolean_t state)
 		}
 	}
 
+	/* The CORE is between two threads, no reader is running */
+	rcu_quiescent();
+
 	local_irq_restore(state);
 }
 
@@ -381,6 +958,28 @@ static void sched_reaper_thread(void *ctx)
 	}
 }
 
+/*
+ * Wait for work with interrupts disabled. MWAIT on need_resched lets a
+ * remote CORE wake us with a plain store instead of an IPI.
+ */
+static void sched_idle_wait(struct sched_core *c)
+{
+	if (!_core_features.monitor) {
+		if (!c->need_resched) {
+			core_idle();
+		}
+		return;
+	}
+
+	c->polling = TRUE;
+	smp_mb();
+	core_monitor(&c->need_resched);
+	if (!c->need_resched) {
+		core_mwait();
+	}
+	c->polling = FALSE;
+}
+
 static void sched_idle_thread(void *ctx)
 {
 	/* We run the loop with interrupts disabled. The core_idle() function
@@ -391,14 +990,19 @@ static void sched_idle_thread(void *ctx)
 	while (TRUE) {
 		spinlock_acquire_noirq(&CURR_THREAD->lock);
 		sched_reschedule(FALSE);
-		
-		core_idle();
+
+		/* Report the quiescent state before we wait, the wait returns
+		 * at once if that woke up the rcu thread.
+		 */
+		rcu_idle_enter();
+		sched_idle_wait(CURR_CORE->sched);
+		rcu_idle_exit();
 	}
 }
 
 void init_sched_percore()
 {
-	int i, j, rc = -1;
+	int i, rc = -1;
 	char name[T_NAME_LEN];
 
 	/* Initialize the scheduler for the current CORE */
@@ -408,8 +1012,24 @@ void init_sched_percore()
 	spinlock_init(&CURR_CORE->sched->lock, "sched-lock");
 	
 	CURR_CORE->sched->total = 0;
-	CURR_CORE->sched->active = &CURR_CORE->sched->queues[0];
-	CURR_CORE->sched->expired = &CURR_CORE->sched->queues[1];
+	CURR_CORE->sched->need_resched = FALSE;
+	CURR_CORE->sched->migrate_prev = FALSE;
+	CURR_CORE->sched->yielded = FALSE;
+	memset(&CURR_CORE->sched->stat, 0, sizeof(CURR_CORE->sched->stat));
+	CURR_CORE->sched->ticks = 0;
+	CURR_CORE->sched->samples = 0;
+	CURR_CORE->sched->sum_queued = 0;
+	CURR_CORE->sched->max_queued = 0;
+	memset(CURR_CORE->sched->nr_pulled, 0,
+	       sizeof(CURR_CORE->sched->nr_pulled));
+	CURR_CORE->sched->nr_stolen = 0;
+	CURR_CORE->sched->polling = FALSE;
+	CURR_CORE->sched->nr_polled = 0;
+
+	/* Initialize run queues of the scheduling classes */
+	for (i = 0; _sched_classes[i]; i++) {
+		_sched_classes[i]->init(CURR_CORE->sched);
+	}
 
 	/* Create the per CORE idle thread */
 	snprintf(name, T_NAME_LEN - 1, "idle-%d", CURR_CORE->id);
@@ -427,14 +1047,50 @@ void init_sched_percore()
 	
 	/* Create the preemption timer */
 	init_timer(&CURR_CORE->sched->timer, "sched-tmr", TIMER_SCHED);
+}
 
-	/* Initialize queues */
-	for (i = 0; i < 2; i++) {
-		CURR_CORE->sched->queues[i].bitmap = 0;
-		for (j = 0; j < NR_PRIORITIES; j++) {
-			LIST_INIT(&CURR_CORE->sched->queues[i].threads[j]);
+static int sched_procfs_read(char *buf, size_t size)
+{
+	int len = 0;
+	uint64_t avg;
+	struct list *l;
+	struct core *c;
+
+	LIST_FOR_EACH(l, &_running_cores) {
+		c = LIST_ENTRY(l, struct core, link);
+
+		/* Average queue length in hundredths */
+		avg = c->sched->sum_queued * 100;
+		if (c->sched->samples) {
+			do_div(avg, c->sched->samples);
+		}
+
+		len += snprintf(buf + len, size - len,
+				"core%d package %d core %d thread %d "
+				"total %d rt_ready %d rt_runtime %lld "
+				"rt_throttled %d fair_ready %d fair_load %d "
+				"min_vruntime %lld avg_queued %d.%02d "
+				"max_queued %d pulled %d/%d/%d stolen %d "
+				"resched_ipis %d polled %d\n",
+				c->id, c->topo.package, c->topo.core,
+				c->topo.thread,
+				c->sched->total, c->sched->rt.nr_ready,
+				c->sched->rt.runtime, c->sched->rt.nr_throttled,
+				c->sched->fair.nr_ready, c->sched->fair.load,
+				c->sched->fair.min_vruntime,
+				(uint32_t)avg / 100, (uint32_t)avg % 100,
+				c->sched->max_queued,
+				c->sched->nr_pulled[SD_SMT],
+				c->sched->nr_pulled[SD_PACKAGE],
+				c->sched->nr_pulled[SD_SYSTEM],
+				c->sched->nr_stolen, c->resched_ipis,
+				c->sched->nr_polled);
+		if (len >= size) {
+			break;
 		}
 	}
+
+	return len;
 }
 
 void init_sched()
@@ -449,6 +1105,9 @@ void init_sched()
 	rc = thread_create("reaper", NULL, 0, sched_reaper_thread, NULL, NULL);
 	ASSERT(rc == 0);
 
+	procfs_register("sched", sched_procfs_read);
+	init_sched_stat();
+
 	DEBUG(DL_DBG, ("sched queues initialization done.\n"));
 }
 
@@ -459,6 +1118,7 @@ void sched_enter()
 
 	// TODO: Find a better place to do the following
 	CURR_CORE->timer_enabled = TRUE;
+	timer_reprogram();
 
 	/* Switch to current process */
 	arch_thread_switch(CURR_THREAD, NULL);
@@ -0,0 +1,229 @@
+/*
+ * sched_fair.c
+ *
+ * Fair scheduling class. Each thread accumulates virtual runtime, which is
+ * the time it ran scaled by the weight of its priority, and the thread with
+ * the smallest virtual runtime runs next. Within a scheduling period every
+ * ready thread runs once for a slice proportional to its weight.
+ */
+
+#include <types.h>
+#include <stddef.h>
+#include "matrix/matrix.h"
+#include "debug.h"
+#include "div64.h"
+#include "rtl/avltree.h"
+#include "proc/thread.h"
+#include "proc/sched_class.h"
+
+/* Weight of the default priority */
+#define FAIR_WEIGHT_BASE	1024
+
+/* Period in which every ready thread should run once */
+#define FAIR_LATENCY		20000
+
+/* Minimum slice, the period is stretched if there are too many threads */
+#define FAIR_MIN_GRANULARITY	4000
+#define FAIR_NR_LATENCY		(FAIR_LATENCY / FAIR_MIN_GRANULARITY)
+
+/* Virtual runtime credited to a thread that wakes up from sleep */
+#define FAIR_SLEEP_CREDIT	(FAIR_LATENCY / 2)
+
+/* Weights of the priorities, each level gets about 25% more CPU time than
+ * the level below it. Priority 16 is the default.
+ */
+static const uint32_t _fair_weights[32] = {
+	29,	36,	45,	56,	70,	87,	110,	137,
+	172,	215,	272,	335,	423,	526,	655,	820,
+	1024,	1277,	1586,	1991,	2501,	3121,	3906,	4904,
+	6100,	7620,	9548,	11916,	14949,	18705,	23254,	29154,
+};
+
+static INLINE uint32_t fair_weight(struct thread *t)
+{
+	ASSERT((t->priority >= 0) && (t->priority < 32));
+	return _fair_weights[t->priority];
+}
+
+static void fair_update_min(struct sched_core *c, struct thread *curr)
+{
+	uint64_t vruntime;
+	struct avl_tree_node *n;
+	struct thread *t;
+
+	n = avl_tree_first(&c->fair.tree);
+	if (n) {
+		t = AVL_TREE_ENTRY(n, struct thread);
+		vruntime = t->vruntime;
+		if (curr && (curr->vruntime < vruntime)) {
+			vruntime = curr->vruntime;
+		}
+	} else if (curr) {
+		vruntime = curr->vruntime;
+	} else {
+		return;
+	}
+
+	/* The minimum only moves forward */
+	if (vruntime > c->fair.min_vruntime) {
+		c->fair.min_vruntime = vruntime;
+	}
+}
+
+static void fair_init(struct sched_core *c)
+{
+	avl_tree_init(&c->fair.tree);
+	c->fair.min_vruntime = 0;
+	c->fair.load = 0;
+	c->fair.nr_ready = 0;
+}
+
+static void fair_enqueue(struct sched_core *c, struct thread *t, int flags)
+{
+	key_t key;
+	uint64_t floor;
+
+	if (FLAG_ON(flags, SCHED_MIGRATE)) {
+		/* Keep the position the thread had in the old queue */
+		t->vruntime += c->fair.min_vruntime;
+	} else if (FLAG_ON(flags, SCHED_WAKEUP)) {
+		/* The virtual runtime was made relative to the queue when the
+		 * thread went to sleep, the thread may wake up on another CORE.
+		 * A sleeper gets some credit but cannot stay far behind.
+		 */
+		t->vruntime += c->fair.min_vruntime;
+		floor = (c->fair.min_vruntime > FAIR_SLEEP_CREDIT) ?
+			(c->fair.min_vruntime - FAIR_SLEEP_CREDIT) : 0;
+		if ((int64_t)(t->vruntime - floor) < 0) {
+			t->vruntime = floor;
+		}
+	}
+
+	/* Keys in the tree are unique, threads with the same virtual runtime
+	 * are queued in arrival order.
+	 */
+	key = t->vruntime;
+	while (avl_tree_lookup(&c->fair.tree, key)) {
+		key++;
+	}
+	avl_tree_insert_node(&c->fair.tree, &t->runq_node, key, t);
+
+	c->fair.load += fair_weight(t);
+	c->fair.nr_ready++;
+}
+
+static void fair_dequeue(struct sched_core *c, struct thread *t, int flags)
+{
+	if (FLAG_ON(flags, SCHED_SLEEP)) {
+		/* The running thread is not in the tree, keep its runtime
+		 * relative to the queue while it sleeps.
+		 */
+		fair_update_min(c, t);
+		t->vruntime -= c->fair.min_vruntime;
+		return;
+	}
+
+	avl_tree_remove_node(&c->fair.tree, &t->runq_node);
+	c->fair.load -= fair_weight(t);
+	c->fair.nr_ready--;
+
+	/* The minimum of the other queue may be far from ours */
+	if (FLAG_ON(flags, SCHED_MIGRATE)) {
+		t->vruntime -= c->fair.min_vruntime;
+	}
+}
+
+static struct thread *fair_pick(struct sched_core *c)
+{
+	struct avl_tree_node *n;
+	struct thread *t;
+
+	n = avl_tree_first(&c->fair.tree);
+	if (!n) {
+		return NULL;
+	}
+
+	t = AVL_TREE_ENTRY(n, struct thread);
+	fair_dequeue(c, t, 0);
+
+	return t;
+}
+
+static void fair_charge(struct sched_core *c, struct thread *t, useconds_t delta)
+{
+	uint64_t vdelta;
+
+	if (delta <= 0) {
+		return;
+	}
+
+	vdelta = (uint64_t)delta * FAIR_WEIGHT_BASE;
+	do_div(vdelta, fair_weight(t));
+	t->vruntime += vdelta;
+
+	fair_update_min(c, t);
+}
+
+static useconds_t fair_slice(struct sched_core *c, struct thread *t)
+{
+	uint32_t weight;
+	uint64_t slice;
+	size_t nr;
+
+	/* The thread was picked so it is not counted in the queue */
+	weight = fair_weight(t);
+	nr = c->fair.nr_ready + 1;
+	if (nr > FAIR_NR_LATENCY) {
+		slice = (uint64_t)nr * FAIR_MIN_GRANULARITY;
+	} else {
+		slice = FAIR_LATENCY;
+	}
+
+	slice *= weight;
+	do_div(slice, c->fair.load + weight);
+
+	return MAX((useconds_t)slice, FAIR_MIN_GRANULARITY);
+}
+
+static void fair_yield(struct sched_core *c, struct thread *t)
+{
+	struct avl_tree_node *n;
+	struct thread *last;
+
+	/* Queue the thread behind all the ready threads */
+	n = avl_tree_last(&c->fair.tree);
+	if (n) {
+		last = AVL_TREE_ENTRY(n, struct thread);
+		if (last->vruntime > t->vruntime) {
+			t->vruntime = last->vruntime;
+		}
+	}
+}
+
+static struct thread *fair_steal(struct sched_core *c, struct core *dst)
+{
+	struct avl_tree_node *n;
+	struct thread *t, *victim = NULL;
+
+	/* Take the thread that would wait the longest on this CORE */
+	for (n = avl_tree_first(&c->fair.tree); n; n = avl_tree_node_next(n)) {
+		t = AVL_TREE_ENTRY(n, struct thread);
+		if (sched_can_migrate(t, dst)) {
+			victim = t;
+		}
+	}
+
+	return victim;
+}
+
+struct sched_class _fair_sched_class = {
+	.name = "fair",
+	.init = fair_init,
+	.enqueue = fair_enqueue,
+	.dequeue = fair_dequeue,
+	.pick = fair_pick,
+	.charge = fair_charge,
+	.slice = fair_slice,
+	.yield = fair_yield,
+	.steal = fair_steal,
+};
@@ -0,0 +1,184 @@
+/*
+ * sched_rt.c
+ *
+ * Real time scheduling class. Ready threads are queued by priority and the
+ * highest one always runs, before any thread of the fair class. A FIFO
+ * thread runs until it blocks or yields, a RR thread is moved behind the
+ * threads of the same priority when its quantum expires. The real time
+ * threads of a CORE are throttled once they used up their runtime in the
+ * current period, so a runaway thread cannot lock up the CORE.
+ */
+
+#include <types.h>
+#include <stddef.h>
+#include <sched.h>
+#include "matrix/matrix.h"
+#include "debug.h"
+#include "bitops.h"
+#include "list.h"
+#include "pit.h"
+#include "proc/thread.h"
+#include "proc/sched_class.h"
+
+/* Quantum of the RR threads */
+#define RT_RR_QUANTUM	100000
+
+/* Throttling period and the runtime allowed in it */
+useconds_t _rt_period = 1000000;
+useconds_t _rt_runtime = 950000;
+
+static void rt_refresh(struct sched_core *c)
+{
+	useconds_t now;
+
+	now = sys_time();
+	if ((now - c->rt.period_start) >= _rt_period) {
+		c->rt.period_start = now;
+		c->rt.runtime = 0;
+		c->rt.throttled = FALSE;
+	}
+}
+
+static void rt_init(struct sched_core *c)
+{
+	int i;
+
+	c->rt.bitmap = 0;
+	for (i = 0; i < NR_RT_PRIORITIES; i++) {
+		LIST_INIT(&c->rt.threads[i]);
+	}
+	c->rt.nr_ready = 0;
+	c->rt.period_start = 0;
+	c->rt.runtime = 0;
+	c->rt.throttled = FALSE;
+	c->rt.nr_throttled = 0;
+}
+
+static void rt_enqueue(struct sched_core *c, struct thread *t, int flags)
+{
+	int q;
+
+	q = t->priority;
+	ASSERT((q >= 0) && (q < NR_RT_PRIORITIES));
+
+	/* A preempted thread stays at the head of its priority */
+	if (FLAG_ON(flags, SCHED_PREEMPT)) {
+		list_add(&t->runq_link, &c->rt.threads[q]);
+	} else {
+		list_add_tail(&t->runq_link, &c->rt.threads[q]);
+	}
+	c->rt.bitmap |= (1 << q);
+	c->rt.nr_ready++;
+}
+
+static void rt_dequeue(struct sched_core *c, struct thread *t, int flags)
+{
+	int q;
+
+	/* The running thread is not queued */
+	if (FLAG_ON(flags, SCHED_SLEEP)) {
+		return;
+	}
+
+	q = t->priority;
+	list_del(&t->runq_link);
+	if (LIST_EMPTY(&c->rt.threads[q])) {
+		c->rt.bitmap &= ~(1 << q);
+	}
+	c->rt.nr_ready--;
+}
+
+static struct thread *rt_pick(struct sched_core *c)
+{
+	int q;
+	struct thread *t;
+
+	if (!c->rt.bitmap) {
+		return NULL;
+	}
+
+	/* Let the fair threads run until the next period */
+	rt_refresh(c);
+	if (c->rt.throttled) {
+		return NULL;
+	}
+
+	q = bitops_fls(c->rt.bitmap);
+	ASSERT(!LIST_EMPTY(&c->rt.threads[q]));
+	t = LIST_ENTRY(c->rt.threads[q].next, struct thread, runq_link);
+	rt_dequeue(c, t, 0);
+
+	return t;
+}
+
+static void rt_charge(struct sched_core *c, struct thread *t, useconds_t delta)
+{
+	if (_rt_runtime >= _rt_period) {
+		return;
+	}
+
+	rt_refresh(c);
+	c->rt.runtime += delta;
+	if (!c->rt.throttled && (c->rt.runtime >= _rt_runtime)) {
+		c->rt.throttled = TRUE;
+		c->rt.nr_throttled++;
+		DEBUG(DL_INF, ("core rt throttled, thread(%s:%d).\n",
+			       t->name, t->id));
+	}
+}
+
+static useconds_t rt_slice(struct sched_core *c, struct thread *t)
+{
+	useconds_t slice, budget;
+
+	slice = (t->policy == SCHED_RR) ? RT_RR_QUANTUM : 0;
+
+	/* Preempt the thread when the runtime of the period is used up */
+	if (_rt_runtime < _rt_period) {
+		budget = MAX(_rt_runtime - c->rt.runtime, 1);
+		slice = slice ? MIN(slice, budget) : budget;
+	}
+
+	return slice;
+}
+
+static boolean_t rt_preempt(struct sched_core *c, struct thread *t,
+			    struct thread *curr)
+{
+	return t->priority > curr->priority;
+}
+
+static struct thread *rt_steal(struct sched_core *c, struct core *dst)
+{
+	int q;
+	struct list *l;
+	struct thread *t;
+
+	/* The highest priority thread waiting here gains the most */
+	for (q = NR_RT_PRIORITIES - 1; q >= 0; q--) {
+		if (!(c->rt.bitmap & (1 << q))) {
+			continue;
+		}
+		LIST_FOR_EACH(l, &c->rt.threads[q]) {
+			t = LIST_ENTRY(l, struct thread, runq_link);
+			if (sched_can_migrate(t, dst)) {
+				return t;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+struct sched_class _rt_sched_class = {
+	.name = "rt",
+	.init = rt_init,
+	.enqueue = rt_enqueue,
+	.dequeue = rt_dequeue,
+	.pick = rt_pick,
+	.charge = rt_charge,
+	.slice = rt_slice,
+	.yield = NULL,			// Requeued at the tail of its priority
+	.preempt = rt_preempt,
+	.steal = rt_steal,
+};
@@ -0,0 +1,212 @@
+/*
+ * sched_stat.c
+ *
+ * Scheduling latency statistics. The scheduler timestamps a thread with the
+ * TSC when it is queued and when it is picked to run, the delays are added
+ * to log2 histograms of the CORE and to the counters of the thread.
+ */
+
+#include <types.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include "matrix/matrix.h"
+#include "hal/hal.h"
+#include "hal/core.h"
+#include "debug.h"
+#include "div64.h"
+#include "bitops.h"
+#include "mutex.h"
+#include "proc/process.h"
+#include "proc/thread.h"
+#include "proc/sched_class.h"
+#include "procfs.h"
+
+struct sched_stat_buf {
+	char *buf;
+	size_t size;
+	int len;
+};
+
+/* Microseconds elapsed since a TSC timestamp */
+static uint32_t sched_stat_elapsed(uint64_t tsc)
+{
+	uint64_t delta;
+
+	delta = x86_rdtsc() - tsc;
+	do_div(delta, (uint32_t)CURR_CORE->arch.cycles_per_us);
+
+	return (delta > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)delta;
+}
+
+static void sched_hist_add(struct sched_hist *h, uint32_t us)
+{
+	int b;
+
+	b = us ? (bitops_fls(us) + 1) : 0;
+	if (b >= NR_SCHED_HIST_BUCKETS) {
+		b = NR_SCHED_HIST_BUCKETS - 1;
+	}
+
+	h->buckets[b]++;
+	h->count++;
+	h->sum += us;
+	if (us > h->max) {
+		h->max = us;
+	}
+}
+
+/**
+ * A thread was queued, the wake up flag tells whether it was sleeping or
+ * just preempted.
+ */
+void sched_stat_enqueue(struct thread *t, boolean_t wakeup)
+{
+	t->enqueue_tsc = x86_rdtsc();
+	t->woken = wakeup;
+}
+
+/**
+ * A thread was picked from the run queue to run next
+ */
+void sched_stat_dequeue(struct sched_core *c, struct thread *t)
+{
+	uint32_t us;
+
+	us = sched_stat_elapsed(t->enqueue_tsc);
+	t->sum_wait += us;
+
+	sched_hist_add(&c->stat.runq, us);
+	if (t->woken) {
+		sched_hist_add(&c->stat.wakeup, us);
+		t->woken = FALSE;
+	}
+}
+
+/**
+ * The CORE switches away from prev, a voluntary switch is one the
+ * thread asked for by sleeping or yielding.
+ */
+void sched_stat_switch(struct sched_core *c, struct thread *prev,
+		       boolean_t voluntary)
+{
+	if (prev == c->idle_thread) {
+		return;
+	}
+
+	if (voluntary) {
+		prev->nr_voluntary++;
+	} else {
+		prev->nr_involuntary++;
+	}
+}
+
+/**
+ * The running thread was charged for the time it ran
+ */
+void sched_stat_slice(struct sched_core *c, useconds_t ran)
+{
+	sched_hist_add(&c->stat.slice, (ran > 0) ? (uint32_t)ran : 0);
+}
+
+static void sched_hist_print(struct sched_stat_buf *b, core_id_t id,
+			     const char *name, struct sched_hist *h)
+{
+	int i;
+	uint64_t avg;
+
+	if (b->len >= b->size) {
+		return;
+	}
+
+	avg = h->sum;
+	if (h->count) {
+		do_div(avg, h->count);
+	}
+
+	b->len += snprintf(b->buf + b->len, b->size - b->len,
+			   "core%d %s count %d avg %d max %d\n",
+			   id, name, h->count, (uint32_t)avg, h->max);
+
+	/* Only the buckets with samples, bucket n holds the samples below
+	 * 2^n microseconds.
+	 */
+	for (i = 0; (i < NR_SCHED_HIST_BUCKETS) && (b->len < b->size); i++) {
+		if (h->buckets[i]) {
+			b->len += snprintf(b->buf + b->len, b->size - b->len,
+					   " <%dus %d", 1 << i, h->buckets[i]);
+		}
+	}
+	if (b->len < b->size) {
+		b->len += snprintf(b->buf + b->len, b->size - b->len, "\n");
+	}
+}
+
+static int sched_stat_lat_read(char *buf, size_t size)
+{
+	struct sched_stat_buf b;
+	struct list *l;
+	struct core *c;
+
+	b.buf = buf;
+	b.size = size;
+	b.len = 0;
+
+	LIST_FOR_EACH(l, &_running_cores) {
+		c = LIST_ENTRY(l, struct core, link);
+		if (!c->sched) {
+			continue;
+		}
+		sched_hist_print(&b, c->id, "wakeup", &c->sched->stat.wakeup);
+		sched_hist_print(&b, c->id, "runq", &c->sched->stat.runq);
+		sched_hist_print(&b, c->id, "slice", &c->sched->stat.slice);
+	}
+
+	return MIN(b.len, size);
+}
+
+static int sched_stat_process(struct process *p, void *ctx)
+{
+	struct sched_stat_buf *b = ctx;
+	struct list *l;
+	struct thread *t;
+
+	mutex_acquire(&p->lock);
+
+	LIST_FOR_EACH(l, &p->threads) {
+		t = LIST_ENTRY(l, struct thread, owner_link);
+		b->len += snprintf(b->buf + b->len, b->size - b->len,
+				   "%d %d %s run %lld wait %lld vcsw %d "
+				   "ivcsw %d\n",
+				   p->id, t->id, t->name, t->sum_exec,
+				   t->sum_wait, t->nr_voluntary,
+				   t->nr_involuntary);
+		if (b->len >= b->size) {
+			break;
+		}
+	}
+
+	mutex_release(&p->lock);
+
+	return (b->len >= b->size) ? 1 : 0;
+}
+
+static int sched_stat_threads_read(char *buf, size_t size)
+{
+	struct sched_stat_buf b;
+
+	b.buf = buf;
+	b.size = size;
+	b.len = snprintf(buf, size, "pid tid name run(us) wait(us) "
+			 "vcsw ivcsw\n");
+
+	process_iterate(sched_stat_process, &b);
+
+	return MIN(b.len, size);
+}
+
+void init_sched_stat()
+{
+	procfs_register("schedlat", sched_stat_lat_read);
+	procfs_register("threads", sched_stat_threads_read);
+}
@@ -1,12 +1,24 @@
 ;
 ; process.s
 ; 
-[GLOBAL read_eip]
-read_eip:			; When read_eip is called, the current instruction location
-				; is pushed on to the stack, we pop it to EAX and return.
-	pop eax			; Get the instruction pointer
-	jmp eax			; Return. Can't use RET because return
-				; address popped off the stack
+[GLOBAL arch_context_switch]
+arch_context_switch:		; void arch_context_switch(void **old_esp, void *new_esp)
+	mov eax, [esp+4]	; Where to save the old stack pointer
+	mov edx, [esp+8]	; The new stack pointer
+
+	push ebp		; Save the callee-saved registers, the other
+	push ebx		; registers are saved by the caller according
+	push esi		; to __cdecl
+	push edi
+
+	mov [eax], esp		; Save the old stack pointer
+	mov esp, edx		; Switch to the new stack
+
+	pop edi			; Restore the registers of the new thread
+	pop esi
+	pop ebx
+	pop ebp
+	ret			; Return to where the new thread switched out
 
 [GLOBAL page_copy]
 page_copy:
@@ -1,17 +1,23 @@
 #include <types.h>
 #include <stddef.h>
 #include <string.h>
+#include <sched.h>
+#include <errno.h>
 #include "matrix/matrix.h"
 #include "debug.h"
 #include "hal/core.h"
+#include "hal/fpu.h"
 #include "mm/mlayout.h"
 #include "mm/kmem.h"
 #include "mm/malloc.h"
 #include "mm/slab.h"
+#include "mm/kstack.h"
 #include "mm/va.h"
 #include "proc/thread.h"
 #include "proc/process.h"
 #include "proc/sched.h"
+#include "proc/sched_class.h"
+#include "smp.h"
 
 /* Temporarily used thread id */
 static tid_t _next_tid = 1;
@@ -19,7 +25,7 @@ static tid_t _next_tid = 1;
 /* Thread structure cache */
 static slab_cache_t _thread_cache;
 
-extern uint32_t read_eip();
+extern void arch_context_switch(void **old_esp, void *new_esp);
 
 static tid_t id_alloc()
 {
@@ -28,75 +34,48 @@ static tid_t id_alloc()
 
 void arch_thread_init(struct thread *t, void *kstack, void (*entry)())
 {
-	t->arch.esp = kstack;
-	t->arch.ebp = 0;
-	t->arch.eip = entry;
+	uint32_t *sp = kstack;
+
+	/* Build the frame arch_context_switch() pops when the thread is
+	 * switched to the first time, it will return to the entry function.
+	 */
+	*--sp = 0;			// Return address of entry, never used
+	*--sp = (uint32_t)entry;	// Return address of the switch
+	*--sp = 0;			// EBP
+	*--sp = 0;			// EBX
+	*--sp = 0;			// ESI
+	*--sp = 0;			// EDI
+
+	t->arch.esp = sp;
+	t->arch.fpu = NULL;
+	t->arch.tls = 0;
 }
 
 void arch_thread_switch(struct thread *curr, struct thread *prev)
 {
-	void *esp, *ebp, *eip;
-
-	/* Get the stack pointer and base pointer first */
-	asm volatile("mov %%esp, %0" : "=r"(esp));
-	asm volatile("mov %%ebp, %0" : "=r"(ebp));
-
-	/* Read the instruction pointer. We do some cunning logic here:
-	 * One of the two things could have happened when this function exits
-	 *   (a) We called the function and it returned the EIP as requested.
-	 *   (b) We have just switched processes, and because the saved EIP is
-	 *       essentially the instruction after read_eip(), it will seem as
-	 *       if read_eip has just returned.
-	 * In the second case we need to return immediately. To detect it we put
-	 * a magic number in EAX further down at the end of this function. As C
-	 * returns value in EAX, it will look like the return value is this
-	 * magic number. (0x87654321).
-	 */
-	eip = (void *)read_eip();
-	
-	/* If we have just switched processes, do nothing */
-	if (0x87654321 == (uint32_t)eip) {
-		return;
-	}
-
-	/* Save the process context for previous process */
-	if (prev) {
-		prev->arch.eip = eip;
-		prev->arch.esp = esp;
-		prev->arch.ebp = ebp;
-	}
+	void *esp;
 
-	/* Switch to current process context */
-	eip = curr->arch.eip;
-	esp = curr->arch.esp;
-	ebp = curr->arch.ebp;
+	/* Save the FPU state of prev if it was used, and let the FPU trap
+	 * for curr
+	 */
+	fpu_switch(prev);
 
 	/* Switch the kernel stack in TSS to the process's kernel stack */
 	set_kernel_stack(curr->kstack);
 
+	/* Point GS at the TLS of curr */
+	gdt_set_tls(CURR_CORE, curr->arch.tls);
+
 #ifdef _DEBUG_THREAD
-	DEBUG(DL_DBG, ("prev(%s:%x:%x:%x), curr(%s:%x:%x:%x)\n",
-		       prev->name, prev->arch.eip, prev->arch.esp, prev->arch.ebp,
-		       curr->name, curr->arch.eip, curr->arch.esp, curr->arch.ebp));
+	DEBUG(DL_DBG, ("prev(%s:%x), curr(%s:%x)\n",
+		       prev ? prev->name : "", prev ? prev->arch.esp : 0,
+		       curr->name, curr->arch.esp));
 #endif	/* _DEBUG_THREAD */
 
-	/* Here we:
-	 * [1] Disable interrupts so we don't get bothered.
-	 * [2] Temporarily puts the new EIP location in EBX.
-	 * [3] Loads the stack and base pointers from the new process struct.
-	 * [4] Puts a magic number (0x87654321) in EAX so that above we can recognize
-	 *     that we've just switched process.
-	 * [5] Jumps to the location in EBX (remember we put the new EIP in there)
-	 * Note that you can't change the sequence we set each register here. You
-	 * can check the actual asm code generated by your compiler for the reason.
+	/* The stack pointer of prev is saved in its thread structure, this
+	 * returns when prev is switched to again.
 	 */
-	asm volatile ("mov %0, %%ebx\n"
-		      "mov %1, %%esp\n"
-		      "mov %2, %%ebp\n"
-		      "mov $0x87654321, %%eax\n"	/* read_eip() will return 0x87654321 */
-		      "jmp *%%ebx\n"
-		      :: "r"(eip), "r"(esp), "r"(ebp)
-		      : "%ebx", "%esp", "%eax");
+	arch_context_switch(prev ? &prev->arch.esp : &esp, curr->arch.esp);
 }
 
 /**
@@ -140,6 +119,32 @@ void arch_thread_enter_uspace(ptr_t entry, ptr_t ustack, ptr_t ctx)
 		     :: "m"(entry), "r"(ustack) : "%ax", "%esp", "%eax");
 }
 
+/**
+ * Kernel entry of a thread created from user mode. The thread enters the
+ * user mode as if entry(func, args) was called.
+ */
+void thread_uspace_wrapper(void *ctx)
+{
+	ptr_t esp;
+	struct thread_uspace_creation info;
+
+	memcpy(&info, ctx, sizeof(info));
+	kfree(ctx);
+
+	/* Push the arguments of entry, arch_thread_enter_uspace() will push
+	 * a NULL return address for us.
+	 */
+	esp = info.esp;
+	esp -= sizeof(ptr_t);
+	*((ptr_t *)esp) = info.args;
+	esp -= sizeof(ptr_t);
+	*((ptr_t *)esp) = info.func;
+
+	arch_thread_enter_uspace(info.entry, esp, 0);
+
+	PANIC("Failed to enter user space");
+}
+
 /* Thread kernel entry function wrapper */
 static void thread_wrapper()
 {
@@ -167,6 +172,7 @@ static void thread_ctor(void *obj)
 	
 	LIST_INIT(&t->runq_link);
 	LIST_INIT(&t->wait_link);
+	LIST_INIT(&t->pi_mutexes);
 	LIST_INIT(&t->owner_link);
 
 	init_timer(&t->sleep_timer, "t-slp-tmr", 0);
@@ -197,26 +203,59 @@ static void thread_wake_internal(struct thread *t)
 	sched_insert_thread(t);
 }
 
+/*
+ * Lock a thread together with the lock of the queue it sleeps on. The
+ * sleeper sets wait_lock while it holds both, so check it again once we
+ * own the thread, it may have gone to sleep on another queue meanwhile.
+ */
+static struct spinlock *thread_lock_wait(struct thread *t)
+{
+	struct spinlock *l;
+
+	while (TRUE) {
+		l = t->wait_lock;
+		if (l) {
+			spinlock_acquire(l);
+		}
+		spinlock_acquire(&t->lock);
+		if (t->wait_lock == l) {
+			return l;
+		}
+		spinlock_release(&t->lock);
+		if (l) {
+			spinlock_release(l);
+		}
+	}
+}
+
 static boolean_t thread_interrupt_internal(struct thread *t, int flags)
 {
 	struct spinlock *l;
 	boolean_t ret = FALSE;
 
-	l = t->wait_lock;
-	if (l) {
-		spinlock_acquire(l);
-	}
-	
-	spinlock_acquire(&t->lock);
+	l = thread_lock_wait(t);
+
+	/* The flags stick, the thread checks them on its way back to user
+	 * mode or before its next interruptible sleep.
+	 */
+	SET_FLAG(t->flags, flags);
 	
 	if ((t->state == THREAD_SLEEPING) &&
 	    FLAG_ON(t->flags, THREAD_INTERRUPTIBLE)) {
-		t->sleep_status = -1;
+		t->sleep_status = EINTR;
 		thread_wake_internal(t);
 		ret = TRUE;
 	} else {
 		/* The thread is either not sleeping or not interruptible. */
 		SET_FLAG(t->flags, THREAD_INTERRUPTED);
+
+		/* A thread running on another CORE may spin in user mode,
+		 * interrupt it so it passes thread_check_killed() soon.
+		 */
+		if ((t->state == THREAD_RUNNING) && (t->core != CURR_CORE) &&
+		    FLAG_ON(flags, THREAD_KILLED)) {
+			smp_send_reschedule(t->core);
+		}
 	}
 
 	spinlock_release(&t->lock);
@@ -235,12 +274,7 @@ static void thread_timeout(void *ctx)
 
 	DEBUG(DL_DBG, ("thread(%s:%p:%d) timed out.\n", t->name, t, t->id));
 
-	l = t->wait_lock;
-	if (l) {
-		spinlock_acquire(l);
-	}
-	
-	spinlock_acquire(&t->lock);
+	l = thread_lock_wait(t);
 
 	/* The thread could have been woken up already by another CPU */
 	if (t->state == THREAD_SLEEPING) {
@@ -280,12 +314,12 @@ int thread_create(const char *name, struct process *owner, int flags,
 	t->name[T_NAME_LEN - 1] = 0;
 	
 	/* Allocate kernel stack for the process */
-	t->kstack = kmalloc(KSTACK_SIZE, MM_ALIGN) + KSTACK_SIZE;
+	t->kstack = kstack_alloc();
 	if (!t->kstack) {
-		DEBUG(DL_INF, ("kmalloc kstack failed.\n"));
+		DEBUG(DL_INF, ("kstack_alloc failed.\n"));
 		goto out;
 	}
-	memset((void *)((uint32_t)t->kstack - KSTACK_SIZE), 0, KSTACK_SIZE);
+	t->kstack += KSTACK_SIZE;
 
 	/* Initialize the architecture-specific data */
 	arch_thread_init(t, t->kstack, thread_wrapper);
@@ -295,6 +329,13 @@ int thread_create(const char *name, struct process *owner, int flags,
 	 */
 	t->core = NULL;
 
+	/* A new thread may run where its creator may run */
+	if (CURR_THREAD) {
+		t->affinity = CURR_THREAD->affinity;
+	} else {
+		CPU_FILL(&t->affinity);
+	}
+
 	t->state = THREAD_CREATED;
 	t->flags = flags;
 	t->priority = 16;
@@ -303,7 +344,24 @@ int thread_create(const char *name, struct process *owner, int flags,
 	t->entry = func;
 	t->args = args;
 	t->quantum = 0;
+	t->sched_class = &_fair_sched_class;
+	t->policy = SCHED_OTHER;
+	t->base_policy = SCHED_OTHER;
+	t->base_priority = 16;
+	t->pi_policy = -1;
+	t->pi_priority = 0;
+	t->vruntime = 0;
+	t->exec_start = 0;
+	t->sum_exec = 0;
+	t->sum_wait = 0;
+	t->enqueue_tsc = 0;
+	t->woken = FALSE;
+	t->nr_voluntary = 0;
+	t->nr_involuntary = 0;
 	t->wait_lock = NULL;
+	t->blocked_on = NULL;
+	t->futex_addr = 0;
+	t->join = NULL;
 
 	/* Initialize signal handling state */
 	t->pending_signals = 0;
@@ -338,6 +396,162 @@ out:
 	return rc;
 }
 
+/**
+ * Create a thread in current process which runs entry(func, args) in user
+ * mode. The thread is running when this function returns.
+ */
+int thread_create_uspace(ptr_t entry, ptr_t func, ptr_t args, tid_t *tidp)
+{
+	int rc = -1;
+	ptr_t ustack = 0;
+	struct process *p;
+	struct thread *t = NULL;
+	struct thread_join *join = NULL;
+	struct thread_uspace_creation *info = NULL;
+
+	p = CURR_PROC;
+	if (p == _kernel_proc) {
+		goto out;
+	}
+
+	info = kmalloc(sizeof(*info), 0);
+	join = kmalloc(sizeof(*join), 0);
+	if (!info || !join) {
+		DEBUG(DL_INF, ("kmalloc failed.\n"));
+		goto out;
+	}
+
+	rc = process_alloc_ustack(p, &ustack);
+	if (rc != 0) {
+		DEBUG(DL_INF, ("process_alloc_ustack failed, err(%x).\n", rc));
+		goto out;
+	}
+
+	info->entry = entry;
+	info->esp = ustack + USTACK_SIZE;
+	info->func = func;
+	info->args = args;
+
+	rc = thread_create("uthread", p, 0, thread_uspace_wrapper, info, &t);
+	if (rc != 0) {
+		DEBUG(DL_INF, ("thread_create failed, err(%x).\n", rc));
+		goto out;
+	}
+
+	/* The stack will be unmapped by thread_exit() */
+	t->ustack = (void *)ustack;
+	t->ustack_size = USTACK_SIZE;
+
+	LIST_INIT(&join->link);
+	join->id = t->id;
+	join->status = 0;
+	join->joining = FALSE;
+	semaphore_init(&join->sem, "join-sem", 0);
+	t->join = join;
+
+	mutex_acquire(&p->lock);
+	list_add_tail(&join->link, &p->joins);
+	mutex_release(&p->lock);
+
+	if (tidp) {
+		*tidp = t->id;
+	}
+
+	thread_run(t);
+	thread_release(t);
+
+ out:
+	if (rc != 0) {
+		if (ustack) {
+			va_unmap(p->vas, ustack, USTACK_SIZE);
+			process_free_ustack(p, ustack);
+		}
+		if (info) {
+			kfree(info);
+		}
+		if (join) {
+			kfree(join);
+		}
+	}
+
+	return rc;
+}
+
+/**
+ * Set the base of the TLS segment of the current thread, the user code
+ * accesses its thread local storage through GS.
+ */
+int thread_set_tls(ptr_t base)
+{
+	int rc = -1;
+	boolean_t state;
+
+	if (base >= KERNEL_KMEM_START) {
+		DEBUG(DL_DBG, ("invalid tls base(%p).\n", base));
+		goto out;
+	}
+
+	state = local_irq_disable();
+	CURR_THREAD->arch.tls = base;
+	gdt_set_tls(CURR_CORE, base);
+	local_irq_restore(state);
+	rc = 0;
+
+ out:
+	return rc;
+}
+
+/**
+ * Wait for a thread created by thread_create_uspace() in current process to
+ * exit. Each thread can be joined only once.
+ */
+int thread_join(tid_t id, int *statusp)
+{
+	int rc = -1;
+	struct list *l;
+	struct process *p;
+	struct thread_join *j, *join = NULL;
+
+	if (id == CURR_THREAD->id) {
+		goto out;
+	}
+
+	p = CURR_PROC;
+
+	mutex_acquire(&p->lock);
+	LIST_FOR_EACH(l, &p->joins) {
+		j = LIST_ENTRY(l, struct thread_join, link);
+		if (j->id == id) {
+			join = j;
+			break;
+		}
+	}
+	if (join && !join->joining) {
+		join->joining = TRUE;
+		rc = 0;
+	}
+	mutex_release(&p->lock);
+
+	if (rc != 0) {
+		DEBUG(DL_DBG, ("thread(%d) not joinable.\n", id));
+		goto out;
+	}
+
+	semaphore_down(&join->sem);
+
+	mutex_acquire(&p->lock);
+	list_del(&join->link);
+	mutex_release(&p->lock);
+
+	if (statusp) {
+		*statusp = join->status;
+	}
+	kfree(join);
+
+ out:
+	return rc;
+}
+
 int thread_sleep(struct spinlock *lock, useconds_t timeout, const char *name, int flags)
 {
 	int rc = -1;
@@ -352,6 +566,20 @@ int thread_sleep(struct spinlock *lock, useconds_t timeout, const char *name, in
 	state = lock ? lock->state : local_irq_disable();
 
 	spinlock_acquire_noirq(&CURR_THREAD->lock);
+	/* Do not go to sleep if we were interrupted on our way here */
+	if (FLAG_ON(flags, THREAD_INTERRUPTIBLE)) {
+		if (FLAG_ON(CURR_THREAD->flags, THREAD_INTERRUPTED|THREAD_KILLED)) {
+			CLEAR_FLAG(CURR_THREAD->flags, THREAD_INTERRUPTED);
+			spinlock_release_noirq(&CURR_THREAD->lock);
+			if (!lock) {
+				local_irq_restore(state);
+			}
+			rc = EINTR;
+			goto cancel;
+		}
+		SET_FLAG(CURR_THREAD->flags, THREAD_INTERRUPTIBLE);
+	}
+	
 	CURR_THREAD->sleep_status = 0;
 	CURR_THREAD->wait_lock = lock;
 
@@ -410,6 +638,18 @@ void thread_kill(struct thread *t)
 	}
 }
 
+/**
+ * Called by the interrupt and system call handlers right before they return
+ * to user mode. A killed thread holds no kernel resources here, so it exits.
+ */
+void thread_check_killed()
+{
+	if (CURR_THREAD && FLAG_ON(CURR_THREAD->flags, THREAD_KILLED)) {
+		local_irq_enable();
+		thread_exit();
+	}
+}
+
 boolean_t thread_interrupt(struct thread *t)
 {
 	boolean_t ret = FALSE;
@@ -444,7 +684,9 @@ void thread_release(struct thread *t)
 
 	/* Cleanup the thread */
 	kstack = (void *)((uint32_t)t->kstack - KSTACK_SIZE);
-	kfree(kstack);
+	kstack_free(kstack);
+
+	fpu_free(t);
 
 	notifier_clear(&t->death_notifier);
 
@@ -467,6 +709,18 @@ void thread_exit()
 		rc = va_unmap(CURR_PROC->vas, (ptr_t)CURR_THREAD->ustack,
 			       CURR_THREAD->ustack_size);
 		ASSERT(rc == 0);
+		process_free_ustack(CURR_PROC, (ptr_t)CURR_THREAD->ustack);
+	}
+
+	/* Pass the exit status to the joiner. The joiner frees the record
+	 * after it gets the process lock, so hold it while signaling.
+	 */
+	if (CURR_THREAD->join) {
+		mutex_acquire(&CURR_PROC->lock);
+		CURR_THREAD->join->status = CURR_THREAD->status;
+		semaphore_up(&CURR_THREAD->join->sem, 1);
+		CURR_THREAD->join = NULL;
+		mutex_release(&CURR_PROC->lock);
 	}
 
 	/* Notify the waiter that we are exiting */
@@ -9,6 +9,7 @@
 #include "device.h"
 #include "rtl/hashtable.h"
 #include "mutex.h"
+#include "hal/spinlock.h"
 
 #define NR_MAX_MAJOR	0x1000
 
@@ -24,6 +25,9 @@ struct dev_db_hash_info {
 
 struct dev_db_hash_info *_dev_db[NR_MAX_MAJOR];
 
+/* Protects the device database, opening a device only reads it */
+static struct rwspinlock _dev_db_lock;
+
 static uint32_t dev_hash(void *key, uint32_t nr_buckets)
 {
 	uint32_t ret = ULONG_MAX;
@@ -58,19 +62,12 @@ int dev_create(dev_t dev, int flags, void *ext, struct dev **dp)
 {
 	int rc = -1;
 	uint32_t major;
+	boolean_t state;
 	struct dev *device;
 	struct dev_db_hash_info *hash_info = NULL;
 
 	major = MAJOR(dev);
 
-	/* Check whether the major was registered */
-	hash_info = _dev_db[major];
-	if (!hash_info) {
-		DEBUG(DL_INF, ("invalid major %x.\n", major));
-		rc = ENOENT;
-		goto out;
-	}
-
 	if (FLAG_ON(flags, DEV_CREATE)) {
 		/* We are creating a device */
 		device = kmalloc(sizeof(*device), 0);
@@ -86,21 +83,49 @@ int dev_create(dev_t dev, int flags, void *ext, struct dev **dp)
 		device->ref_count = 1;	// Initial refcnt of the device is 1
 		device->dev = dev;
 
-		rc = hashtable_insert(&hash_info->ht, &dev, (void *)device);
+		rwspinlock_write_acquire(&_dev_db_lock);
+
+		/* Check whether the major was registered */
+		hash_info = _dev_db[major];
+		if (!hash_info) {
+			rc = ENOENT;
+		} else {
+			rc = hashtable_insert(&hash_info->ht, &dev, (void *)device);
+		}
+
+		rwspinlock_write_release(&_dev_db_lock);
+
 		if (rc != 0) {
+			DEBUG(DL_INF, ("create dev %x failed, err(%x).\n", dev, rc));
+			kfree(device);
 			goto out;
 		}
 		
 		*dp = device;
 	} else {
 		/* We are opening a device */
-		rc = hashtable_lookup(&hash_info->ht, &dev, (void **)&device);
-		if (rc != 0) {
+		state = rwspinlock_read_acquire(&_dev_db_lock);
+
+		hash_info = _dev_db[major];
+		if (!hash_info) {
 			rc = ENOENT;
+		} else {
+			rc = hashtable_lookup(&hash_info->ht, &dev,
+					      (void **)&device);
+			if (rc != 0) {
+				rc = ENOENT;
+			} else {
+				atomic_inc(&device->ref_count);
+			}
+		}
+
+		rwspinlock_read_release(&_dev_db_lock, state);
+
+		if (rc != 0) {
+			DEBUG(DL_INF, ("open dev %x failed, err(%x).\n", dev, rc));
 			goto out;
 		}
 		
-		device->ref_count++;
 		*dp = device;
 	}
 
@@ -203,12 +228,18 @@ int dev_register(uint32_t major, const char *name)
 		       nr_buckets, offsetof(struct dev, dev_link),
 		       dev_hash, dev_compare, 0);
 
-	_dev_db[major] = hash_info;
-	rc = 0;
+	rwspinlock_write_acquire(&_dev_db_lock);
+	if (_dev_db[major]) {
+		rc = EGENERIC;
+	} else {
+		_dev_db[major] = hash_info;
+		rc = 0;
+	}
+	rwspinlock_write_release(&_dev_db_lock);
 
  out:
-	if ((rc != 0) && (rc != EGENERIC)) {
-		DEBUG(DL_WRN, ("register dev %s failed, err(%x).\n", rc));
+	if (rc != 0) {
+		DEBUG(DL_WRN, ("register dev %s failed, err(%x).\n", name, rc));
 		if (hash_info) {
 			if (hash_info->buckets_ptr) {
 				kfree(hash_info->buckets_ptr);
@@ -230,4 +261,5 @@ int dev_unregister(uint32_t major)
 void init_dev()
 {
 	memset(_dev_db, 0, sizeof(_dev_db));
+	rwspinlock_init(&_dev_db_lock, "dev-db-lock");
 }
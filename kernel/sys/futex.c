@@ -0,0 +1,141 @@
+/*
+ * futex.c
+ *
+ * Fast user space locking. The user space lock is a 32 bit integer, only the
+ * contended cases come into the kernel. The waiters are kept in a hashed
+ * table keyed by the address space and the user address of the lock.
+ */
+
+#include <types.h>
+#include <stddef.h>
+#include "matrix/matrix.h"
+#include "hal/spinlock.h"
+#include "list.h"
+#include "debug.h"
+#include "mm/page.h"
+#include "mm/mmu.h"
+#include "mm/va.h"
+#include "mm/mlayout.h"
+#include "proc/process.h"
+#include "proc/thread.h"
+#include "futex.h"
+
+#define NR_FUTEX_BUCKETS	64
+
+struct futex_bucket {
+	struct spinlock lock;		// Lock to protect the waiters
+	struct list threads;		// Threads waiting on this bucket
+};
+
+static struct futex_bucket _futex_buckets[NR_FUTEX_BUCKETS];
+
+static struct futex_bucket *futex_bucket(struct va_space *vas, ptr_t uaddr)
+{
+	uint32_t hash;
+
+	hash = ((uint32_t)vas >> 4) ^ (uaddr >> 2);
+	hash ^= (hash >> 12);
+
+	return &_futex_buckets[hash % NR_FUTEX_BUCKETS];
+}
+
+/* The lock must be aligned and in a present user page */
+static boolean_t futex_valid(ptr_t uaddr)
+{
+	struct page *p;
+
+	if ((uaddr & (sizeof(int32_t) - 1)) || (uaddr >= KERNEL_KMEM_START) ||
+	    !CURR_PROC->vas) {
+		return FALSE;
+	}
+
+	p = mmu_get_page(CURR_PROC->vas->mmu, uaddr, FALSE, 0);
+	return (p != NULL) && p->present && p->user;
+}
+
+/**
+ * Sleep if the value at uaddr is still val. Return 0 if woken up by
+ * futex_wake(), EINTR if interrupted and -1 if the value changed or timed
+ * out.
+ */
+int futex_wait(int32_t *uaddr, int32_t val, useconds_t timeout)
+{
+	int rc = -1;
+	struct futex_bucket *b;
+
+	if (!futex_valid((ptr_t)uaddr)) {
+		DEBUG(DL_DBG, ("invalid futex(%p).\n", uaddr));
+		goto out;
+	}
+
+	b = futex_bucket(CURR_PROC->vas, (ptr_t)uaddr);
+
+	spinlock_acquire(&b->lock);
+
+	/* The waker changes the value before taking the bucket lock, so we
+	 * will not miss a wake up after this check.
+	 */
+	if (*((volatile int32_t *)uaddr) != val) {
+		spinlock_release(&b->lock);
+		goto out;
+	}
+
+	CURR_THREAD->futex_addr = (ptr_t)uaddr;
+	list_add_tail(&CURR_THREAD->wait_link, &b->threads);
+
+	/* Whoever wakes us takes us off the bucket under its lock, and so
+	 * does thread_sleep() if we were interrupted before we slept.
+	 */
+	rc = thread_sleep(&b->lock, timeout, "futex", THREAD_INTERRUPTIBLE);
+
+ out:
+	return rc;
+}
+
+/**
+ * Wake up at most count threads waiting on uaddr, return the number of
+ * threads woken up.
+ */
+int futex_wake(int32_t *uaddr, int count)
+{
+	int nr = 0;
+	struct list *l, *n;
+	struct thread *t;
+	struct va_space *vas;
+	struct futex_bucket *b;
+
+	if (!futex_valid((ptr_t)uaddr)) {
+		DEBUG(DL_DBG, ("invalid futex(%p).\n", uaddr));
+		return -1;
+	}
+
+	vas = CURR_PROC->vas;
+	b = futex_bucket(vas, (ptr_t)uaddr);
+
+	spinlock_acquire(&b->lock);
+
+	LIST_FOR_EACH_SAFE(l, n, &b->threads) {
+		if (nr >= count) {
+			break;
+		}
+		t = LIST_ENTRY(l, struct thread, wait_link);
+		if ((t->futex_addr == (ptr_t)uaddr) && (t->owner->vas == vas)) {
+			thread_wake(t);
+			nr++;
+		}
+	}
+
+	spinlock_release(&b->lock);
+
+	return nr;
+}
+
+void init_futex()
+{
+	int i;
+
+	for (i = 0; i < NR_FUTEX_BUCKETS; i++) {
+		spinlock_init(&_futex_buckets[i].lock, "futex-lock");
+		LIST_INIT(&_futex_buckets[i].threads);
+	}
+}
@@ -0,0 +1,379 @@
+/*
+ * lockstat.c
+ *
+ * Lock contention statistics, built with _LOCKSTAT. The spinlocks and the
+ * mutexes report each acquisition and release here, the statistics are
+ * shown in /proc/lockstat and by the lockstat command of KD, hottest locks
+ * first. The tables are fixed size, nothing is allocated while recording.
+ */
+
+#ifdef _LOCKSTAT
+
+#include <types.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include "matrix/matrix.h"
+#include "hal/hal.h"
+#include "hal/core.h"
+#include "atomic.h"
+#include "barrier.h"
+#include "debug.h"
+#include "mm/page.h"
+#include "symbol.h"
+#include "procfs.h"
+#include "kd.h"
+#include "lockstat.h"
+
+#define NR_LOCKSTAT_CLASSES	128
+#define NR_LOCKSTAT_SITES	512
+
+/* Number of lines of each table shown by KD */
+#define LOCKSTAT_KD_LINES	32
+
+static struct lockstat_class _lockstat_classes[NR_LOCKSTAT_CLASSES];
+static size_t _nr_lockstat_classes = 0;
+
+/* Sites hashed by call site, a slot is never freed once it is used */
+static struct lockstat_site _lockstat_sites[NR_LOCKSTAT_SITES];
+
+/* Serializes the insertions, lookups do not take it. It cannot be a
+ * spinlock as the spinlocks report to us.
+ */
+static atomic_t _lockstat_insert_lock = 0;
+
+/* Acquisitions not recorded because the tables are full */
+static uint32_t _lockstat_dropped = 0;
+
+static char _lockstat_kd_buf[PAGE_SIZE];
+
+static const char *_lockstat_types[] = {
+	"spin",
+	"mutex",
+};
+
+/* Find the site, or a free slot to put it in if freep is not NULL */
+static struct lockstat_site *lockstat_probe(const char *name, int type,
+					    ptr_t ip,
+					    struct lockstat_site **freep)
+{
+	size_t i, start;
+	struct lockstat_site *s;
+
+	start = ((ip >> 2) ^ ((ptr_t)name >> 2)) % NR_LOCKSTAT_SITES;
+	i = start;
+	do {
+		s = &_lockstat_sites[i];
+		if (!s->ip) {
+			if (freep) {
+				*freep = s;
+			}
+			break;
+		}
+		if ((s->ip == ip) && (s->name == name) &&
+		    (s->class->type == type)) {
+			return s;
+		}
+		i = (i + 1) % NR_LOCKSTAT_SITES;
+	} while (i != start);
+
+	return NULL;
+}
+
+static struct lockstat_class *lockstat_class(const char *name, int type)
+{
+	size_t i;
+	struct lockstat_class *c;
+
+	for (i = 0; i < _nr_lockstat_classes; i++) {
+		c = &_lockstat_classes[i];
+		if ((c->type == type) && (strcmp(c->name, name) == 0)) {
+			return c;
+		}
+	}
+
+	if (_nr_lockstat_classes == NR_LOCKSTAT_CLASSES) {
+		return NULL;
+	}
+
+	c = &_lockstat_classes[_nr_lockstat_classes];
+	c->name = name;
+	c->type = type;
+	memset(&c->stat, 0, sizeof(c->stat));
+	_nr_lockstat_classes++;
+
+	return c;
+}
+
+/*
+ * Find the site of an acquisition, a new site is published only after it
+ * is initialized. Called with interrupts disabled.
+ */
+static struct lockstat_site *lockstat_site(const char *name, int type,
+					   ptr_t ip)
+{
+	struct lockstat_site *s, *slot = NULL;
+	struct lockstat_class *c;
+
+	s = lockstat_probe(name, type, ip, NULL);
+	if (s) {
+		return s;
+	}
+
+	while (!atomic_tas(&_lockstat_insert_lock, 0, 1)) {
+		core_spin_hint();
+	}
+
+	/* Another CORE may have inserted it while we waited */
+	s = lockstat_probe(name, type, ip, &slot);
+	if (!s && slot) {
+		c = lockstat_class(name, type);
+		if (c) {
+			slot->name = name;
+			slot->class = c;
+			memset(&slot->stat, 0, sizeof(slot->stat));
+			smp_wmb();
+			slot->ip = ip;
+			s = slot;
+		}
+	}
+
+	_lockstat_insert_lock = 0;
+
+	return s;
+}
+
+static void lockstat_add_wait(struct lockstat *st, boolean_t contended,
+			      uint64_t wait)
+{
+	st->acquires++;
+	if (contended) {
+		st->contended++;
+		st->wait_total += wait;
+		if (wait > st->wait_max) {
+			st->wait_max = wait;
+		}
+	}
+}
+
+static void lockstat_add_hold(struct lockstat *st, uint64_t held)
+{
+	st->hold_total += held;
+	if (held > st->hold_max) {
+		st->hold_max = held;
+	}
+}
+
+/**
+ * Record an acquisition that started at TSC start. The counters are not
+ * atomic, a concurrent update of the same site on another CORE may be
+ * lost now and then.
+ */
+void lockstat_acquired(struct lockstat_hold *h, const char *name, int type,
+		       ptr_t ip, uint64_t start, boolean_t contended)
+{
+	boolean_t state;
+	uint64_t now;
+	struct lockstat_site *s;
+
+	state = local_irq_disable();
+
+	now = x86_rdtsc();
+	s = lockstat_site(name ? name : "unnamed", type, ip);
+	h->site = s;
+	h->since = now;
+	if (s) {
+		lockstat_add_wait(&s->stat, contended, now - start);
+		lockstat_add_wait(&s->class->stat, contended, now - start);
+	} else {
+		_lockstat_dropped++;
+	}
+
+	local_irq_restore(state);
+}
+
+void lockstat_released(struct lockstat_hold *h)
+{
+	boolean_t state;
+	uint64_t held;
+	struct lockstat_site *s;
+
+	s = h->site;
+	if (!s) {
+		return;
+	}
+
+	state = local_irq_disable();
+
+	held = x86_rdtsc() - h->since;
+	lockstat_add_hold(&s->stat, held);
+	lockstat_add_hold(&s->class->stat, held);
+	h->site = NULL;
+
+	local_irq_restore(state);
+}
+
+/**
+ * Clear the counters, the classes and sites seen so far are kept
+ */
+void lockstat_reset()
+{
+	size_t i;
+	boolean_t state;
+
+	state = local_irq_disable();
+
+	for (i = 0; i < _nr_lockstat_classes; i++) {
+		memset(&_lockstat_classes[i].stat, 0, sizeof(struct lockstat));
+	}
+	for (i = 0; i < NR_LOCKSTAT_SITES; i++) {
+		memset(&_lockstat_sites[i].stat, 0, sizeof(struct lockstat));
+	}
+	_lockstat_dropped = 0;
+
+	local_irq_restore(state);
+}
+
+static struct lockstat *lockstat_class_stat(int i)
+{
+	return (i < _nr_lockstat_classes) ? &_lockstat_classes[i].stat : NULL;
+}
+
+static struct lockstat *lockstat_site_stat(int i)
+{
+	return _lockstat_sites[i].ip ? &_lockstat_sites[i].stat : NULL;
+}
+
+/* Whether entry a ranks before entry b, the most cycles lost first */
+static boolean_t lockstat_before(struct lockstat *a, int ia,
+				 struct lockstat *b, int ib)
+{
+	if (a->wait_total != b->wait_total) {
+		return a->wait_total > b->wait_total;
+	}
+	if (a->contended != b->contended) {
+		return a->contended > b->contended;
+	}
+	if (a->acquires != b->acquires) {
+		return a->acquires > b->acquires;
+	}
+	return ia < ib;
+}
+
+/*
+ * Index of the entry ranked right after prev, or of the first one if prev
+ * is negative. Entries never taken are skipped, returns -1 at the end.
+ */
+static int lockstat_next(struct lockstat *(*get)(int), int nr, int prev)
+{
+	int i, best = -1;
+	struct lockstat *st;
+
+	for (i = 0; i < nr; i++) {
+		st = get(i);
+		if (!st || !st->acquires) {
+			continue;
+		}
+		if ((prev >= 0) && !lockstat_before(get(prev), prev, st, i)) {
+			continue;
+		}
+		if ((best < 0) || lockstat_before(st, i, get(best), best)) {
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+static int lockstat_print_stat(char *buf, size_t size, struct lockstat *st)
+{
+	return snprintf(buf, size,
+			"acquires %d contended %d wait_total %lld "
+			"wait_max %lld hold_total %lld hold_max %lld\n",
+			st->acquires, st->contended, st->wait_total,
+			st->wait_max, st->hold_total, st->hold_max);
+}
+
+/* Print at most max_lines lines of each table */
+static int lockstat_format(char *buf, size_t size, int max_lines)
+{
+	int i, n, len;
+	size_t off;
+	struct symbol *sym;
+	struct lockstat_class *c;
+	struct lockstat_site *s;
+
+	len = snprintf(buf, size, "classes %d dropped %d\n",
+		       _nr_lockstat_classes, _lockstat_dropped);
+
+	i = -1;
+	for (n = 0; (n < max_lines) && (len < size); n++) {
+		i = lockstat_next(lockstat_class_stat, _nr_lockstat_classes, i);
+		if (i < 0) {
+			break;
+		}
+		c = &_lockstat_classes[i];
+		len += snprintf(buf + len, size - len, "class %s type %s ",
+				c->name, _lockstat_types[c->type]);
+		if (len < size) {
+			len += lockstat_print_stat(buf + len, size - len,
+						   &c->stat);
+		}
+	}
+
+	i = -1;
+	for (n = 0; (n < max_lines) && (len < size); n++) {
+		i = lockstat_next(lockstat_site_stat, NR_LOCKSTAT_SITES, i);
+		if (i < 0) {
+			break;
+		}
+		s = &_lockstat_sites[i];
+		sym = symbol_lookup_by_addr(s->ip, &off);
+		if (sym) {
+			len += snprintf(buf + len, size - len,
+					"site %s+0x%x class %s ",
+					sym->name, off, s->class->name);
+		} else {
+			len += snprintf(buf + len, size - len,
+					"site 0x%08x class %s ",
+					s->ip, s->class->name);
+		}
+		if (len < size) {
+			len += lockstat_print_stat(buf + len, size - len,
+						   &s->stat);
+		}
+	}
+
+	return (len < size) ? len : size;
+}
+
+static int lockstat_procfs_read(char *buf, size_t size)
+{
+	return lockstat_format(buf, size, NR_LOCKSTAT_SITES);
+}
+
+static int kd_cmd_lockstat(int argc, char **argv, kd_filter_t *filter)
+{
+	if ((argc == 2) && (strcmp(argv[1], "reset") == 0)) {
+		lockstat_reset();
+		return 0;
+	} else if (argc != 1) {
+		kd_printf("Usage: %s [reset]\n", argv[0]);
+		return -1;
+	}
+
+	lockstat_format(_lockstat_kd_buf, sizeof(_lockstat_kd_buf) - 1,
+			LOCKSTAT_KD_LINES);
+	kd_printf("%s", _lockstat_kd_buf);
+
+	return 0;
+}
+
+void init_lockstat()
+{
+	procfs_register("lockstat", lockstat_procfs_read);
+	kd_register_cmd("lockstat", "Show the lock contention statistics.",
+			kd_cmd_lockstat);
+}
+
+#endif	/* _LOCKSTAT */
@@ -1,58 +1,258 @@
+/*
+ * mutex.c
+ *
+ * Adaptive mutexes with priority inheritance. A contender spins for a
+ * while if the owner is running on another CORE, then sleeps in the wait
+ * queue and the mutex is handed over to it on release. Waiters are queued
+ * by priority and the owner runs at the priority of its highest waiter
+ * until it releases the mutex. The boost is passed along the chain of
+ * owners that are themselves waiting for another mutex.
+ */
+
 #include <types.h>
 #include <stddef.h>
 #include "matrix/matrix.h"
+#include "hal/core.h"
 #include "debug.h"
+#include "barrier.h"
 #include "proc/thread.h"
+#include "proc/sched.h"
 #include "mutex.h"
 
+/* Longest chain of owners a boost is passed along */
+#define MUTEX_PI_MAX_DEPTH	16
+
+/* Protects the order of the wait queues, the owners' lists of mutexes that
+ * have waiters and the blocked_on of the waiters. Taken after the lock of
+ * a mutex and before the lock of a thread.
+ */
+static struct spinlock _pi_lock = SPINLOCK_INITIALIZER("pi-lock");
+
+/* Times a contender polls the mutex before it sleeps, 0 disables spinning */
+uint32_t _mutex_spin_limit = 1000;
+
 static INLINE void mutex_recursive_error(struct mutex *m)
 {
 	PANIC("Recursive locking of non-recursive mutex");
 }
 
-static int mutex_acquire_internal(struct mutex *m, useconds_t timeout, int flags)
+static INLINE int mutex_waiter_rank(struct thread *t)
 {
-	int rc = -1;
+	return sched_prio_rank(t->policy, t->priority);
+}
 
-	if (!atomic_tas(&m->value, 0, 1)) {
-		if (m->owner == CURR_THREAD) {
-			mutex_recursive_error(m);
-		} else {
-			spinlock_acquire(&m->lock);
+/* Queue a waiter behind the waiters of the same or higher priority */
+static void mutex_queue_waiter(struct mutex *m, struct thread *t)
+{
+	int rank;
+	struct list *l;
+	struct thread *w;
 
-			/* Check again now that we owned the lock, in case mutex_release()
-			 * was called on another CPU
-			 */
-			if (atomic_tas(&m->value, 0, 1)) {
-				spinlock_release(&m->lock);
-			} else {
-				list_add_tail(&CURR_THREAD->wait_link, &m->threads);
-
-				/* If thread_sleep is successful, we will own the lock */
-				rc = thread_sleep(&m->lock, timeout, m->name, flags);
-				if (rc != 0) {
-					return rc;
-				}
-
-				DEBUG(DL_DBG, ("mutex(%s) put thread(%s:%d) to wait list.\n",
-					       m->name, CURR_THREAD->name, CURR_THREAD->id));
-			}
+	rank = mutex_waiter_rank(t);
+	LIST_FOR_EACH(l, &m->threads) {
+		w = LIST_ENTRY(l, struct thread, wait_link);
+		if (mutex_waiter_rank(w) < rank) {
+			break;
+		}
+	}
+	list_add_tail(&t->wait_link, l);
+}
+
+/*
+ * Boost a thread to the priority of the highest waiter of the mutexes it
+ * owns. Returns TRUE if the effective priority of the thread changed.
+ */
+static boolean_t mutex_pi_boost(struct thread *t)
+{
+	int policy = -1, priority = 0;
+	struct list *l;
+	struct mutex *m;
+	struct thread *w;
+
+	LIST_FOR_EACH(l, &t->pi_mutexes) {
+		m = LIST_ENTRY(l, struct mutex, pi_link);
+		w = LIST_ENTRY(m->threads.next, struct thread, wait_link);
+		if ((policy < 0) ||
+		    (mutex_waiter_rank(w) > sched_prio_rank(policy, priority))) {
+			policy = w->policy;
+			priority = w->priority;
 		}
 	}
 
+	return sched_set_boost(t, policy, priority);
+}
+
+/*
+ * The priority of a thread changed, requeue it in the mutex it waits for
+ * and update the owner of that mutex, and so on along the chain.
+ */
+static void mutex_pi_chain(struct thread *t)
+{
+	int depth;
+	struct mutex *m;
+
+	for (depth = 0; depth < MUTEX_PI_MAX_DEPTH; depth++) {
+		m = t->blocked_on;
+		if (!m) {
+			break;
+		}
+
+		/* The queue must never look empty to mutex_release(), which
+		 * only holds the lock of the mutex when it checks.
+		 */
+		if (m->threads.next != m->threads.prev) {
+			list_del(&t->wait_link);
+			mutex_queue_waiter(m, t);
+		}
+
+		t = m->owner;
+		if (!t || !mutex_pi_boost(t)) {
+			break;
+		}
+	}
+
+	if (depth == MUTEX_PI_MAX_DEPTH) {
+		DEBUG(DL_WRN, ("mutex chain too long, thread(%s:%d).\n",
+			       t->name, t->id));
+	}
+}
+
+/* Let the waiters of a mutex boost its owner */
+static void mutex_pi_link(struct mutex *m)
+{
+	struct thread *owner = m->owner;
+
+	if (!owner || LIST_EMPTY(&m->threads)) {
+		return;
+	}
+
+	if (LIST_EMPTY(&m->pi_link)) {
+		list_add_tail(&m->pi_link, &owner->pi_mutexes);
+	}
+
+	if (mutex_pi_boost(owner)) {
+		mutex_pi_chain(owner);
+	}
+}
+
+/* Take the ownership of a mutex we got without waiting in the queue */
+static void mutex_set_owner(struct mutex *m)
+{
 	m->owner = CURR_THREAD;
-	return 0;
+
+	/* A waiter may have found the mutex without an owner */
+	smp_mb();
+	if (!LIST_EMPTY(&m->threads)) {
+		spinlock_acquire(&m->lock);
+		spinlock_acquire_noirq(&_pi_lock);
+		mutex_pi_link(m);
+		spinlock_release_noirq(&_pi_lock);
+		spinlock_release(&m->lock);
+	}
+}
+
+/*
+ * Poll the mutex while its owner runs on another CORE, the owner is likely
+ * to release it sooner than we could sleep and be woken up. Thread
+ * structures come from a slab cache, so a stale owner is still readable.
+ * Returns TRUE if we got the mutex.
+ */
+static boolean_t mutex_spin(struct mutex *m)
+{
+	uint32_t i;
+	struct thread *owner;
+
+	if (_nr_cores <= 1) {
+		return FALSE;
+	}
+
+	for (i = 0; i < _mutex_spin_limit; i++) {
+		/* A queued waiter gets the mutex by handoff, not us */
+		if (!LIST_EMPTY(&m->threads)) {
+			break;
+		}
+
+		owner = m->owner;
+		if (owner && ((owner->state != THREAD_RUNNING) ||
+			      (owner->core == CURR_CORE))) {
+			break;
+		}
+
+		if (atomic_tas(&m->value, 0, 1)) {
+			return TRUE;
+		}
+		core_spin_hint();
+	}
+
+	return FALSE;
+}
+
+/*
+ * Waits are not interruptible and do not time out, so a waiter only leaves
+ * the queue when mutex_release() hands the mutex over to it. Returns TRUE
+ * if the mutex was not free.
+ */
+static boolean_t mutex_acquire_internal(struct mutex *m)
+{
+	if (atomic_tas(&m->value, 0, 1)) {
+		mutex_set_owner(m);
+		return FALSE;
+	}
+
+	if (m->owner == CURR_THREAD) {
+		mutex_recursive_error(m);
+	}
+
+	if (mutex_spin(m)) {
+		mutex_set_owner(m);
+		return TRUE;
+	}
+
+	spinlock_acquire(&m->lock);
+
+	/* Check again now that we owned the lock, in case mutex_release()
+	 * was called on another CPU
+	 */
+	if (atomic_tas(&m->value, 0, 1)) {
+		m->owner = CURR_THREAD;
+		spinlock_release(&m->lock);
+		return TRUE;
+	}
+
+	spinlock_acquire_noirq(&_pi_lock);
+	CURR_THREAD->blocked_on = m;
+	mutex_queue_waiter(m, CURR_THREAD);
+	mutex_pi_link(m);
+	spinlock_release_noirq(&_pi_lock);
+
+	DEBUG(DL_DBG, ("mutex(%s) put thread(%s:%d) to wait list.\n",
+		       m->name, CURR_THREAD->name, CURR_THREAD->id));
+
+	/* We own the lock when we are woken up */
+	thread_sleep(&m->lock, -1, m->name, 0);
+	ASSERT(m->owner == CURR_THREAD);
+
+	return TRUE;
 }
 
 void mutex_acquire(struct mutex *m)
 {
-	mutex_acquire_internal(m, -1, 0);
+#ifdef _LOCKSTAT
+	boolean_t contended;
+	uint64_t start;
+
+	start = x86_rdtsc();
+	contended = mutex_acquire_internal(m);
+	lockstat_acquired(&m->stat, m->name, LOCKSTAT_MUTEX, LOCK_CALLER,
+			  start, contended);
+#else
+	mutex_acquire_internal(m);
+#endif	/* _LOCKSTAT */
 }
 
 void mutex_release(struct mutex *m)
 {
 	struct thread *t;
-	struct list *l;
 
 	spinlock_acquire(&m->lock);
 
@@ -67,15 +267,32 @@ void mutex_release(struct mutex *m)
 	 * ownership of the lock to it. Otherwise, decrement the count.
 	 */
 	if (m->value == 1) {
-		m->owner = NULL;
+#ifdef _LOCKSTAT
+		lockstat_released(&m->stat);
+#endif	/* _LOCKSTAT */
 		if (!LIST_EMPTY(&m->threads)) {
-			l = m->threads.next;
-			t = LIST_ENTRY(l, struct thread, wait_link);
+			spinlock_acquire_noirq(&_pi_lock);
+
+			t = LIST_ENTRY(m->threads.next, struct thread, wait_link);
+			list_del(&t->wait_link);
+			t->blocked_on = NULL;
+
+			/* The remaining waiters boost the new owner, and we
+			 * drop the boost they gave us.
+			 */
+			list_del(&m->pi_link);
+			m->owner = t;
+			mutex_pi_link(m);
+			mutex_pi_boost(CURR_THREAD);
+
+			spinlock_release_noirq(&_pi_lock);
+
 			DEBUG(DL_DBG, ("mutex(%s) waking up thread(%s:%d).\n",
 				       m->name, t->name, t->id));
 			thread_wake(t);
 		} else {
 			DEBUG(DL_DBG, ("mutex(%s) no waiting threads.\n", m->name));
+			m->owner = NULL;
 			atomic_dec(&m->value);
 		}
 	} else {
@@ -85,12 +302,30 @@ void mutex_release(struct mutex *m)
 	spinlock_release(&m->lock);
 }
 
+/**
+ * Requeue a waiting thread whose priority was changed by sched_set_policy()
+ */
+void mutex_pi_update(struct thread *t)
+{
+	if (!t->blocked_on) {
+		return;
+	}
+
+	spinlock_acquire(&_pi_lock);
+	mutex_pi_chain(t);
+	spinlock_release(&_pi_lock);
+}
+
 void mutex_init(struct mutex *m, const char *name, int flags)
 {
 	m->value = 0;
 	spinlock_init(&m->lock, "mutex-lock");
 	LIST_INIT(&m->threads);
+	LIST_INIT(&m->pi_link);
 	m->flags = flags;
 	m->owner = NULL;
 	m->name = name;
+#ifdef _LOCKSTAT
+	m->stat.site = NULL;
+#endif	/* _LOCKSTAT */
 }
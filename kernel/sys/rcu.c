@@ -0,0 +1,394 @@
+/*
+ * rcu.c
+ *
+ * Quiescent state based RCU. Callbacks are queued on the CORE that calls
+ * call_rcu() and handed to the grace period machinery as one batch when the
+ * CORE passes its next quiescent state. A grace period ends when every
+ * CORE that was not idle at its start has passed a quiescent state, then
+ * the batch that waited for it is invoked by the rcu thread.
+ */
+
+#include <types.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "matrix/matrix.h"
+#include "hal/hal.h"
+#include "hal/core.h"
+#include "hal/spinlock.h"
+#include "debug.h"
+#include "barrier.h"
+#include "mm/malloc.h"
+#include "proc/thread.h"
+#include "proc/sched.h"
+#include "proc/sched_class.h"
+#include "semaphore.h"
+#include "procfs.h"
+#include "rcu.h"
+
+struct rcu_sync {
+	struct rcu_head head;
+	struct semaphore sem;
+};
+
+/* Protects the grace period state and the global batches */
+static struct spinlock _rcu_lock = SPINLOCK_INITIALIZER("rcu-lock");
+
+/* A grace period is in progress while the two differ */
+static volatile uint32_t _rcu_cur = 0;		// Grace period started last
+static uint32_t _rcu_completed = 0;		// Grace period completed last
+
+/* COREs that have not passed a quiescent state in the current period */
+static uint32_t _rcu_nr_pending = 0;
+
+/* Callbacks waiting for the current period, for the one after it and the
+ * ones ready to be invoked.
+ */
+static struct rcu_batch _rcu_cur_batch = { NULL, &_rcu_cur_batch.head, 0 };
+static struct rcu_batch _rcu_next_batch = { NULL, &_rcu_next_batch.head, 0 };
+static struct rcu_batch _rcu_done = { NULL, &_rcu_done.head, 0 };
+
+/* Wakes up the rcu thread when callbacks are ready */
+static struct semaphore _rcu_sem;
+
+/* Statistics */
+static uint32_t _rcu_nr_gps = 0;
+static uint32_t _rcu_nr_invoked = 0;
+
+static INLINE void rcu_batch_init(struct rcu_batch *b)
+{
+	b->head = NULL;
+	b->tail = &b->head;
+	b->count = 0;
+}
+
+static INLINE void rcu_batch_add(struct rcu_batch *b, struct rcu_head *h)
+{
+	h->next = NULL;
+	*b->tail = h;
+	b->tail = &h->next;
+	b->count++;
+}
+
+/* Move all the callbacks of src to the end of dst */
+static void rcu_batch_splice(struct rcu_batch *dst, struct rcu_batch *src)
+{
+	if (!src->head) {
+		return;
+	}
+
+	*dst->tail = src->head;
+	dst->tail = src->tail;
+	dst->count += src->count;
+	rcu_batch_init(src);
+}
+
+/*
+ * Start a new grace period, the lock must be held. Idle COREs have no
+ * readers, the readers they run after they leave the idle loop or enter an
+ * interrupt handler will see the changes made before now.
+ */
+static void rcu_start_gp()
+{
+	struct list *l;
+	struct core *c;
+
+	_rcu_cur++;
+	_rcu_nr_pending = 0;
+
+	/* Pairs with the barriers in rcu_idle_enter(), rcu_idle_exit() and
+	 * rcu_irq_enter()
+	 */
+	smp_mb();
+
+	LIST_FOR_EACH(l, &_running_cores) {
+		c = LIST_ENTRY(l, struct core, link);
+		if (!c->rcu) {
+			continue;
+		}
+		if (c->rcu->idle) {
+			c->rcu->gp_seen = _rcu_cur;
+		} else {
+			_rcu_nr_pending++;
+		}
+	}
+}
+
+/*
+ * End the grace periods all the COREs have passed, the lock must be held.
+ * Returns TRUE if callbacks became ready.
+ */
+static boolean_t rcu_check_gp()
+{
+	boolean_t ready = FALSE;
+
+	while ((_rcu_cur != _rcu_completed) && !_rcu_nr_pending) {
+		_rcu_completed = _rcu_cur;
+		_rcu_nr_gps++;
+
+		if (_rcu_cur_batch.head) {
+			rcu_batch_splice(&_rcu_done, &_rcu_cur_batch);
+			ready = TRUE;
+		}
+
+		/* Callbacks queued during this period need another one */
+		if (_rcu_next_batch.head) {
+			rcu_batch_splice(&_rcu_cur_batch, &_rcu_next_batch);
+			rcu_start_gp();
+		}
+	}
+
+	return ready;
+}
+
+/**
+ * Mark the current CORE as being in a read-side section. The thread will
+ * not be preempted until the matching rcu_read_unlock().
+ */
+void rcu_read_lock()
+{
+	boolean_t state;
+
+	state = local_irq_disable();
+	CURR_CORE->rcu_nesting++;
+	local_irq_restore(state);
+}
+
+void rcu_read_unlock()
+{
+	boolean_t state, preempt;
+	struct core *c;
+
+	state = local_irq_disable();
+	c = CURR_CORE;
+	ASSERT(c->rcu_nesting > 0);
+	c->rcu_nesting--;
+	preempt = !c->rcu_nesting && c->sched && c->sched->need_resched;
+	local_irq_restore(state);
+
+	/* Take the preemption we held off. An interrupt handler will do it
+	 * on the way out of the interrupt.
+	 */
+	if (preempt && state) {
+		sched_preempt();
+	}
+}
+
+/**
+ * Queue a callback to be called once all the current readers are gone. The
+ * callback runs in the rcu thread and may sleep.
+ */
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *))
+{
+	boolean_t state;
+	struct rcu_core *rc;
+
+	head->func = func;
+
+	state = local_irq_disable();
+	rc = CURR_CORE->rcu;
+	ASSERT(rc != NULL);
+	rcu_batch_add(&rc->next, head);
+	rc->nr_queued++;
+	local_irq_restore(state);
+}
+
+static void rcu_sync_func(struct rcu_head *head)
+{
+	struct rcu_sync *s;
+
+	s = (struct rcu_sync *)head;
+	semaphore_up(&s->sem, 1);
+}
+
+/**
+ * Wait until all the readers that may see the old version of a structure
+ * are gone. Must not be called from a read-side section.
+ */
+void synchronize_rcu()
+{
+	struct rcu_sync s;
+
+	ASSERT(!CURR_CORE->rcu_nesting);
+
+	semaphore_init(&s.sem, "rcu-sync", 0);
+	call_rcu(&s.head, rcu_sync_func);
+	semaphore_down(&s.sem);
+}
+
+/**
+ * Called with interrupts disabled when the current CORE is not in a
+ * read-side section, on a thread switch or in the idle loop. Reports the
+ * quiescent state and hands the callbacks queued on this CORE over.
+ */
+void rcu_quiescent()
+{
+	boolean_t ready;
+	struct rcu_core *rc;
+
+	rc = CURR_CORE->rcu;
+	if (!rc) {
+		return;
+	}
+
+	ASSERT(!CURR_CORE->rcu_nesting);
+
+	/* Fast path, no lock is taken if we have nothing to do */
+	if ((rc->gp_seen == _rcu_cur) && !rc->next.head) {
+		return;
+	}
+
+	spinlock_acquire_noirq(&_rcu_lock);
+
+	if (rc->gp_seen != _rcu_cur) {
+		ASSERT(_rcu_nr_pending > 0);
+		rc->gp_seen = _rcu_cur;
+		rc->nr_qs++;
+		_rcu_nr_pending--;
+	}
+
+	if (rc->next.head) {
+		if (_rcu_cur == _rcu_completed) {
+			rcu_batch_splice(&_rcu_cur_batch, &rc->next);
+			rcu_start_gp();
+		} else {
+			rcu_batch_splice(&_rcu_next_batch, &rc->next);
+		}
+	}
+
+	ready = rcu_check_gp();
+
+	spinlock_release_noirq(&_rcu_lock);
+
+	if (ready) {
+		semaphore_up(&_rcu_sem, 1);
+	}
+}
+
+/**
+ * The current CORE is about to wait for interrupts, grace periods started
+ * from now on will not wait for it.
+ */
+void rcu_idle_enter()
+{
+	struct rcu_core *rc;
+
+	rc = CURR_CORE->rcu;
+	if (!rc) {
+		return;
+	}
+
+	rc->idle = TRUE;
+	smp_mb();
+	rcu_quiescent();
+}
+
+void rcu_idle_exit()
+{
+	struct rcu_core *rc;
+
+	rc = CURR_CORE->rcu;
+	if (!rc) {
+		return;
+	}
+
+	rc->idle = FALSE;
+	smp_mb();
+}
+
+/**
+ * Called on entry of the interrupt handlers. An idle CORE wakes up right in
+ * the handler, which walks the hook chains under RCU, so it is not idle for
+ * the grace periods started from now on. The idle loop reports a quiescent
+ * state and marks it idle again before its next wait.
+ */
+void rcu_irq_enter()
+{
+	struct rcu_core *rc;
+
+	rc = CURR_CORE->rcu;
+	if (!rc || !rc->idle) {
+		return;
+	}
+
+	rc->idle = FALSE;
+	smp_mb();
+}
+
+static void rcu_thread(void *ctx)
+{
+	struct rcu_batch b;
+	struct rcu_head *h, *n;
+
+	while (TRUE) {
+		semaphore_down(&_rcu_sem);
+
+		rcu_batch_init(&b);
+		spinlock_acquire(&_rcu_lock);
+		rcu_batch_splice(&b, &_rcu_done);
+		spinlock_release(&_rcu_lock);
+
+		for (h = b.head; h; h = n) {
+			n = h->next;
+			h->func(h);
+		}
+		_rcu_nr_invoked += b.count;
+	}
+}
+
+static int rcu_procfs_read(char *buf, size_t size)
+{
+	int len;
+	struct list *l;
+	struct core *c;
+
+	len = snprintf(buf, size,
+		       "gp %d completed %d pending %d gps %d "
+		       "waiting %d invoked %d\n",
+		       _rcu_cur, _rcu_completed, _rcu_nr_pending, _rcu_nr_gps,
+		       _rcu_cur_batch.count + _rcu_next_batch.count +
+		       _rcu_done.count, _rcu_nr_invoked);
+
+	LIST_FOR_EACH(l, &_running_cores) {
+		c = LIST_ENTRY(l, struct core, link);
+		if (!c->rcu || (len >= size)) {
+			continue;
+		}
+		len += snprintf(buf + len, size - len,
+				"core%d qs %d queued %d idle %d\n",
+				c->id, c->rcu->nr_qs, c->rcu->nr_queued,
+				c->rcu->idle);
+	}
+
+	return len;
+}
+
+void init_rcu_percore()
+{
+	struct rcu_core *rc;
+
+	rc = kmalloc(sizeof(struct rcu_core), 0);
+	ASSERT(rc != NULL);
+
+	rcu_batch_init(&rc->next);
+	rc->idle = FALSE;
+	rc->nr_qs = 0;
+	rc->nr_queued = 0;
+
+	/* Grace periods in progress do not wait for us */
+	spinlock_acquire(&_rcu_lock);
+	rc->gp_seen = _rcu_cur;
+	CURR_CORE->rcu = rc;
+	spinlock_release(&_rcu_lock);
+}
+
+void init_rcu()
+{
+	int rc = -1;
+
+	semaphore_init(&_rcu_sem, "rcu-sem", 0);
+
+	rc = thread_create("rcu", NULL, 0, rcu_thread, NULL, NULL);
+	ASSERT(rc == 0);
+
+	procfs_register("rcu", rcu_procfs_read);
+}
@@ -0,0 +1,111 @@
+#include <types.h>
+#include <stddef.h>
+#include "matrix/matrix.h"
+#include "proc/thread.h"
+#include "rwlock.h"
+#include "debug.h"
+
+/*
+ * The lock is handed over to the threads we wake up, they own it when
+ * they return from thread_sleep().
+ */
+static void rwlock_wake_writer(struct rwlock *l)
+{
+	struct thread *t;
+
+	t = LIST_ENTRY(l->writers_waiting.next, struct thread, wait_link);
+	l->writer = t;
+	thread_wake(t);
+}
+
+static void rwlock_wake_readers(struct rwlock *l)
+{
+	struct list *p, *n;
+	struct thread *t;
+
+	LIST_FOR_EACH_SAFE(p, n, &l->readers_waiting) {
+		t = LIST_ENTRY(p, struct thread, wait_link);
+		l->readers++;
+		thread_wake(t);
+	}
+}
+
+void rwlock_read_acquire(struct rwlock *l)
+{
+	spinlock_acquire(&l->lock);
+
+	if (!l->writer && LIST_EMPTY(&l->writers_waiting)) {
+		l->readers++;
+		spinlock_release(&l->lock);
+		return;
+	}
+
+	ASSERT(l->writer != CURR_THREAD);
+
+	list_add_tail(&CURR_THREAD->wait_link, &l->readers_waiting);
+	thread_sleep(&l->lock, -1, l->name, 0);
+}
+
+void rwlock_read_release(struct rwlock *l)
+{
+	spinlock_acquire(&l->lock);
+
+	if (l->readers <= 0) {
+		PANIC("Release of rwlock not read locked");
+	}
+
+	l->readers--;
+	if (!l->readers && !LIST_EMPTY(&l->writers_waiting)) {
+		rwlock_wake_writer(l);
+	}
+
+	spinlock_release(&l->lock);
+}
+
+void rwlock_write_acquire(struct rwlock *l)
+{
+	spinlock_acquire(&l->lock);
+
+	if (!l->writer && !l->readers) {
+		l->writer = CURR_THREAD;
+		spinlock_release(&l->lock);
+		return;
+	}
+
+	if (l->writer == CURR_THREAD) {
+		PANIC("Recursive locking of rwlock");
+	}
+
+	list_add_tail(&CURR_THREAD->wait_link, &l->writers_waiting);
+	thread_sleep(&l->lock, -1, l->name, 0);
+	ASSERT(l->writer == CURR_THREAD);
+}
+
+void rwlock_write_release(struct rwlock *l)
+{
+	spinlock_acquire(&l->lock);
+
+	if (l->writer != CURR_THREAD) {
+		PANIC("Release of rwlock from incorrect thread");
+	}
+
+	/* Waiting writers go first, then all the waiting readers at once */
+	l->writer = NULL;
+	if (!LIST_EMPTY(&l->writers_waiting)) {
+		rwlock_wake_writer(l);
+	} else {
+		rwlock_wake_readers(l);
+	}
+
+	spinlock_release(&l->lock);
+}
+
+void rwlock_init(struct rwlock *l, const char *name)
+{
+	spinlock_init(&l->lock, "rwlock-lock");
+	l->readers = 0;
+	l->writer = NULL;
+	LIST_INIT(&l->readers_waiting);
+	LIST_INIT(&l->writers_waiting);
+	l->name = name;
+}
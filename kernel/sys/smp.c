@@ -3,11 +3,13 @@
 #include <string.h>
 #include "debug.h"
 #include "list.h"
+#include "barrier.h"
 #include "hal/hal.h"
 #include "hal/core.h"
 #include "hal/lapic.h"
 #include "mm/mlayout.h"
 #include "mm/mmu.h"
+#include "mm/va.h"
 #include "mm/kmem.h"
 #include "mm/malloc.h"
 #include "platform.h"
@@ -37,6 +39,10 @@ static boolean_t _smp_call_enabled = FALSE;
 /* Variable used to synchronize the stages of the SMP boot process */
 volatile uint32_t _smp_boot_status = 0;
 
+/* Width of the SMT field and of the SMT and core fields in the APIC ID */
+static uint32_t _smt_bits = 0;
+static uint32_t _core_bits = 0;
+
 extern char __ac_trampoline_start[], __ac_trampoline_end[];
 extern void kmain_ac(struct core *c);
 
@@ -159,6 +165,81 @@ void smp_boot_cores()
 	local_irq_restore(state);
 }
 
+/* Number of bits needed to number n items */
+static uint32_t smp_count_bits(uint32_t n)
+{
+	uint32_t bits = 0;
+
+	while ((1U << bits) < n) {
+		bits++;
+	}
+
+	return bits;
+}
+
+/*
+ * Find out how the APIC ID is split into the package, core and SMT fields.
+ * The extended topology leaf 0xB is used if the CORE supports it, otherwise
+ * the counts from leaf 1 and the deterministic cache leaf 4. All the COREs
+ * are assumed to be the same as the boot CORE.
+ */
+static void smp_detect_topology()
+{
+	uint32_t a, b, c, d, max, level, type, logical, cores;
+	boolean_t found = FALSE;
+
+	x86_coreid(0, &max, &b, &c, &d);
+
+	if (max >= 0xB) {
+		for (level = 0; level < 8; level++) {
+			x86_coreid_count(0xB, level, &a, &b, &c, &d);
+			type = (c >> 8) & 0xFF;
+			if (!type || !(b & 0xFFFF)) {
+				break;
+			}
+			if (type == 1) {
+				_smt_bits = a & 0x1F;
+				found = TRUE;
+			} else if (type == 2) {
+				_core_bits = a & 0x1F;
+				found = TRUE;
+			}
+		}
+	}
+
+	if (!found) {
+		x86_coreid(1, &a, &b, &c, &d);
+		logical = (d & (1 << 28)) ? ((b >> 16) & 0xFF) : 1;
+		cores = 1;
+		if (max >= 4) {
+			x86_coreid_count(4, 0, &a, &b, &c, &d);
+			cores = ((a >> 26) & 0x3F) + 1;
+		}
+		if (logical < cores) {
+			logical = cores;
+		}
+		_smt_bits = smp_count_bits(logical / cores);
+		_core_bits = smp_count_bits(logical);
+	}
+
+	if (_core_bits < _smt_bits) {
+		_core_bits = _smt_bits;
+	}
+
+	kprintf("smp: %d threads per core, %d cores per package\n",
+		1 << _smt_bits, 1 << (_core_bits - _smt_bits));
+}
+
+static void smp_set_topology(struct core *c)
+{
+	c->topo.package = c->id >> _core_bits;
+	c->topo.core = (c->id & ((1 << _core_bits) - 1)) >> _smt_bits;
+	c->topo.thread = c->id & ((1 << _smt_bits) - 1);
+
+	DEBUG(DL_DBG, ("core(%d) package(%d) core(%d) thread(%d).\n", c->id,
+		       c->topo.package, c->topo.core, c->topo.thread));
+}
+
 void smp_ipi_handler()
 {
 	ASSERT(_smp_call_enabled);
@@ -166,6 +247,81 @@ void smp_ipi_handler()
 	DEBUG(DL_DBG, ("received IPI.\n"));
 }
 
+/*
+ * The sender has already set need_resched of this CORE, the reschedule
+ * happens in sched_preempt() on the way out of the interrupt.
+ */
+void smp_resched_handler()
+{
+	CURR_CORE->resched_ipis++;
+}
+
+/**
+ * Ask a remote CORE to reschedule
+ */
+void smp_send_reschedule(struct core *c)
+{
+	ASSERT(c != CURR_CORE);
+	
+	lapic_ipi(LAPIC_IPI_DEST_SINGLE, c->id, LAPIC_IPI_FIXED,
+		  LAPIC_VECT_RESCHED);
+}
+
+/*
+ * Another CORE changed a mapping we may have cached. The whole TLB is
+ * flushed so that the requests need no arguments.
+ */
+void smp_tlb_handler()
+{
+	if (CURR_CORE->tlb_flush) {
+		x86_write_cr3(x86_read_cr3());
+		CURR_CORE->tlb_flush = FALSE;
+	}
+}
+
+/**
+ * Invalidate a page of the context on every CORE that may have it cached,
+ * return when they all did. The kernel context is mapped in every context,
+ * so all the COREs are asked for it. Must be called with interrupts
+ * disabled. The requests to this CORE are served while we wait, so two
+ * COREs may shoot down at the same time.
+ */
+void smp_tlb_shootdown(struct mmu_ctx *ctx, ptr_t virt)
+{
+	struct list *l;
+	struct core *c;
+
+	ASSERT(!local_irq_state());
+
+	if (IS_KERNEL_CTX(ctx) || (CURR_ASPACE && (CURR_ASPACE->mmu == ctx))) {
+		x86_invlpg(virt);
+	}
+
+	/* A CORE that switches to the context after this walks the new
+	 * entry, only the ones running it now may have the old one.
+	 */
+	smp_mb();
+
+	LIST_FOR_EACH(l, &_running_cores) {
+		c = LIST_ENTRY(l, struct core, link);
+		if ((c == CURR_CORE) || (!IS_KERNEL_CTX(ctx) &&
+		    (!c->aspace || (c->aspace->mmu != ctx)))) {
+			continue;
+		}
+		c->tlb_flush = TRUE;
+		lapic_ipi(LAPIC_IPI_DEST_SINGLE, c->id, LAPIC_IPI_FIXED,
+			  LAPIC_VECT_TLB);
+	}
+
+	LIST_FOR_EACH(l, &_running_cores) {
+		c = LIST_ENTRY(l, struct core, link);
+		while (c->tlb_flush) {
+			smp_tlb_handler();
+			core_spin_hint();
+		}
+	}
+}
+
 void init_smp()
 {
 	size_t cnt, i;
@@ -174,6 +330,14 @@ void init_smp()
 	/* Detect application CORE */
 	platform_detect_smp();
 
+	/* Place the COREs listed in the MADT in the topology */
+	smp_detect_topology();
+	for (i = 0; i <= _highest_core_id; i++) {
+		if (_cores[i]) {
+			smp_set_topology(_cores[i]);
+		}
+	}
+
 	/* If we have only 1 CORE, there's nothing to do */
 	if (_nr_cores == 1) {
 		DEBUG(DL_DBG, ("Only 1 core.\n"));
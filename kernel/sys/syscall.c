@@ -5,15 +5,21 @@
 #include <stddef.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
 #include "matrix/matrix.h"
 #include "sys/time.h"
 #include "hal/isr.h"
 #include "mm/malloc.h"
 #include "mm/slab.h"
+#include "mm/va.h"
+#include "mm/mlayout.h"
 #include "util.h"
 #include "dirent.h"
 #include "sys/stat.h"
+#include "sys/mman.h"
 #include "proc/process.h"
+#include "proc/sched.h"
 #include "div64.h"
 #include "debug.h"
 #include "fd.h"
@@ -22,6 +28,7 @@
 #include "pit.h"
 #include "platform.h"
 #include "module.h"
+#include "futex.h"
 
 #define MAX_HOSTNAME_LEN	256
 #define NR_SYSCALLS		(sizeof(_syscalls)/sizeof(_syscalls[0]))
@@ -72,6 +79,9 @@ int do_open(const char *file, int flags, int mode)
 		DEBUG(DL_DBG, ("file(%s) node(%s) open.\n", file, n->name));
 		/* Attach the file descriptor to the process */
 		fd = fd_attach((struct process *)CURR_PROC, n);
+		if ((fd != -1) && FLAG_ON(flags, O_CLOEXEC)) {
+			fd_set_flags(NULL, fd, FD_CLOEXEC);
+		}
 	} else {
 		DEBUG(DL_DBG, ("file(%s) open failed.\n", file));
 	}
@@ -136,16 +146,20 @@ int do_gettimeofday(struct timeval *tv, struct timezone *tz)
 {
 	struct tm t;
 	useconds_t usecs;
+	static useconds_t boot_time = 0;
 
-	get_cmostime(&t);
-	tv->tv_sec = 0;
-	tv->tv_usec = 0;
+	/* Read the CMOS time only once, the system time will give us
+	 * microsecond resolution since then.
+	 */
+	if (!boot_time) {
+		get_cmostime(&t);
+		boot_time = time_to_unix(t.tm_year, t.tm_mon, t.tm_mday,
+					 t.tm_hour, t.tm_min, t.tm_sec) - sys_time();
+	}
 
-	usecs = time_to_unix(t.tm_year, t.tm_mon, t.tm_mday,
-			     t.tm_hour, t.tm_min, t.tm_sec);
-	do_div(usecs, 1000000);
+	usecs = boot_time + sys_time();
+	tv->tv_usec = do_div(usecs, 1000000);
 	tv->tv_sec = usecs;
-	tv->tv_usec = 0;
 	
 	return 0;
 }
@@ -379,44 +393,13 @@ int do_getpid()
 
 int do_sleep(uint32_t ms)
 {
-	timer_delay(ms);
-
-	return 0;
-}
-
-static char **alloc_args(const char *argv[])
-{
-	char **ret = NULL;
-	size_t i, size, count;
-	char *ptr;
-
-	for (i = 0, size = 0; argv[i] != NULL; i++) {
-		size += strlen(argv[i]) + 1;
+	/* Block instead of spinning so the CORE is free for other threads */
+	if (ms) {
+		thread_sleep(NULL, (useconds_t)ms * 1000, "sleep",
+			     THREAD_INTERRUPTIBLE);
 	}
 
-	/* All the strings plus pointers to them and a NULL pointer */
-	count = i;
-	size += (sizeof(char *) * (count + 1));
-
-	ret = kmalloc(size, 0);
-	if (!ret) {
-		goto out;
-	}
-
-	for (i = 0, ptr = (char *)&ret[count + 1]; i < count; i++) {
-		strcpy(ptr, argv[i]);
-		ret[i] = ptr;
-		ptr += strlen(ptr) + 1;
-	}
-	ret[i] = NULL;
-
- out:
-	return ret;
-}
-
-static void free_args(char **args)
-{
-	kfree(args);
+	return 0;
 }
 
 int do_create_process(const char *path, const char *args[], int flags, int priority)
@@ -431,8 +414,8 @@ int do_create_process(const char *path, const char *args[], int flags, int prior
 	}
 
 	/* Copy the arguments to kernel memory */
-	arguments = alloc_args(args);
-	if (!args) {
+	arguments = process_dup_args(args);
+	if (!arguments) {
 		DEBUG(DL_INF, ("allocate args failed.\n"));
 		goto out;
 	}
@@ -450,7 +433,7 @@ int do_create_process(const char *path, const char *args[], int flags, int prior
 
  out:
 	if (arguments) {
-		free_args(arguments);
+		kfree(arguments);
 	}
 	
 	return rc;
@@ -627,6 +610,247 @@ int do_ioctl(int d, int request, void *input, void *output)
 	return rc;
 }
 
+int do_create_thread(ptr_t entry, ptr_t func, ptr_t args)
+{
+	int rc = -1;
+	tid_t tid;
+
+	rc = thread_create_uspace(entry, func, args, &tid);
+	if (rc != 0) {
+		DEBUG(DL_DBG, ("thread_create_uspace failed, err(%x).\n", rc));
+		goto out;
+	}
+
+	rc = tid;
+
+ out:
+	return rc;
+}
+
+int do_exit_thread(int status)
+{
+	CURR_THREAD->status = status;
+	thread_exit();
+	return 0;
+}
+
+int do_join_thread(tid_t tid, int *status)
+{
+	return thread_join(tid, status);
+}
+
+int do_gettid()
+{
+	return CURR_THREAD->id;
+}
+
+int do_futex_wait(int32_t *uaddr, int32_t val, uint32_t timeout)
+{
+	/* Zero timeout means wait forever */
+	return futex_wait(uaddr, val, timeout ? (useconds_t)timeout : -1);
+}
+
+int do_futex_wake(int32_t *uaddr, int count)
+{
+	return futex_wake(uaddr, count);
+}
+
+int do_yield()
+{
+	sched_yield();
+	return 0;
+}
+
+int do_fcntl(int fd, int cmd, int arg)
+{
+	int rc = -1;
+
+	switch (cmd) {
+	case F_GETFD:
+		rc = fd_get_flags(NULL, fd);
+		break;
+	case F_SETFD:
+		rc = fd_set_flags(NULL, fd, arg & FD_CLOEXEC);
+		break;
+	default:
+		DEBUG(DL_DBG, ("fcntl cmd(%d) not supported.\n", cmd));
+		break;
+	}
+
+	return rc;
+}
+
+int do_execve(const char *path, const char *args[], const char *env[])
+{
+	/* Only returns on failure */
+	return process_replace(path, args);
+}
+
+int do_set_tls(void *base)
+{
+	return thread_set_tls((ptr_t)base);
+}
+
+/* Find a thread of the current process, 0 means the calling thread */
+static struct thread *syscall_lookup_thread(tid_t tid)
+{
+	struct list *l;
+	struct thread *t;
+
+	if (!tid || (tid == CURR_THREAD->id)) {
+		return CURR_THREAD;
+	}
+
+	LIST_FOR_EACH(l, &CURR_PROC->threads) {
+		t = LIST_ENTRY(l, struct thread, owner_link);
+		if (t->id == tid) {
+			return t;
+		}
+	}
+
+	return NULL;
+}
+
+int do_set_scheduler(tid_t tid, int policy, int priority)
+{
+	int rc = -1;
+	struct thread *t;
+
+	/* Only the super user may run real time threads */
+	if ((policy != SCHED_OTHER) && (CURR_PROC->uid != 0)) {
+		DEBUG(DL_DBG, ("uid(%d) not allowed.\n", CURR_PROC->uid));
+		goto out;
+	}
+
+	mutex_acquire(&CURR_PROC->lock);
+	t = syscall_lookup_thread(tid);
+	if (t) {
+		rc = sched_set_policy(t, policy, priority);
+	}
+	mutex_release(&CURR_PROC->lock);
+
+ out:
+	return rc;
+}
+
+int do_get_scheduler(tid_t tid, int *priority)
+{
+	int rc = -1;
+	struct thread *t;
+
+	mutex_acquire(&CURR_PROC->lock);
+	t = syscall_lookup_thread(tid);
+	if (t) {
+		if (priority) {
+			*priority = t->base_priority;
+		}
+		rc = t->base_policy;
+	}
+	mutex_release(&CURR_PROC->lock);
+
+	return rc;
+}
+
+int do_set_affinity(tid_t tid, size_t size, const cpu_set_t *mask)
+{
+	int rc = -1;
+	cpu_set_t set;
+	struct thread *t;
+
+	if (!mask) {
+		goto out;
+	}
+
+	/* COREs beyond the size of the user mask are not allowed */
+	CPU_ZERO(&set);
+	memcpy(&set, mask, MIN(size, sizeof(cpu_set_t)));
+
+	mutex_acquire(&CURR_PROC->lock);
+	t = syscall_lookup_thread(tid);
+	if (t) {
+		rc = sched_set_affinity(t, &set);
+	}
+	mutex_release(&CURR_PROC->lock);
+
+ out:
+	return rc;
+}
+
+int do_get_affinity(tid_t tid, size_t size, cpu_set_t *mask)
+{
+	int rc = -1;
+	struct thread *t;
+
+	if (!mask) {
+		goto out;
+	}
+
+	mutex_acquire(&CURR_PROC->lock);
+	t = syscall_lookup_thread(tid);
+	if (t) {
+		memcpy(mask, &t->affinity, MIN(size, sizeof(cpu_set_t)));
+		rc = 0;
+	}
+	mutex_release(&CURR_PROC->lock);
+
+ out:
+	return rc;
+}
+
+/*
+ * Map a file or zero filled memory at a fixed address, the pages are
+ * brought in when they are touched. The flags are in the high bits of
+ * mode and the protection in the low bits. Return 0 if mapped at addr, the
+ * range must not be mapped already.
+ */
+int do_mmap(void *addr, size_t len, int mode, int fd, uint32_t offset)
+{
+	int rc = -1, prot, flags, vflags;
+	ptr_t start;
+	size_t size, filesz = 0;
+	struct vfs_node *n = NULL;
+
+	prot = mode & 0xFF;
+	flags = mode >> 8;
+	start = (ptr_t)addr;
+	size = ROUND_UP(len, PAGE_SIZE);
+
+	if (!FLAG_ON(flags, MAP_FIXED) || !size || (start % PAGE_SIZE) ||
+	    (offset % PAGE_SIZE) || (start + size > KERNEL_KMEM_START) ||
+	    (start + size < start)) {
+		DEBUG(DL_DBG, ("addr(%p) len(%x) flags(%x) not supported.\n",
+			       addr, len, flags));
+		goto out;
+	}
+
+	if (!FLAG_ON(flags, MAP_ANONYMOUS)) {
+		n = fd_2_vfs_node(NULL, fd);
+		if (!n || (n->type != VFS_FILE)) {
+			DEBUG(DL_DBG, ("invalid fd(%d).\n", fd));
+			goto out;
+		}
+		if (offset < n->length) {
+			filesz = MIN(size, n->length - offset);
+		}
+	}
+
+	vflags = VA_MAP_FIXED|VA_MAP_EXCL;
+	if (FLAG_ON(prot, PROT_READ)) {
+		vflags |= VA_MAP_READ;
+	}
+	if (FLAG_ON(prot, PROT_WRITE)) {
+		vflags |= VA_MAP_WRITE;
+	}
+	if (FLAG_ON(prot, PROT_EXEC)) {
+		vflags |= VA_MAP_EXEC;
+	}
+
+	rc = va_map_file(CURR_ASPACE, start, size, vflags, n, offset, filesz);
+
+ out:
+	return rc;
+}
+
 /*
  * NOTE: When adding a system call, please add the following items:
  *   [1] _syscalls - the array which contains pointers to the system calls
@@ -669,6 +893,21 @@ static void *_syscalls[] = {
 	do_query_module,
 	do_delete_module,
 	do_ioctl,
+	do_create_thread,
+	do_exit_thread,
+	do_join_thread,
+	do_gettid,
+	do_futex_wait,
+	do_futex_wake,
+	do_yield,
+	do_fcntl,
+	do_execve,
+	do_mmap,
+	do_set_tls,
+	do_set_scheduler,
+	do_get_scheduler,
+	do_set_affinity,
+	do_get_affinity,
 	NULL
 };
 
@@ -720,4 +959,7 @@ void syscall_handler(struct registers *regs)
 		     "r"(regs->ecx), "r"(regs->ebx), "r"(location));
 	
 	regs->eax = rc;
+
+	/* Switch to the thread woken up by the system call if it should run */
+	sched_preempt();
 }
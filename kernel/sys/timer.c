@@ -1,14 +1,26 @@
 #include <types.h>
 #include <stddef.h>
 #include <string.h>
+#include <stdio.h>
+#include "matrix/const.h"
 #include "sys/time.h"
 #include "debug.h"
+#include "div64.h"
 #include "hal/core.h"
 #include "hal/lapic.h"
 #include "pit.h"
 #include "timer.h"
 #include "proc/thread.h"
 #include "proc/sched.h"
+#include "proc/sched_class.h"
+#include "procfs.h"
+
+/* Period of the scheduler tick while a thread is running */
+#define TIMER_TICK_PERIOD	(1000000 / HZ)
+
+/* Bounds of a one-shot timer interval */
+#define TIMER_MIN_DELTA		10
+#define TIMER_MAX_DELTA		1000000
 
 void tmrs_clrtimer(struct list *head, struct timer *t)
 {
@@ -54,7 +66,7 @@ void tmrs_settimer(struct list *head, struct timer *t, useconds_t expire_time,
 	/* Add the timer to the active timer list, the next timer due is in front */
 	LIST_FOR_EACH(l, head) {
 		at = LIST_ENTRY(l, struct timer, link);
-		if (expire_time < at->expire_time) {
+		if (t->expire_time < at->expire_time) {
 			break;
 		}
 	}
@@ -63,36 +75,95 @@ void tmrs_settimer(struct list *head, struct timer *t, useconds_t expire_time,
 	list_add(&t->link, l->prev);
 }
 
-boolean_t tmrs_exptimers(struct list *head, useconds_t now)
+boolean_t tmrs_exptimers(struct list *head, struct spinlock *lock,
+			 useconds_t now)
 {
 	struct timer *t;
-	struct list *l, *p;
 	boolean_t preempt = FALSE;
 
 	ASSERT(head != NULL);
 
 	/* Use the current time to check the timers queue list for expired timers.
 	 * Call the callback functions for all expired timers and deactive them.
-	 * The caller is responsible for scheduling a new alarm if needed.
+	 * The lock is dropped while a callback runs as the callback may set or
+	 * cancel timers. The caller is responsible for scheduling a new alarm.
 	 */
-	LIST_FOR_EACH_SAFE(l, p, head) {
-		t = LIST_ENTRY(l, struct timer, link);
-		if (t->expire_time <= now) {
-			list_del(&t->link);
-			t->func(t->ctx);
-			
-			/* If this is a schedule timer we need to do schedule */
-			if (!preempt && FLAG_ON(t->flags, TIMER_SCHED)) {
-				preempt = TRUE;
-			}
-		} else {
+	while (!LIST_EMPTY(head)) {
+		t = LIST_ENTRY(head->next, struct timer, link);
+		if (t->expire_time > now) {
 			break;
 		}
+
+		list_del(&t->link);
+		t->expire_time = TIMER_NEVER;
+
+		spinlock_release(lock);
+		t->func(t->ctx);
+		spinlock_acquire(lock);
+			
+		/* If this is a schedule timer we need to do schedule */
+		if (!preempt && FLAG_ON(t->flags, TIMER_SCHED)) {
+			preempt = TRUE;
+		}
 	}
 
 	return preempt;
 }
 
+/**
+ * Arm the one-shot timer of the CORE for its next event, which is the first
+ * timer due or the next scheduler tick. The tick is stopped while the CORE
+ * is idle. The timer lock of the CORE must be held.
+ */
+static void timer_program(struct core *c, useconds_t now)
+{
+	useconds_t deadline = TIMER_NEVER;
+	struct timer *t;
+
+	/* Periodic PIT is used without the LAPIC */
+	if (!lapic_enabled() || !c->timer_enabled) {
+		return;
+	}
+
+	if (!LIST_EMPTY(&c->timers)) {
+		t = LIST_ENTRY(c->timers.next, struct timer, link);
+		deadline = t->expire_time;
+	}
+
+	if (!c->tick_stopped &&
+	    ((deadline == TIMER_NEVER) || (deadline > now + TIMER_TICK_PERIOD))) {
+		deadline = now + TIMER_TICK_PERIOD;
+	}
+
+	/* A later deadline only costs an early interrupt, which programs the
+	 * timer again, so the hardware is only touched for earlier ones.
+	 */
+	if ((c->timer_deadline != TIMER_NEVER) && (c->timer_deadline > now) &&
+	    ((deadline == TIMER_NEVER) || (deadline >= c->timer_deadline))) {
+		return;
+	}
+
+	c->timer_deadline = deadline;
+	if (deadline == TIMER_NEVER) {
+		lapic_timer_prepare(0);
+	} else {
+		deadline -= now;
+		lapic_timer_prepare(MIN(MAX(deadline, TIMER_MIN_DELTA),
+					TIMER_MAX_DELTA));
+	}
+}
+
+/**
+ * Arm the timer hardware of the current CORE again, called when the CORE
+ * starts or stops the periodic tick.
+ */
+void timer_reprogram()
+{
+	spinlock_acquire(&CURR_CORE->timer_lock);
+	timer_program(CURR_CORE, sys_time());
+	spinlock_release(&CURR_CORE->timer_lock);
+}
+
 void init_timer(struct timer *t, const char *name, int flags)
 {
 	ASSERT(t != NULL);
@@ -115,6 +186,7 @@ void set_timer(struct timer *t, useconds_t expire_time, timer_func_t callback,
 
 	spinlock_acquire(&CURR_CORE->timer_lock);
 	tmrs_settimer(&CURR_CORE->timers, t, expire_time, callback, ctx);
+	timer_program(CURR_CORE, sys_time());
 	spinlock_release(&CURR_CORE->timer_lock);
 
 #ifdef _DEBUG_SCHED
@@ -124,15 +196,20 @@ void set_timer(struct timer *t, useconds_t expire_time, timer_func_t callback,
 
 void cancel_timer(struct timer *t)
 {
+	struct core *c;
+
 	ASSERT(t != NULL);
 	
-	/* The timer pointed to by t was no longer needed, remove it from the active
-	 * timer list. Always update the next timeout time by setting it to the front
-	 * of the active timer list.
+	/* The timer pointed to by t was no longer needed, remove it from the
+	 * active timer list of the CORE it was started on.
 	 */
-	spinlock_acquire(&CURR_CORE->timer_lock);
-	tmrs_clrtimer(&CURR_CORE->timers, t);
-	spinlock_release(&CURR_CORE->timer_lock);
+	c = t->core ? t->core : CURR_CORE;
+	spinlock_acquire(&c->timer_lock);
+	tmrs_clrtimer(&c->timers, t);
+	if (c == CURR_CORE) {
+		timer_program(c, sys_time());
+	}
+	spinlock_release(&c->timer_lock);
 }
 
 void timer_delay(uint32_t usec)
@@ -140,21 +217,72 @@ void timer_delay(uint32_t usec)
 	spin((useconds_t)usec);
 }
 
+/* Interrupts per second given the count in an elapsed time */
+static uint32_t timer_rate(uint32_t irqs, useconds_t elapsed)
+{
+	uint64_t rate;
+
+	if ((elapsed <= 0) || (elapsed >= 0xFFFFFFFF)) {
+		return 0;
+	}
+
+	rate = (uint64_t)irqs * 1000000;
+	do_div(rate, (uint32_t)elapsed);
+
+	return (uint32_t)rate;
+}
+
+static void timer_account(struct core *c, useconds_t now)
+{
+	c->timer_irqs++;
+	c->timer_window_irqs++;
+	if ((now - c->timer_window_start) >= 1000000) {
+		c->timer_irq_rate = timer_rate(c->timer_window_irqs,
+					       now - c->timer_window_start);
+		c->timer_window_irqs = 0;
+		c->timer_window_start = now;
+	}
+}
+
 void timer_tick()
 {
 	useconds_t now;
 	boolean_t prempt = FALSE;
+	struct sched_core *c;
 
 	if (!CURR_CORE->timer_enabled) {
 		return;
 	}
 
 	now = sys_time();
+	timer_account(CURR_CORE, now);
+
+	if (!CURR_CORE->tick_stopped) {
+		sched_tick();
+	}
 
 	spinlock_acquire(&CURR_CORE->timer_lock);
-	prempt = tmrs_exptimers(&CURR_CORE->timers, now);
+
+	/* The one-shot timer has fired, arm it for the next event */
+	CURR_CORE->timer_deadline = TIMER_NEVER;
+	prempt = tmrs_exptimers(&CURR_CORE->timers, &CURR_CORE->timer_lock,
+				now);
+	timer_program(CURR_CORE, now);
+
 	spinlock_release(&CURR_CORE->timer_lock);
-	if (prempt) {
+	if (!prempt) {
+		return;
+	}
+
+	/* An RCU reader must not be switched out, rcu_read_unlock() takes
+	 * the preemption we hold off.
+	 */
+	if (CURR_CORE->rcu_nesting) {
+		c = CURR_CORE->sched;
+		spinlock_acquire_noirq(&c->lock);
+		c->need_resched = TRUE;
+		spinlock_release_noirq(&c->lock);
+	} else {
 		spinlock_acquire_noirq(&CURR_THREAD->lock);
 
 		/* This function should be called with interrupt disabled */
@@ -162,3 +290,39 @@ void timer_tick()
 	}
 }
 
+static int timer_procfs_read(char *buf, size_t size)
+{
+	int len = 0;
+	uint32_t rate;
+	useconds_t now, elapsed;
+	struct list *l;
+	struct core *c;
+
+	now = sys_time();
+
+	LIST_FOR_EACH(l, &_running_cores) {
+		c = LIST_ENTRY(l, struct core, link);
+
+		/* An idle CORE may not have closed its window for long */
+		rate = c->timer_irq_rate;
+		elapsed = now - c->timer_window_start;
+		if (elapsed >= 2000000) {
+			rate = timer_rate(c->timer_window_irqs, elapsed);
+		}
+
+		len += snprintf(buf + len, size - len,
+				"core%d irqs %d irqs_per_sec %d tick %s\n",
+				c->id, c->timer_irqs, rate,
+				c->tick_stopped ? "stopped" : "running");
+		if (len >= size) {
+			break;
+		}
+	}
+
+	return len;
+}
+
+void init_timers()
+{
+	procfs_register("timer", timer_procfs_read);
+}
@@ -7,10 +7,15 @@
 #include "mm/slab.h"
 #include "mm/va.h"
 #include "debug.h"
+#include "hal/core.h"
 #include "kd.h"
 #include "mutex.h"
+#include "semaphore.h"
+#include "rcu.h"
+#include "pit.h"
 #include "proc/thread.h"
 #include "proc/process.h"
+#include "proc/sched.h"
 #include "rtl/bitmap.h"
 #include "rtl/fsrtl.h"
 #include "rtl/hashtable.h"
@@ -63,6 +68,303 @@ static int test_compare(void *key, void *entry)
 	return strcmp((char *)k, w->str);
 }
 
+/* The low priority thread holds the mutex this long, while the medium
+ * priority thread hogs the CORE for a longer time.
+ */
+#define PI_HOLD_TIME	50000
+#define PI_SPIN_TIME	200000
+
+static struct mutex _pi_mutex;
+static struct semaphore _pi_sem;
+static atomic_t _pi_seq;
+static int32_t _pi_high_seq;
+static int32_t _pi_medium_seq;
+
+static void pi_low_thread(void *ctx)
+{
+	mutex_acquire(&_pi_mutex);
+	semaphore_up(&_pi_sem, 1);
+
+	/* The high priority thread blocks on the mutex meanwhile */
+	thread_sleep(NULL, PI_HOLD_TIME, "pi-low", 0);
+
+	mutex_release(&_pi_mutex);
+	semaphore_up(&_pi_sem, 1);
+}
+
+static void pi_medium_thread(void *ctx)
+{
+	useconds_t start = sys_time();
+
+	while ((sys_time() - start) < PI_SPIN_TIME) {
+		;
+	}
+
+	_pi_medium_seq = atomic_inc(&_pi_seq);
+	semaphore_up(&_pi_sem, 1);
+}
+
+static void pi_high_thread(void *ctx)
+{
+	mutex_acquire(&_pi_mutex);
+	_pi_high_seq = atomic_inc(&_pi_seq);
+	mutex_release(&_pi_mutex);
+	semaphore_up(&_pi_sem, 1);
+}
+
+static int pi_run_thread(const char *name, thread_func_t func, int priority)
+{
+	int rc;
+	struct thread *t;
+
+	rc = thread_create(name, NULL, 0, func, NULL, &t);
+	if (rc != 0) {
+		goto out;
+	}
+
+	sched_set_policy(t, SCHED_FIFO, priority);
+	thread_run(t);
+	thread_release(t);
+
+ out:
+	return rc;
+}
+
+/*
+ * Priority inversion: a low priority thread holds a mutex a high priority
+ * thread waits for, while a medium priority thread keeps the CORE busy.
+ * Without priority inheritance the high priority thread gets the mutex
+ * only after the medium priority thread is done.
+ */
+static int pi_test()
+{
+	int rc = -1;
+
+	mutex_init(&_pi_mutex, "pi-mutex", 0);
+	semaphore_init(&_pi_sem, "pi-sem", 0);
+	_pi_seq = 0;
+
+	if (pi_run_thread("pi-low", pi_low_thread, 1) != 0) {
+		goto out;
+	}
+	semaphore_down(&_pi_sem);
+
+	if ((pi_run_thread("pi-high", pi_high_thread, 20) != 0) ||
+	    (pi_run_thread("pi-medium", pi_medium_thread, 10) != 0)) {
+		goto out;
+	}
+
+	/* Wait for the low, medium and high priority threads to finish */
+	semaphore_down(&_pi_sem);
+	semaphore_down(&_pi_sem);
+	semaphore_down(&_pi_sem);
+
+	if (_pi_high_seq > _pi_medium_seq) {
+		DEBUG(DL_WRN, ("priority inversion, high(%d) medium(%d).\n",
+			       _pi_high_seq, _pi_medium_seq));
+		goto out;
+	}
+	rc = 0;
+
+ out:
+	return rc;
+}
+
+/* Contention benchmark of the kernel mutex */
+#define MB_THREADS	4
+#define MB_LOOPS	20000
+#define MB_WORK		200
+
+static struct mutex _mb_mutex;
+static struct semaphore _mb_sem;
+static volatile uint32_t _mb_counter;
+
+static void mb_worker(void *ctx)
+{
+	int i, j;
+
+	for (i = 0; i < MB_LOOPS; i++) {
+		mutex_acquire(&_mb_mutex);
+		for (j = 0; j < MB_WORK; j++) {
+			_mb_counter++;
+		}
+		mutex_release(&_mb_mutex);
+	}
+
+	semaphore_up(&_mb_sem, 1);
+}
+
+/*
+ * Hammer a mutex from several threads and report the wall clock time and
+ * the CPU time they used, spin_limit 0 makes every contender sleep at once.
+ */
+static int mutex_bench(const char *name, uint32_t spin_limit)
+{
+	int i, rc = 0, nr_threads = 0;
+	uint32_t saved;
+	useconds_t start, end, cpu = 0;
+	struct thread *threads[MB_THREADS];
+
+	saved = _mutex_spin_limit;
+	_mutex_spin_limit = spin_limit;
+
+	mutex_init(&_mb_mutex, "mb-mutex", 0);
+	semaphore_init(&_mb_sem, "mb-sem", 0);
+	_mb_counter = 0;
+
+	start = sys_time();
+
+	for (i = 0; i < MB_THREADS; i++) {
+		rc = thread_create("mb-worker", NULL, 0, mb_worker, NULL,
+				   &threads[i]);
+		if (rc != 0) {
+			break;
+		}
+		thread_run(threads[i]);
+		nr_threads++;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		semaphore_down(&_mb_sem);
+	}
+
+	end = sys_time();
+
+	for (i = 0; i < nr_threads; i++) {
+		cpu += threads[i]->sum_exec;
+		thread_release(threads[i]);
+	}
+
+	kprintf("mutex bench(%s): %d threads, %d ops in %lld us, cpu %lld us.\n",
+		name, nr_threads, nr_threads * MB_LOOPS, end - start, cpu);
+
+	if (_mb_counter != (uint32_t)(nr_threads * MB_LOOPS * MB_WORK)) {
+		DEBUG(DL_WRN, ("mutex bench counter %d, expected %d.\n",
+			       _mb_counter, nr_threads * MB_LOOPS * MB_WORK));
+		rc = -1;
+	}
+
+	_mutex_spin_limit = saved;
+
+	return rc;
+}
+
+/* RCU test, readers check the object they see is not freed under them */
+#define RCU_READERS	2
+#define RCU_UPDATES	200
+#define RCU_MAGIC	0x52435521
+
+struct rcu_obj {
+	struct rcu_head rcu;
+	uint32_t magic;
+};
+
+static struct rcu_obj *_rcu_obj;
+static struct semaphore _rcu_ut_sem;
+static volatile boolean_t _rcu_stop;
+static volatile uint32_t _rcu_freed;
+static volatile uint32_t _rcu_bad;
+
+static void rcu_obj_free(struct rcu_head *head)
+{
+	struct rcu_obj *o = (struct rcu_obj *)head;
+
+	o->magic = 0;
+	kfree(o);
+	_rcu_freed++;
+}
+
+static void rcu_reader(void *ctx)
+{
+	int i;
+	struct rcu_obj *o;
+
+	while (!_rcu_stop) {
+		rcu_read_lock();
+		o = rcu_dereference(_rcu_obj);
+		for (i = 0; i < 100; i++) {
+			if (o->magic != RCU_MAGIC) {
+				_rcu_bad++;
+				break;
+			}
+		}
+		rcu_read_unlock();
+		sched_yield();
+	}
+
+	semaphore_up(&_rcu_ut_sem, 1);
+}
+
+static struct rcu_obj *rcu_obj_alloc()
+{
+	struct rcu_obj *o;
+
+	o = kmalloc(sizeof(struct rcu_obj), 0);
+	if (o) {
+		o->magic = RCU_MAGIC;
+	}
+
+	return o;
+}
+
+/*
+ * Replace an object the readers are looking at and free the old one with
+ * call_rcu(), none of the readers should see a freed object.
+ */
+static int rcu_test()
+{
+	int i, rc = -1, nr_readers = 0;
+	struct rcu_obj *o, *old;
+
+	semaphore_init(&_rcu_ut_sem, "rcu-ut-sem", 0);
+	_rcu_stop = FALSE;
+	_rcu_freed = 0;
+	_rcu_bad = 0;
+
+	_rcu_obj = rcu_obj_alloc();
+	if (!_rcu_obj) {
+		goto out;
+	}
+
+	for (i = 0; i < RCU_READERS; i++) {
+		if (thread_create("rcu-reader", NULL, 0, rcu_reader, NULL,
+				  NULL) != 0) {
+			break;
+		}
+		nr_readers++;
+	}
+
+	for (i = 0; i < RCU_UPDATES; i++) {
+		o = rcu_obj_alloc();
+		if (!o) {
+			break;
+		}
+		old = _rcu_obj;
+		rcu_assign_pointer(_rcu_obj, o);
+		call_rcu(&old->rcu, rcu_obj_free);
+		sched_yield();
+	}
+
+	_rcu_stop = TRUE;
+	for (i = 0; i < nr_readers; i++) {
+		semaphore_down(&_rcu_ut_sem);
+	}
+
+	/* Callbacks run in order, all of them are done after this one */
+	call_rcu(&_rcu_obj->rcu, rcu_obj_free);
+	synchronize_rcu();
+
+	if (_rcu_bad || (_rcu_freed != (uint32_t)(i + 1))) {
+		DEBUG(DL_WRN, ("rcu test bad(%d) freed(%d) updates(%d).\n",
+			       _rcu_bad, _rcu_freed, i));
+		goto out;
+	}
+	rc = 0;
+
+ out:
+	return rc;
+}
+
 int do_unit_test(uint32_t round)
 {
 	int i, r, rc = 0;
@@ -239,6 +541,31 @@ int do_unit_test(uint32_t round)
 	}
 	kfree(buckets);
 
+	/* Priority inheritance test */
+	rc = pi_test();
+	DEBUG(DL_DBG, ("priority inheritance test finished, rc(%d).\n", rc));
+
+	/* Mutex contention benchmark, sleeping only and adaptive. A waiter
+	 * only spins while the owner runs on another CORE, so the two runs
+	 * would be the same on one CORE.
+	 */
+	if (_nr_cores < 2) {
+		kprintf("mutex bench: skipped, %d CORE running.\n", _nr_cores);
+	} else {
+		if (rc == 0) {
+			rc = mutex_bench("sleep", 0);
+		}
+		if (rc == 0) {
+			rc = mutex_bench("adaptive", _mutex_spin_limit);
+		}
+	}
+
+	/* Deferred free with RCU */
+	if (rc == 0) {
+		rc = rcu_test();
+		DEBUG(DL_DBG, ("rcu test finished, rc(%d).\n", rc));
+	}
+
  out:
 	for (i = 0; i < 4; i++) {
 		if (obj[i]) {
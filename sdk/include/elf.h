@@ -1,11 +1,7 @@
 #ifndef __ELF_H__
 #define __ELF_H__
 
-#ifdef __KERNEL__
 #include <types.h>
-#else
-#include <stdint.h>
-#endif	/* __KERNEL__ */
 
 /**
  * Basic 32 bit ELF Data Types
@@ -98,6 +94,7 @@ typedef struct {
 	Elf32_Addr p_vaddr;
 	Elf32_Addr p_paddr;
 	Elf32_Word p_filesz;
+	Elf32_Word p_memsz;
 	Elf32_Word p_flags;
 	Elf32_Word p_align;
 } Elf32_Phdr;
@@ -112,9 +109,17 @@ typedef struct {
 #define ELF_PT_NOTE	4		// Auxillary information
 #define ELF_PT_SHLIB	5		// Reserved
 #define ELF_PT_PHDR	6		// Back reference to the header table itself
+#define ELF_PT_TLS	7		// Thread local storage template
 #define ELF_PT_LOPROC	0x70000000
 #define ELF_PT_HIPROC	0x7FFFFFFF
 
+/**
+ * p_flags
+ */
+#define ELF_PF_X	0x1		// Execute
+#define ELF_PF_W	0x2		// Write
+#define ELF_PF_R	0x4		// Read
+
 /* Section Header */
 typedef struct {
 	Elf32_Word sh_name;
@@ -137,13 +142,86 @@ typedef struct {
 #define ELF_SHT_SYMTAB	2
 #define ELF_SHT_STRTAB	3
 #define ELF_SHT_NOBITS	8
+#define ELF_SHT_DYNSYM	11
 
+#define ELF_SHN_UNDEF	0
+
+/* Dynamic Section Entry */
+typedef struct {
+	Elf32_Sword d_tag;
+	union {
+		Elf32_Word d_val;
+		Elf32_Addr d_ptr;
+	} d_un;
+} Elf32_Dyn;
+
+/**
+ * d_tag
+ */
+#define ELF_DT_NULL	0		// End of the dynamic section
+#define ELF_DT_NEEDED	1		// Name of a needed library
+#define ELF_DT_PLTRELSZ	2		// Size of the PLT relocations
+#define ELF_DT_PLTGOT	3		// Address of the GOT
+#define ELF_DT_HASH	4		// Address of the symbol hash table
+#define ELF_DT_STRTAB	5		// Address of the string table
+#define ELF_DT_SYMTAB	6		// Address of the symbol table
+#define ELF_DT_STRSZ	10		// Size of the string table
+#define ELF_DT_SYMENT	11		// Size of a symbol table entry
+#define ELF_DT_REL	17		// Address of the relocations
+#define ELF_DT_RELSZ	18		// Size of the relocations
+#define ELF_DT_RELENT	19		// Size of a relocation entry
+#define ELF_DT_PLTREL	20		// Type of the PLT relocations
+#define ELF_DT_TEXTREL	22		// Relocations may modify the text
+#define ELF_DT_JMPREL	23		// Address of the PLT relocations
+
+/* Symbol Table Entry */
+typedef struct {
+	Elf32_Word st_name;
+	Elf32_Addr st_value;
+	Elf32_Word st_size;
+	unsigned char st_info;
+	unsigned char st_other;
+	Elf32_Half st_shndx;
+} Elf32_Sym;
+
+#define ELF32_ST_BIND(i)	((i) >> 4)
+#define ELF32_ST_TYPE(i)	((i) & 0xF)
+
+#define ELF_STB_LOCAL	0
+#define ELF_STB_GLOBAL	1
+#define ELF_STB_WEAK	2
+
+/* Relocation Entry */
+typedef struct {
+	Elf32_Addr r_offset;
+	Elf32_Word r_info;
+} Elf32_Rel;
+
+#define ELF32_R_SYM(i)		((i) >> 8)
+#define ELF32_R_TYPE(i)		((unsigned char)(i))
+
+/**
+ * r_type for i386
+ */
+#define ELF_R_386_NONE		0
+#define ELF_R_386_32		1
+#define ELF_R_386_PC32		2
+#define ELF_R_386_COPY		5
+#define ELF_R_386_GLOB_DAT	6
+#define ELF_R_386_JMP_SLOT	7
+#define ELF_R_386_RELATIVE	8
+
+#ifdef __KERNEL__
 
 typedef Elf32_Ehdr elf_ehdr_t;
 typedef Elf32_Shdr elf_shdr_t;
 typedef Elf32_Phdr elf_phdr_t;
 
+struct process_args;
+
 extern int elf_load_binary(struct vfs_node *n, struct va_space *vas, void **datap);
-extern ptr_t elf_finish_binary(void *data);
+extern ptr_t elf_finish_binary(void *data, struct process_args *args);
+
+#endif	/* __KERNEL__ */
 
 #endif	/* __ELF_H__ */
@@ -7,7 +7,11 @@
 #define _SIGN
 #endif	/* __KERNEL__ */
 
+#ifdef __KERNEL__
 extern int errno;
+#else
+extern __thread int errno;
+#endif	/* __KERNEL__ */
 
 #define _NERROR		70		/* Number of errors */
 
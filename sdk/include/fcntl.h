@@ -7,5 +7,18 @@
 #define O_RDWR		  02
 #define O_CREAT		0100
 #define O_EXCL		0200
+#define O_CLOEXEC	02000000
+
+/* Commands for fcntl */
+#define F_GETFD		1	/* Get the descriptor flags */
+#define F_SETFD		2	/* Set the descriptor flags */
+
+/* Descriptor flags */
+#define FD_CLOEXEC	1	/* Close the descriptor on exec */
+
+#ifndef __KERNEL__
+extern int open(const char *file, int flags, int mode);
+extern int fcntl(int fd, int cmd, ...);
+#endif	/* __KERNEL__ */
 
 #endif	/* __FCNTL_H__ */
@@ -6,6 +6,10 @@ struct process_args {
 	char **argv;		// Arguments array
 	char **env;		// Environment array
 	int argc;		// Argument count
+	ptr_t entry;		// Entry of the program
+	ptr_t phdr;		// Program headers of the program
+	int phnum;		// Number of the program headers
+	ptr_t base;		// Load base of the interpreter, 0 if none
 };
 
 #endif	/* __MTX_PROCESS_H__ */
@@ -0,0 +1,15 @@
+#ifndef __MTX_TLS_H__
+#define __MTX_TLS_H__
+
+struct process_args;
+
+/* Thread control block, GS points to it and the TLS block is right below */
+struct tls_tcb {
+	struct tls_tcb *self;	// Pointer to itself, read through %gs:0
+};
+
+extern void tls_init(struct process_args *args);
+extern size_t tls_size();
+extern int tls_setup(void *area);
+
+#endif	/* __MTX_TLS_H__ */
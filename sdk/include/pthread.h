@@ -0,0 +1,60 @@
+#ifndef __PTHREAD_H__
+#define __PTHREAD_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+typedef int pthread_t;
+
+/* Thread attributes, no attribute is supported for now */
+typedef struct {
+	int flags;
+} pthread_attr_t;
+
+/* Mutex, 0 - unlocked, 1 - locked, 2 - locked and maybe contended */
+typedef struct {
+	volatile int state;
+} pthread_mutex_t;
+
+typedef struct {
+	int flags;
+} pthread_mutexattr_t;
+
+/* Condition variable, the sequence is bumped on each signal */
+typedef struct {
+	volatile int seq;
+} pthread_cond_t;
+
+typedef struct {
+	int flags;
+} pthread_condattr_t;
+
+#define PTHREAD_MUTEX_INITIALIZER	{ 0 }
+#define PTHREAD_COND_INITIALIZER	{ 0 }
+
+extern int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+			  void *(*start)(void *), void *arg);
+extern int pthread_join(pthread_t thread, void **retval);
+extern void pthread_exit(void *retval);
+extern pthread_t pthread_self();
+
+extern int pthread_mutex_init(pthread_mutex_t *mutex,
+			      const pthread_mutexattr_t *attr);
+extern int pthread_mutex_destroy(pthread_mutex_t *mutex);
+extern int pthread_mutex_lock(pthread_mutex_t *mutex);
+extern int pthread_mutex_trylock(pthread_mutex_t *mutex);
+extern int pthread_mutex_unlock(pthread_mutex_t *mutex);
+
+extern int pthread_cond_init(pthread_cond_t *cond,
+			     const pthread_condattr_t *attr);
+extern int pthread_cond_destroy(pthread_cond_t *cond);
+extern int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+extern int pthread_cond_signal(pthread_cond_t *cond);
+extern int pthread_cond_broadcast(pthread_cond_t *cond);
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* __PTHREAD_H__ */
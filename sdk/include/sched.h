@@ -0,0 +1,63 @@
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/* Scheduling policies */
+#define SCHED_OTHER	0		// Fair share
+#define SCHED_FIFO	1		// Real time, first in first out
+#define SCHED_RR	2		// Real time, round robin
+
+/* Priorities are 0 to 31, higher priority runs first */
+#define SCHED_PRIORITY_MIN	0
+#define SCHED_PRIORITY_MAX	31
+
+struct sched_param {
+	int sched_priority;
+};
+
+/* Number of COREs a CPU set can hold */
+#define CPU_SETSIZE	256
+
+/* Set of COREs a thread may run on */
+typedef struct {
+	uint32_t bits[CPU_SETSIZE / 32];
+} cpu_set_t;
+
+#define CPU_ZERO(set)	do {					\
+	int __i;						\
+	for (__i = 0; __i < CPU_SETSIZE / 32; __i++) {		\
+		(set)->bits[__i] = 0;				\
+	}							\
+} while (0)
+
+#define CPU_FILL(set)	do {					\
+	int __i;						\
+	for (__i = 0; __i < CPU_SETSIZE / 32; __i++) {		\
+		(set)->bits[__i] = 0xFFFFFFFF;			\
+	}							\
+} while (0)
+
+#define CPU_SET(cpu, set)	((set)->bits[(cpu) / 32] |= (1U << ((cpu) % 32)))
+#define CPU_CLR(cpu, set)	((set)->bits[(cpu) / 32] &= ~(1U << ((cpu) % 32)))
+#define CPU_ISSET(cpu, set)	(((set)->bits[(cpu) / 32] >> ((cpu) % 32)) & 1)
+
+#ifndef __KERNEL__
+
+extern int sched_yield();
+extern int sched_setscheduler(pid_t tid, int policy,
+			      const struct sched_param *param);
+extern int sched_getscheduler(pid_t tid);
+extern int sched_getparam(pid_t tid, struct sched_param *param);
+extern int sched_setaffinity(pid_t tid, size_t size, const cpu_set_t *mask);
+extern int sched_getaffinity(pid_t tid, size_t size, cpu_set_t *mask);
+
+#endif	/* __KERNEL__ */
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* __SCHED_H__ */
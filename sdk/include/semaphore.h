@@ -0,0 +1,25 @@
+#ifndef __SEMAPHORE_H__
+#define __SEMAPHORE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/* Counting semaphore for the threads in a process */
+typedef struct {
+	volatile int value;
+	volatile int waiters;
+} sem_t;
+
+extern int sem_init(sem_t *sem, int pshared, unsigned int value);
+extern int sem_destroy(sem_t *sem);
+extern int sem_wait(sem_t *sem);
+extern int sem_trywait(sem_t *sem);
+extern int sem_post(sem_t *sem);
+extern int sem_getvalue(sem_t *sem, int *sval);
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* __SEMAPHORE_H__ */
@@ -0,0 +1,32 @@
+#ifndef __MMAN_H__
+#define __MMAN_H__
+
+#include <types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/* Protection of the mapping */
+#define PROT_NONE	0x0
+#define PROT_READ	0x1
+#define PROT_WRITE	0x2
+#define PROT_EXEC	0x4
+
+/* Flags of the mapping, only fixed private mappings are supported */
+#define MAP_PRIVATE	0x02
+#define MAP_FIXED	0x10
+#define MAP_ANONYMOUS	0x20
+
+#define MAP_FAILED	((void *)-1)
+
+#ifndef __KERNEL__
+extern void *mmap(void *addr, size_t len, int prot, int flags, int fd,
+		  off_t offset);
+#endif	/* __KERNEL__ */
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* __MMAN_H__ */
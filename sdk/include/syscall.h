@@ -89,6 +89,21 @@ DECL_SYSCALL1(create_module, int);
 DECL_SYSCALL2(query_module, const char *, void *);
 DECL_SYSCALL1(delete_module, const char *);
 DECL_SYSCALL4(ioctl, int, int, void *, void *);
+DECL_SYSCALL3(create_thread, void *, void *, void *);
+DECL_SYSCALL1(exit_thread, int);
+DECL_SYSCALL2(join_thread, int, int *);
+DECL_SYSCALL0(gettid);
+DECL_SYSCALL3(futex_wait, int *, int, uint32_t);
+DECL_SYSCALL2(futex_wake, int *, int);
+DECL_SYSCALL0(yield);
+DECL_SYSCALL3(fcntl, int, int, int);
+DECL_SYSCALL3(execve, const char *, char *const *, char *const *);
+DECL_SYSCALL5(mmap, void *, size_t, int, int, off_t);
+DECL_SYSCALL1(set_tls, void *);
+DECL_SYSCALL3(set_scheduler, int, int, int);
+DECL_SYSCALL2(get_scheduler, int, int *);
+DECL_SYSCALL3(set_affinity, int, size_t, const void *);
+DECL_SYSCALL3(get_affinity, int, size_t, void *);
 /* System call declaration end */
 
 #endif	/* __SYSCALL_H__ */
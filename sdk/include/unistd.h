@@ -0,0 +1,18 @@
+#ifndef __UNISTD_H__
+#define __UNISTD_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+extern int read(int fd, char *buf, int len);
+extern int write(int fd, char *buf, int len);
+extern int close(int fd);
+extern int execve(const char *path, char *const argv[], char *const envp[]);
+extern int execv(const char *path, char *const argv[]);
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* __UNISTD_H__ */
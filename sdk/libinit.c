@@ -2,6 +2,7 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include "matrix/process.h"
+#include "matrix/tls.h"
 
 extern int main(int argc, char **argv);
 
@@ -9,6 +10,10 @@ void libc_main(struct process_args *args)
 {
 	int rc = -1;
 
+	/* The TLS of the main thread lives on its stack */
+	tls_init(args);
+	tls_setup(__builtin_alloca(tls_size()));
+
 	rc = main(args->argc, args->argv);
 	exit(rc);
 }
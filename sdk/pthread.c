@@ -0,0 +1,246 @@
+/*
+ * pthread.c
+ */
+
+#include <types.h>
+#include <stddef.h>
+#include <errno.h>
+#include <syscall.h>
+#include <limit.h>
+#include <matrix/matrix.h>
+#include <matrix/tls.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+static INLINE int atomic_add(volatile int *var, int val)
+{
+	asm volatile("lock xaddl %0, %1" : "+r"(val), "+m"(*var) :: "memory");
+	return val;
+}
+
+static INLINE int atomic_xchg(volatile int *var, int val)
+{
+	asm volatile("xchgl %0, %1" : "+r"(val), "+m"(*var) :: "memory");
+	return val;
+}
+
+/* Return the old value, *var is set to val only if it was test */
+static INLINE int atomic_cas(volatile int *var, int test, int val)
+{
+	asm volatile("lock cmpxchgl %2, %1"
+		     : "+a"(test), "+m"(*var)
+		     : "r"(val)
+		     : "memory");
+	return test;
+}
+
+/*
+ * Entry of the threads, the kernel calls it as pthread_entry(start, arg)
+ * on the new user stack.
+ */
+static void pthread_entry(void *(*start)(void *), void *arg)
+{
+	/* Each thread gets a copy of the TLS on its own stack */
+	tls_setup(__builtin_alloca(tls_size()));
+
+	pthread_exit(start(arg));
+}
+
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+		   void *(*start)(void *), void *arg)
+{
+	int tid;
+
+	tid = mtx_create_thread((void *)pthread_entry, (void *)start, arg);
+	if (tid < 0) {
+		return EAGAIN;
+	}
+
+	if (thread) {
+		*thread = tid;
+	}
+
+	return 0;
+}
+
+int pthread_join(pthread_t thread, void **retval)
+{
+	int status;
+
+	if (mtx_join_thread(thread, &status) != 0) {
+		return ESRCH;
+	}
+
+	if (retval) {
+		*retval = (void *)status;
+	}
+
+	return 0;
+}
+
+void pthread_exit(void *retval)
+{
+	mtx_exit_thread((int)retval);
+
+	/* Should not get here */
+	while (TRUE) ;
+}
+
+pthread_t pthread_self()
+{
+	return mtx_gettid();
+}
+
+int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr)
+{
+	mutex->state = 0;
+	return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex)
+{
+	return (mutex->state != 0) ? EBUSY : 0;
+}
+
+/*
+ * The uncontended cases stay in user mode. Once a thread has to sleep it
+ * marks the mutex as contended, so that the owner will wake it up.
+ */
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+	int c;
+
+	c = atomic_cas(&mutex->state, 0, 1);
+	if (c == 0) {
+		return 0;
+	}
+
+	if (c != 2) {
+		c = atomic_xchg(&mutex->state, 2);
+	}
+	while (c != 0) {
+		mtx_futex_wait((int *)&mutex->state, 2, 0);
+		c = atomic_xchg(&mutex->state, 2);
+	}
+
+	return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex)
+{
+	return (atomic_cas(&mutex->state, 0, 1) == 0) ? 0 : EBUSY;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+	if (atomic_add(&mutex->state, -1) != 1) {
+		/* There may be waiters */
+		mutex->state = 0;
+		mtx_futex_wake((int *)&mutex->state, 1);
+	}
+
+	return 0;
+}
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr)
+{
+	cond->seq = 0;
+	return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *cond)
+{
+	return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+	int seq, c;
+
+	seq = cond->seq;
+	pthread_mutex_unlock(mutex);
+
+	/* Return at once if signaled after we read the sequence */
+	mtx_futex_wait((int *)&cond->seq, seq, 0);
+
+	/* Other threads may be waiting on the mutex, take it as contended */
+	while ((c = atomic_xchg(&mutex->state, 2)) != 0) {
+		mtx_futex_wait((int *)&mutex->state, 2, 0);
+	}
+
+	return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *cond)
+{
+	atomic_add(&cond->seq, 1);
+	mtx_futex_wake((int *)&cond->seq, 1);
+	return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond)
+{
+	atomic_add(&cond->seq, 1);
+	mtx_futex_wake((int *)&cond->seq, INT_MAX);
+	return 0;
+}
+
+int sem_init(sem_t *sem, int pshared, unsigned int value)
+{
+	/* Semaphore shared between processes is not supported */
+	if (pshared) {
+		return -1;
+	}
+
+	sem->value = value;
+	sem->waiters = 0;
+	return 0;
+}
+
+int sem_destroy(sem_t *sem)
+{
+	return 0;
+}
+
+int sem_trywait(sem_t *sem)
+{
+	int v;
+
+	while ((v = sem->value) > 0) {
+		if (atomic_cas(&sem->value, v, v - 1) == v) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+int sem_wait(sem_t *sem)
+{
+	while (sem_trywait(sem) != 0) {
+		/* Sleep only if the value is still 0, sem_post() checks the
+		 * waiters after it bumps the value.
+		 */
+		atomic_add(&sem->waiters, 1);
+		mtx_futex_wait((int *)&sem->value, 0, 0);
+		atomic_add(&sem->waiters, -1);
+	}
+
+	return 0;
+}
+
+int sem_post(sem_t *sem)
+{
+	atomic_add(&sem->value, 1);
+	if (sem->waiters) {
+		mtx_futex_wake((int *)&sem->value, 1);
+	}
+
+	return 0;
+}
+
+int sem_getvalue(sem_t *sem, int *sval)
+{
+	*sval = sem->value;
+	return 0;
+}
@@ -7,6 +7,10 @@
 #include <dirent.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sched.h>
 
 /* Definition of the system calls */
 DEFN_SYSCALL0(null, 0)
@@ -44,6 +48,21 @@ DEFN_SYSCALL1(create_module, 31, int)
 DEFN_SYSCALL2(query_module, 32, const char *, void *)
 DEFN_SYSCALL1(delete_module, 33, const char *)
 DEFN_SYSCALL4(ioctl, 34, int, int, void *, void *)
+DEFN_SYSCALL3(create_thread, 35, void *, void *, void *)
+DEFN_SYSCALL1(exit_thread, 36, int)
+DEFN_SYSCALL2(join_thread, 37, int, int *)
+DEFN_SYSCALL0(gettid, 38)
+DEFN_SYSCALL3(futex_wait, 39, int *, int, uint32_t)
+DEFN_SYSCALL2(futex_wake, 40, int *, int)
+DEFN_SYSCALL0(yield, 41)
+DEFN_SYSCALL3(fcntl, 42, int, int, int)
+DEFN_SYSCALL3(execve, 43, const char *, char *const *, char *const *)
+DEFN_SYSCALL5(mmap, 44, void *, size_t, int, int, off_t)
+DEFN_SYSCALL1(set_tls, 45, void *)
+DEFN_SYSCALL3(set_scheduler, 46, int, int, int)
+DEFN_SYSCALL2(get_scheduler, 47, int, int *)
+DEFN_SYSCALL3(set_affinity, 48, int, size_t, const void *)
+DEFN_SYSCALL3(get_affinity, 49, int, size_t, void *)
 
 int null()
 {
@@ -203,9 +222,14 @@ int mknod(const char *path, mode_t mode, dev_t dev)
 
 int fcntl(int fd, int cmd, ...)
 {
-	int rc = -1;
+	int arg;
+	va_list ap;
 
-	return rc;
+	va_start(ap, cmd);
+	arg = va_arg(ap, int);
+	va_end(ap);
+
+	return mtx_fcntl(fd, cmd, arg);
 }
 
 int create_module(int handle)
@@ -227,3 +251,63 @@ int ioctl(int d, int request, void *input, void *output)
 {
 	return mtx_ioctl(d, request, input, output);
 }
+
+int sched_yield()
+{
+	return mtx_yield();
+}
+
+int sched_setscheduler(pid_t tid, int policy, const struct sched_param *param)
+{
+	if (!param) {
+		return -1;
+	}
+
+	return mtx_set_scheduler(tid, policy, param->sched_priority);
+}
+
+int sched_getscheduler(pid_t tid)
+{
+	return mtx_get_scheduler(tid, NULL);
+}
+
+int sched_getparam(pid_t tid, struct sched_param *param)
+{
+	int rc;
+
+	rc = mtx_get_scheduler(tid, &param->sched_priority);
+	return (rc < 0) ? rc : 0;
+}
+
+int sched_setaffinity(pid_t tid, size_t size, const cpu_set_t *mask)
+{
+	return mtx_set_affinity(tid, size, mask);
+}
+
+int sched_getaffinity(pid_t tid, size_t size, cpu_set_t *mask)
+{
+	return mtx_get_affinity(tid, size, mask);
+}
+
+int execve(const char *path, char *const argv[], char *const envp[])
+{
+	return mtx_execve(path, argv, envp);
+}
+
+int execv(const char *path, char *const argv[])
+{
+	return mtx_execve(path, argv, NULL);
+}
+
+/*
+ * The kernel returns 0 rather than the address, which is fixed, so that an
+ * address above 2GB is not taken for an error.
+ */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset)
+{
+	if (mtx_mmap(addr, len, (flags << 8) | prot, fd, offset) != 0) {
+		return MAP_FAILED;
+	}
+
+	return addr;
+}
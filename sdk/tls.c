@@ -0,0 +1,94 @@
+/*
+ * tls.c
+ *
+ * Thread local storage of the program. The TLS block of a thread is right
+ * below its thread pointer (variant II of the i386 ABI), the thread pointer
+ * is the base of the GS segment and points to the thread control block.
+ * Only the TLS of the program itself is supported, shared libraries may
+ * not have TLS.
+ */
+
+#include <types.h>
+#include <stddef.h>
+#include <string.h>
+#include <elf.h>
+#include <syscall.h>
+#include <matrix/matrix.h>
+#include <matrix/process.h>
+#include <matrix/tls.h>
+
+__thread int errno;
+
+/* TLS template of the program, found in PT_TLS */
+static void *_tls_image = NULL;
+static size_t _tls_filesz = 0;
+static size_t _tls_memsz = 0;
+static size_t _tls_align = sizeof(void *);
+
+/**
+ * Find the TLS template through the program headers, must be called once
+ * before any thread is set up.
+ */
+void tls_init(struct process_args *args)
+{
+	int i;
+	ptr_t bias = 0;
+	Elf32_Phdr *phdrs, *tls = NULL;
+
+	phdrs = (Elf32_Phdr *)args->phdr;
+	if (!phdrs) {
+		return;
+	}
+
+	for (i = 0; i < args->phnum; i++) {
+		if (phdrs[i].p_type == ELF_PT_PHDR) {
+			bias = args->phdr - phdrs[i].p_vaddr;
+		} else if (phdrs[i].p_type == ELF_PT_TLS) {
+			tls = &phdrs[i];
+		}
+	}
+
+	if (!tls || !tls->p_memsz) {
+		return;
+	}
+
+	_tls_image = (void *)(bias + tls->p_vaddr);
+	_tls_filesz = tls->p_filesz;
+	_tls_memsz = tls->p_memsz;
+	if (tls->p_align > _tls_align) {
+		_tls_align = tls->p_align;
+	}
+}
+
+/**
+ * Size of the area needed by tls_setup(), this includes the TLS block, the
+ * TCB and the slack for aligning the thread pointer.
+ */
+size_t tls_size()
+{
+	return ROUND_UP(_tls_memsz, _tls_align) + sizeof(struct tls_tcb) +
+		_tls_align;
+}
+
+/**
+ * Build the TLS of the current thread in area and point GS at it, area
+ * must be valid until the thread exits.
+ */
+int tls_setup(void *area)
+{
+	ptr_t tp;
+	uint8_t *block;
+	struct tls_tcb *tcb;
+
+	tp = ROUND_UP((ptr_t)area + ROUND_UP(_tls_memsz, _tls_align),
+		      _tls_align);
+	tcb = (struct tls_tcb *)tp;
+	tcb->self = tcb;
+
+	/* Copy the initialized data and clear the rest */
+	block = (uint8_t *)(tp - ROUND_UP(_tls_memsz, _tls_align));
+	memcpy(block, _tls_image, _tls_filesz);
+	memset(block + _tls_filesz, 0, _tls_memsz - _tls_filesz);
+
+	return mtx_set_tls(tcb);
+}
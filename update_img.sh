@@ -49,7 +49,8 @@ update_prepare()
     $tool_path bin/init init bin/crond crond bin/echo echo bin/unit_test unit_test \
 	bin/ls ls bin/cat cat bin/clear clear bin/shutdown shutdown bin/mkdir mkdir \
 	bin/date date bin/mount mount bin/umount umount bin/mknod mknod bin/dd dd \
-	bin/lsmod lsmod bin/initrd
+	bin/lsmod lsmod bin/ld.so ld.so bin/libc.so libc.so bin/dyn_test dyn_test \
+	bin/initrd
 
 }
 
@@ -0,0 +1,81 @@
+#include <types.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include <pthread.h>
+#include <sched.h>
+
+static int _failed = 0;
+static cpu_set_t _pinned;
+
+static void check(int cond, const char *what)
+{
+	if (!cond) {
+		printf("affinity_test: %s failed.\n", what);
+		_failed = 1;
+	}
+}
+
+static void *worker(void *arg)
+{
+	cpu_set_t mask;
+
+	/* A new thread starts with the affinity of its creator */
+	check(sched_getaffinity(0, sizeof(mask), &mask) == 0, "getaffinity");
+	check(memcmp(&mask, &_pinned, sizeof(mask)) == 0, "inherit");
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int rc = 0, i, core = -1;
+	cpu_set_t mask, all;
+	pthread_t thread;
+
+	if (sched_getaffinity(0, sizeof(all), &all) != 0) {
+		printf("affinity_test: sched_getaffinity failed.\n");
+		rc = -1;
+		goto out;
+	}
+
+	for (i = 0; i < CPU_SETSIZE; i++) {
+		if (CPU_ISSET(i, &all)) {
+			core = i;
+			break;
+		}
+	}
+	check(core >= 0, "initial mask");
+
+	/* A mask without any running CORE is rejected */
+	CPU_ZERO(&mask);
+	check(sched_setaffinity(0, sizeof(mask), &mask) == -1, "empty mask");
+
+	/* Pin ourselves to the first CORE we may run on */
+	CPU_ZERO(&_pinned);
+	CPU_SET(core, &_pinned);
+	check(sched_setaffinity(0, sizeof(_pinned), &_pinned) == 0, "pin");
+	mtx_yield();
+	check(sched_getaffinity(0, sizeof(mask), &mask) == 0, "getaffinity");
+	check(memcmp(&mask, &_pinned, sizeof(mask)) == 0, "readback");
+
+	if (pthread_create(&thread, NULL, worker, NULL) == 0) {
+		pthread_join(thread, NULL);
+	} else {
+		check(0, "pthread_create");
+	}
+
+	/* Restore the original mask */
+	check(sched_setaffinity(0, sizeof(all), &all) == 0, "restore");
+
+	if (_failed) {
+		rc = -1;
+	}
+
+	printf("affinity_test: core %d, %s.\n", core,
+	       _failed ? "failed" : "passed");
+
+ out:
+	return rc;
+}
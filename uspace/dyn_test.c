@@ -0,0 +1,25 @@
+#include <types.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <syscall.h>
+
+/*
+ * Linked against libc.so, the library text is mapped by the dynamic
+ * loader and shared by all the dynamically linked programs.
+ */
+int main(int argc, char **argv)
+{
+	struct timeval tv;
+
+	if (gettimeofday(&tv, NULL) != 0) {
+		printf("dyn_test: gettimeofday failed.\n");
+		return -1;
+	}
+
+	printf("dyn_test: %s linked, %d args, strlen at %p, printf at %p.\n",
+	       argv[0], argc, strlen, printf);
+
+	return 0;
+}
@@ -0,0 +1,75 @@
+#include <types.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syscall.h>
+
+static int check_image(char **argv);
+
+/*
+ * Open two descriptors, one of them close-on-exec, then replace ourself
+ * with a new image of the same program which checks the pid and the
+ * descriptors survived as expected.
+ */
+int main(int argc, char **argv)
+{
+	int rc = -1, fd, cloexec_fd;
+	char pid[16], fd_str[16], cloexec_str[16];
+	char *args[] = {
+		"/exec_test",
+		"-c",
+		pid,
+		fd_str,
+		cloexec_str,
+		NULL
+	};
+
+	if ((argc == 5) && (strcmp(argv[1], "-c") == 0)) {
+		return check_image(argv);
+	}
+
+	fd = open("/exec_test", O_RDONLY, 0);
+	cloexec_fd = open("/exec_test", O_RDONLY|O_CLOEXEC, 0);
+	if ((fd == -1) || (cloexec_fd == -1)) {
+		printf("exec_test: open failed.\n");
+		goto out;
+	}
+
+	sprintf(pid, "%d", mtx_getpid());
+	sprintf(fd_str, "%d", fd);
+	sprintf(cloexec_str, "%d", cloexec_fd);
+
+	rc = execv(args[0], args);
+	printf("exec_test: execv failed, err(%d).\n", rc);
+
+ out:
+	return rc;
+}
+
+int check_image(char **argv)
+{
+	int rc = 0;
+
+	if (mtx_getpid() != atoi(argv[2])) {
+		printf("exec_test: pid changed from %s to %d.\n",
+		       argv[2], mtx_getpid());
+		rc = -1;
+	}
+
+	if (fcntl(atoi(argv[3]), F_GETFD) == -1) {
+		printf("exec_test: descriptor %s was closed.\n", argv[3]);
+		rc = -1;
+	}
+
+	if (fcntl(atoi(argv[4]), F_GETFD) != -1) {
+		printf("exec_test: close-on-exec descriptor %s is open.\n",
+		       argv[4]);
+		rc = -1;
+	}
+
+	printf("exec_test: %s.\n", rc ? "failed" : "passed");
+
+	return rc;
+}
@@ -0,0 +1,55 @@
+#include <types.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#define NR_THREADS	4
+#define NR_LOOPS	1000000
+
+/*
+ * Each thread keeps its own values in the FPU registers for a long time,
+ * the results will be wrong if the FPU state is not switched with threads.
+ */
+static void *worker(void *arg)
+{
+	int i, seed = (int)arg;
+	double x = seed, sum = 0.0;
+
+	for (i = 0; i < NR_LOOPS; i++) {
+		sum += x * 0.5;
+		sum -= x * 0.5;
+		sum += 1.0;
+	}
+
+	return (void *)((int)sum + seed);
+}
+
+int main(int argc, char **argv)
+{
+	int rc = 0, i;
+	void *ret;
+	pthread_t threads[NR_THREADS];
+
+	for (i = 0; i < NR_THREADS; i++) {
+		rc = pthread_create(&threads[i], NULL, worker, (void *)(i * 1000));
+		if (rc != 0) {
+			printf("pthread_create failed, err(%d).\n", rc);
+			goto out;
+		}
+	}
+
+	for (i = 0; i < NR_THREADS; i++) {
+		pthread_join(threads[i], &ret);
+		if ((int)ret != (NR_LOOPS + i * 1000)) {
+			printf("fpu_test: thread %d got %d, expected %d.\n",
+			       i, (int)ret, NR_LOOPS + i * 1000);
+			rc = -1;
+		}
+	}
+
+	printf("fpu_test: %s.\n", rc ? "failed" : "passed");
+
+ out:
+	return rc;
+}
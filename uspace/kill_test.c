@@ -0,0 +1,118 @@
+#include <types.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <syscall.h>
+#include <pthread.h>
+
+/* Long enough that the sleeper never wakes up by itself */
+#define SLEEP_MS	(60 * 60 * 1000)
+
+/* Time the siblings get to start before the main thread exits */
+#define SETTLE_MS	100
+
+static void usage();
+
+static volatile uint32_t _spins = 0;
+
+/* Held by the main thread until it exits */
+static pthread_mutex_t _mutex;
+
+static void *spinner(void *arg)
+{
+	while (TRUE) {
+		_spins++;
+	}
+
+	return NULL;
+}
+
+static void *locker(void *arg)
+{
+	pthread_mutex_lock(&_mutex);
+	printf("kill_test: got the mutex of an exited thread.\n");
+	pthread_mutex_unlock(&_mutex);
+
+	return NULL;
+}
+
+static void *sleeper(void *arg)
+{
+	while (TRUE) {
+		mtx_sleep(SLEEP_MS);
+	}
+
+	return NULL;
+}
+
+/*
+ * Child of the test, leave a spinning, a sleeping and a futex waiting
+ * sibling behind when we exit. They must be killed or the process never
+ * dies.
+ */
+static int child()
+{
+	pthread_t spin, sleep, lock;
+
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_mutex_lock(&_mutex);
+
+	if ((pthread_create(&spin, NULL, spinner, NULL) != 0) ||
+	    (pthread_create(&sleep, NULL, sleeper, NULL) != 0) ||
+	    (pthread_create(&lock, NULL, locker, NULL) != 0)) {
+		printf("kill_test: pthread_create failed.\n");
+		return -1;
+	}
+
+	mtx_sleep(SETTLE_MS);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int rc = 0, pid, status;
+	uint32_t usecs;
+	struct timeval start, end;
+	char *args[] = {
+		"/kill_test",
+		"-c",
+		NULL
+	};
+
+	if (argc == 2) {
+		if (strcmp(argv[1], "-c") == 0) {
+			return child();
+		}
+		usage();
+		return -1;
+	}
+
+	gettimeofday(&start, NULL);
+
+	pid = create_process(args[0], args, 0, 16);
+	if (pid == -1) {
+		printf("kill_test: create_process(%s) failed.\n", args[0]);
+		rc = -1;
+		goto out;
+	}
+
+	/* Returns only when all the threads of the child are gone */
+	waitpid(pid, &status, 0);
+
+	gettimeofday(&end, NULL);
+
+	usecs = (end.tv_sec - start.tv_sec) * 1000000 +
+		(int32_t)(end.tv_usec - start.tv_usec);
+	printf("kill_test: child exited with %d in %d us.\n", status, usecs);
+
+ out:
+	return rc;
+}
+
+void usage()
+{
+	printf("usage: kill_test\n");
+}
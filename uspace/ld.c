@@ -0,0 +1,401 @@
+/*
+ * ld.c
+ *
+ * Dynamic loader. The kernel maps the program and this loader, and enters
+ * the loader with the arguments of the program. The loader maps the shared
+ * libraries the program needs, binds all the GOT and PLT entries at once and
+ * then jumps to the program.
+ */
+
+#include <types.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syscall.h>
+#include <sys/mman.h>
+#include <elf.h>
+#include "matrix/matrix.h"
+#include "matrix/process.h"
+
+/* Where the shared libraries are mapped */
+#define DL_LIB_BASE	0x40000000
+
+/* Maximum number of objects including the program */
+#define DL_MAX_OBJECTS	8
+
+#define DL_PAGE_SIZE	0x1000
+
+struct dl_object {
+	const char *name;
+	ptr_t base;			// Load bias
+	Elf32_Dyn *dynamic;
+	Elf32_Word *hash;
+	Elf32_Sym *symtab;
+	const char *strtab;
+	Elf32_Rel *rel;
+	size_t relsz;
+	Elf32_Rel *jmprel;
+	size_t pltrelsz;
+};
+
+static struct dl_object _objects[DL_MAX_OBJECTS];
+static int _nr_objects = 0;
+static ptr_t _next_base = DL_LIB_BASE;
+
+/* Buffer for the headers of a library */
+static uint8_t _hdr_buf[DL_PAGE_SIZE];
+
+ptr_t dl_main(struct process_args *args);
+
+/* Enter with the arguments on the top of the stack, leave them to the
+ * program.
+ */
+asm(".globl _dl_start\n"
+    "_dl_start:\n"
+    "	call dl_main\n"
+    "	jmp *%eax\n");
+
+static void dl_fatal(const char *msg, const char *name)
+{
+	mtx_putstr("ld.so: ");
+	mtx_putstr(msg);
+	if (name) {
+		mtx_putstr(name);
+	}
+	mtx_putstr("\n");
+	mtx_exit(-1);
+}
+
+static uint32_t dl_hash(const char *name)
+{
+	uint32_t h = 0, g;
+
+	while (*name) {
+		h = (h << 4) + (uint8_t)*name++;
+		g = h & 0xF0000000;
+		if (g) {
+			h ^= g >> 24;
+		}
+		h &= ~g;
+	}
+
+	return h;
+}
+
+static void dl_parse_dynamic(struct dl_object *obj)
+{
+	Elf32_Dyn *d;
+
+	for (d = obj->dynamic; d->d_tag != ELF_DT_NULL; d++) {
+		switch (d->d_tag) {
+		case ELF_DT_HASH:
+			obj->hash = (Elf32_Word *)(obj->base + d->d_un.d_ptr);
+			break;
+		case ELF_DT_SYMTAB:
+			obj->symtab = (Elf32_Sym *)(obj->base + d->d_un.d_ptr);
+			break;
+		case ELF_DT_STRTAB:
+			obj->strtab = (const char *)(obj->base + d->d_un.d_ptr);
+			break;
+		case ELF_DT_REL:
+			obj->rel = (Elf32_Rel *)(obj->base + d->d_un.d_ptr);
+			break;
+		case ELF_DT_RELSZ:
+			obj->relsz = d->d_un.d_val;
+			break;
+		case ELF_DT_JMPREL:
+			obj->jmprel = (Elf32_Rel *)(obj->base + d->d_un.d_ptr);
+			break;
+		case ELF_DT_PLTRELSZ:
+			obj->pltrelsz = d->d_un.d_val;
+			break;
+		case ELF_DT_TEXTREL:
+			dl_fatal("text relocations not supported: ", obj->name);
+			break;
+		}
+	}
+
+	if (!obj->hash || !obj->symtab || !obj->strtab) {
+		dl_fatal("no symbol hash table in ", obj->name);
+	}
+}
+
+static Elf32_Sym *dl_lookup_in(struct dl_object *obj, const char *name,
+			       uint32_t hash)
+{
+	uint32_t nbucket, i;
+	Elf32_Word *bucket, *chain;
+	Elf32_Sym *sym;
+
+	nbucket = obj->hash[0];
+	bucket = &obj->hash[2];
+	chain = &bucket[nbucket];
+
+	for (i = bucket[hash % nbucket]; i != 0; i = chain[i]) {
+		sym = &obj->symtab[i];
+		if ((sym->st_shndx != ELF_SHN_UNDEF) &&
+		    (ELF32_ST_BIND(sym->st_info) != ELF_STB_LOCAL) &&
+		    (strcmp(obj->strtab + sym->st_name, name) == 0)) {
+			return sym;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Search the global scope in load order, the program comes first. Return
+ * the address of the symbol, or 0 for an undefined weak symbol.
+ */
+static ptr_t dl_lookup(const char *name, int weak, struct dl_object *skip)
+{
+	int i;
+	uint32_t hash;
+	Elf32_Sym *sym;
+
+	hash = dl_hash(name);
+	for (i = 0; i < _nr_objects; i++) {
+		if (&_objects[i] == skip) {
+			continue;
+		}
+		sym = dl_lookup_in(&_objects[i], name, hash);
+		if (sym) {
+			return _objects[i].base + sym->st_value;
+		}
+	}
+
+	if (!weak) {
+		dl_fatal("undefined symbol: ", name);
+	}
+
+	return 0;
+}
+
+static void dl_relocate(struct dl_object *obj, Elf32_Rel *rel, size_t size)
+{
+	size_t i;
+	ptr_t *where, value = 0;
+	Elf32_Sym *sym;
+	const char *name;
+
+	for (i = 0; i < size / sizeof(Elf32_Rel); i++) {
+		where = (ptr_t *)(obj->base + rel[i].r_offset);
+		sym = &obj->symtab[ELF32_R_SYM(rel[i].r_info)];
+		name = obj->strtab + sym->st_name;
+
+		/* Resolve the symbol if the relocation refers to one */
+		if (ELF32_R_SYM(rel[i].r_info) &&
+		    (ELF32_R_TYPE(rel[i].r_info) != ELF_R_386_RELATIVE)) {
+			if (ELF32_R_TYPE(rel[i].r_info) == ELF_R_386_COPY) {
+				/* The program owns the copy, search the others */
+				value = dl_lookup(name, FALSE, obj);
+			} else {
+				value = dl_lookup(name, ELF32_ST_BIND(sym->st_info) ==
+						  ELF_STB_WEAK, NULL);
+			}
+		}
+
+		switch (ELF32_R_TYPE(rel[i].r_info)) {
+		case ELF_R_386_NONE:
+			break;
+		case ELF_R_386_32:
+			*where += value;
+			break;
+		case ELF_R_386_PC32:
+			*where += value - (ptr_t)where;
+			break;
+		case ELF_R_386_GLOB_DAT:
+		case ELF_R_386_JMP_SLOT:
+			*where = value;
+			break;
+		case ELF_R_386_RELATIVE:
+			*where += obj->base;
+			break;
+		case ELF_R_386_COPY:
+			memcpy(where, (void *)value, sym->st_size);
+			break;
+		default:
+			dl_fatal("unknown relocation in ", obj->name);
+			break;
+		}
+	}
+}
+
+static int dl_prot(Elf32_Word flags)
+{
+	int prot = PROT_NONE;
+
+	if (FLAG_ON(flags, ELF_PF_R)) {
+		prot |= PROT_READ;
+	}
+	if (FLAG_ON(flags, ELF_PF_W)) {
+		prot |= PROT_WRITE;
+	}
+	if (FLAG_ON(flags, ELF_PF_X)) {
+		prot |= PROT_EXEC;
+	}
+
+	return prot;
+}
+
+static void dl_map_segment(struct dl_object *obj, int fd, Elf32_Phdr *phdr)
+{
+	ptr_t vaddr, start, file_end, page_end, end;
+	uint32_t delta;
+	int prot;
+
+	prot = dl_prot(phdr->p_flags);
+	vaddr = obj->base + phdr->p_vaddr;
+	start = ROUND_DOWN(vaddr, DL_PAGE_SIZE);
+	delta = vaddr - start;
+	file_end = vaddr + phdr->p_filesz;
+	end = vaddr + phdr->p_memsz;
+
+	if (phdr->p_filesz &&
+	    (mmap((void *)start, phdr->p_filesz + delta, prot,
+		  MAP_FIXED | MAP_PRIVATE, fd, phdr->p_offset - delta) == MAP_FAILED)) {
+		dl_fatal("failed to map ", obj->name);
+	}
+
+	if (end <= file_end) {
+		return;
+	}
+
+	/* The rest of the last file page belongs to the .bss */
+	page_end = ROUND_UP(file_end, DL_PAGE_SIZE);
+	if (phdr->p_filesz && (page_end > file_end)) {
+		memset((void *)file_end, 0, MIN(page_end, end) - file_end);
+	} else {
+		page_end = ROUND_DOWN(file_end, DL_PAGE_SIZE);
+	}
+
+	if ((end > page_end) &&
+	    (mmap((void *)page_end, end - page_end, prot,
+		  MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED)) {
+		dl_fatal("failed to map .bss of ", obj->name);
+	}
+}
+
+static void dl_load(const char *name)
+{
+	int i, fd, len;
+	char path[64];
+	ptr_t end = 0;
+	Elf32_Ehdr *ehdr;
+	Elf32_Phdr *phdrs;
+	struct dl_object *obj;
+
+	if (_nr_objects >= DL_MAX_OBJECTS) {
+		dl_fatal("too many libraries: ", name);
+	}
+
+	if (strlen(name) + 2 > sizeof(path)) {
+		dl_fatal("name too long: ", name);
+	}
+	path[0] = '/';
+	strcpy(&path[1], name);
+
+	fd = open(path, O_RDONLY, 0);
+	if (fd < 0) {
+		dl_fatal("library not found: ", name);
+	}
+
+	/* The headers are in the first page of the file */
+	len = read(fd, (char *)_hdr_buf, sizeof(_hdr_buf));
+	ehdr = (Elf32_Ehdr *)_hdr_buf;
+	if ((len < (int)sizeof(Elf32_Ehdr)) ||
+	    (memcmp(ehdr->e_ident, ELF_MAGIC, 4) != 0) ||
+	    (ehdr->e_type != ELF_ET_DYN) ||
+	    (ehdr->e_phentsize != sizeof(Elf32_Phdr)) ||
+	    (ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf32_Phdr) > len)) {
+		dl_fatal("invalid library: ", name);
+	}
+	phdrs = (Elf32_Phdr *)(_hdr_buf + ehdr->e_phoff);
+
+	obj = &_objects[_nr_objects++];
+	memset(obj, 0, sizeof(*obj));
+	obj->name = name;
+	obj->base = _next_base;
+
+	for (i = 0; i < ehdr->e_phnum; i++) {
+		if (phdrs[i].p_type == ELF_PT_LOAD) {
+			dl_map_segment(obj, fd, &phdrs[i]);
+			end = MAX(end, phdrs[i].p_vaddr + phdrs[i].p_memsz);
+		} else if (phdrs[i].p_type == ELF_PT_DYNAMIC) {
+			obj->dynamic = (Elf32_Dyn *)(obj->base + phdrs[i].p_vaddr);
+		}
+	}
+
+	/* The mappings hold the file */
+	close(fd);
+
+	if (!obj->dynamic) {
+		dl_fatal("no dynamic section in ", name);
+	}
+
+	/* Leave a hole between two libraries */
+	_next_base = ROUND_UP(obj->base + end, DL_PAGE_SIZE) + DL_PAGE_SIZE;
+
+	dl_parse_dynamic(obj);
+}
+
+static int dl_loaded(const char *name)
+{
+	int i;
+
+	for (i = 1; i < _nr_objects; i++) {
+		if (strcmp(_objects[i].name, name) == 0) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+ptr_t dl_main(struct process_args *args)
+{
+	int i;
+	Elf32_Phdr *phdrs;
+	Elf32_Dyn *d;
+	struct dl_object *prog;
+
+	/* The program was mapped by the kernel */
+	prog = &_objects[_nr_objects++];
+	prog->name = args->argv[0];
+	phdrs = (Elf32_Phdr *)args->phdr;
+	for (i = 0; i < args->phnum; i++) {
+		if (phdrs[i].p_type == ELF_PT_PHDR) {
+			prog->base = args->phdr - phdrs[i].p_vaddr;
+		}
+	}
+	for (i = 0; i < args->phnum; i++) {
+		if (phdrs[i].p_type == ELF_PT_DYNAMIC) {
+			prog->dynamic = (Elf32_Dyn *)(prog->base + phdrs[i].p_vaddr);
+		}
+	}
+	if (!prog->dynamic) {
+		dl_fatal("no dynamic section in ", prog->name);
+	}
+	dl_parse_dynamic(prog);
+
+	/* Load the needed libraries breadth first, the list grows as we go */
+	for (i = 0; i < _nr_objects; i++) {
+		for (d = _objects[i].dynamic; d->d_tag != ELF_DT_NULL; d++) {
+			if ((d->d_tag == ELF_DT_NEEDED) &&
+			    !dl_loaded(_objects[i].strtab + d->d_un.d_val)) {
+				dl_load(_objects[i].strtab + d->d_un.d_val);
+			}
+		}
+	}
+
+	/* Relocate the libraries before the program, COPY relocations of the
+	 * program read the initialized data of the libraries.
+	 */
+	for (i = _nr_objects - 1; i >= 0; i--) {
+		dl_relocate(&_objects[i], _objects[i].rel, _objects[i].relsz);
+		dl_relocate(&_objects[i], _objects[i].jmprel, _objects[i].pltrelsz);
+	}
+
+	return args->entry;
+}
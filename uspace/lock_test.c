@@ -0,0 +1,87 @@
+#include <types.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#define MAX_THREADS	16
+
+/* Number of times each thread takes the lock */
+#define NR_LOOPS	100000
+
+static void usage();
+
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile uint32_t _counter = 0;
+
+static void *worker(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NR_LOOPS; i++) {
+		pthread_mutex_lock(&_lock);
+		_counter++;
+		pthread_mutex_unlock(&_lock);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int rc = 0, i, nr_threads;
+	uint32_t usecs;
+	pthread_t threads[MAX_THREADS];
+	struct timeval start, end;
+
+	if (argc != 2) {
+		usage();
+		rc = -1;
+		goto out;
+	}
+
+	nr_threads = atoi(argv[1]);
+	if ((nr_threads <= 0) || (nr_threads > MAX_THREADS)) {
+		usage();
+		rc = -1;
+		goto out;
+	}
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < nr_threads; i++) {
+		rc = pthread_create(&threads[i], NULL, worker, NULL);
+		if (rc != 0) {
+			printf("pthread_create failed, err(%d).\n", rc);
+			nr_threads = i;
+			break;
+		}
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	gettimeofday(&end, NULL);
+
+	if (_counter != (uint32_t)(nr_threads * NR_LOOPS)) {
+		printf("lock_test: counter %d, expected %d.\n",
+		       _counter, nr_threads * NR_LOOPS);
+		rc = -1;
+	}
+
+	usecs = (end.tv_sec - start.tv_sec) * 1000000 +
+		(int32_t)(end.tv_usec - start.tv_usec);
+	printf("lock_test: %d threads, %d lock operations in %d us.\n",
+	       nr_threads, nr_threads * NR_LOOPS, usecs);
+
+ out:
+	return rc;
+}
+
+void usage()
+{
+	printf("usage: lock_test count\n");
+	printf("       count - number of threads, 1 to %d\n", MAX_THREADS);
+}
@@ -0,0 +1,149 @@
+#include <types.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syscall.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define MAX_THREADS	16
+
+/* Number of lookups each thread does */
+#define NR_LOOPS	2000
+
+/* No process has this ID, waitpid() only searches the process tree */
+#define NO_SUCH_PID	0x7FFFFFF
+
+static void usage();
+
+static int _nr_cores = 0;
+static int _cores[CPU_SETSIZE];
+static volatile uint32_t _errors = 0;
+
+/*
+ * Each loop walks a path through the mount points, opens a device and
+ * searches the process tree, all of which only read the shared structures.
+ */
+static void *worker(void *arg)
+{
+	int i, fd, status;
+
+	for (i = 0; i < NR_LOOPS; i++) {
+		fd = open("/dev/null", 0, 0);
+		if (fd == -1) {
+			_errors++;
+			continue;
+		}
+		close(fd);
+
+		if (waitpid(NO_SUCH_PID, &status, 0) != -1) {
+			_errors++;
+		}
+	}
+
+	return NULL;
+}
+
+static int run(int nr_threads)
+{
+	int rc = 0, i;
+	uint32_t usecs, msecs;
+	pthread_t threads[MAX_THREADS];
+	struct timeval start, end;
+	cpu_set_t all, mask;
+
+	sched_getaffinity(0, sizeof(all), &all);
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < nr_threads; i++) {
+		/* Spread the threads over the COREs, they inherit our mask */
+		if (_nr_cores > 0) {
+			CPU_ZERO(&mask);
+			CPU_SET(_cores[i % _nr_cores], &mask);
+			sched_setaffinity(0, sizeof(mask), &mask);
+		}
+
+		rc = pthread_create(&threads[i], NULL, worker, NULL);
+		if (rc != 0) {
+			printf("pthread_create failed, err(%d).\n", rc);
+			nr_threads = i;
+			break;
+		}
+	}
+
+	if (_nr_cores > 0) {
+		sched_setaffinity(0, sizeof(all), &all);
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	gettimeofday(&end, NULL);
+
+	usecs = (end.tv_sec - start.tv_sec) * 1000000 +
+		(int32_t)(end.tv_usec - start.tv_usec);
+	msecs = (usecs < 1000) ? 1 : (usecs / 1000);
+
+	printf("lookup_test: %d threads, %d lookups in %d us, %d per second.\n",
+	       nr_threads, nr_threads * NR_LOOPS, usecs,
+	       nr_threads * NR_LOOPS * 1000 / msecs);
+
+	return rc;
+}
+
+int main(int argc, char **argv)
+{
+	int rc = 0, i, nr_threads;
+	cpu_set_t all;
+
+	if (argc != 2) {
+		usage();
+		rc = -1;
+		goto out;
+	}
+
+	nr_threads = atoi(argv[1]);
+	if ((nr_threads <= 0) || (nr_threads > MAX_THREADS)) {
+		usage();
+		rc = -1;
+		goto out;
+	}
+
+	if (sched_getaffinity(0, sizeof(all), &all) == 0) {
+		for (i = 0; i < CPU_SETSIZE; i++) {
+			if (CPU_ISSET(i, &all)) {
+				_cores[_nr_cores++] = i;
+			}
+		}
+	}
+
+	/* Readers should scale with the number of threads up to the number
+	 * of COREs.
+	 */
+	for (i = 1; i <= nr_threads; i *= 2) {
+		rc = run(i);
+		if (rc != 0) {
+			break;
+		}
+	}
+
+	if (_errors) {
+		printf("lookup_test: %d lookups failed.\n", _errors);
+		rc = -1;
+	}
+
+ out:
+	return rc;
+}
+
+void usage()
+{
+	printf("usage: lookup_test count\n");
+	printf("       count - maximum number of threads, 1 to %d\n",
+	       MAX_THREADS);
+}
@@ -1,9 +1,14 @@
 #include <types.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
 #include <syscall.h>
 #include <errno.h>
 
+static void usage();
+static int spawn_test(int nr_procs);
+
 void idle_spin()
 {
 	uint32_t cnt = 5000;
@@ -18,16 +23,32 @@ int main(int argc, char **argv)
 	int rc = 0;
 	uint32_t nr_prints = 0;
 
-	if (argc != 2) {
+	if (argc < 2) {
+		usage();
 		rc = -1;
 		goto out;
 	}
 
+	/* Child of the spawn test, exit at once */
+	if (strcmp(argv[1], "-q") == 0) {
+		goto out;
+	}
+
+	if (strcmp(argv[1], "-s") == 0) {
+		if (argc != 3) {
+			usage();
+			rc = -1;
+			goto out;
+		}
+		rc = spawn_test(atoi(argv[2]));
+		goto out;
+	}
+
 	while (TRUE) {
 		printf("%s: say hello!\n", argv[1]);
 		idle_spin();
 		nr_prints++;
-		
+
 		/* We only do this test for 5000 round */
 		if (nr_prints > 1000) {
 			break;
@@ -37,3 +58,52 @@ int main(int argc, char **argv)
  out:
 	return rc;
 }
+
+/*
+ * Create and wait the children one by one, this measures the throughput of
+ * process and thread creation/destruction.
+ */
+int spawn_test(int nr_procs)
+{
+	int rc = 0, i, pid, status;
+	uint32_t usecs;
+	struct timeval start, end;
+	char *child[] = {
+		"/process_test",
+		"-q",
+		NULL
+	};
+
+	if (nr_procs <= 0) {
+		rc = -1;
+		goto out;
+	}
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < nr_procs; i++) {
+		pid = create_process(child[0], child, 0, 16);
+		if (pid == -1) {
+			printf("create_process(%s) failed.\n", child[0]);
+			rc = -1;
+			goto out;
+		}
+		waitpid(pid, &status, 0);
+	}
+
+	gettimeofday(&end, NULL);
+
+	usecs = (end.tv_sec - start.tv_sec) * 1000000 +
+		(int32_t)(end.tv_usec - start.tv_usec);
+	printf("process_test: %d processes in %d us, %d us per process.\n",
+	       nr_procs, usecs, usecs / nr_procs);
+
+ out:
+	return rc;
+}
+
+void usage()
+{
+	printf("usage: process_test name\n");
+	printf("       process_test -s count\n");
+}
@@ -0,0 +1,195 @@
+#include <types.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <syscall.h>
+#include <pthread.h>
+#include <sched.h>
+#include <matrix/matrix.h>
+
+#define MAX_THREADS	16
+
+/* Time the interactive thread sleeps each round, in milliseconds */
+#define SLEEP_MS	10
+
+/* Priority of the real time threads */
+#define RT_PRIORITY	10
+
+static void usage();
+
+static volatile int _stop = 0;
+static int _policy = SCHED_OTHER;
+static int _hog = 0;
+static volatile uint32_t _loops[MAX_THREADS];
+
+/* Wake up latency of the interactive thread, in microseconds */
+static uint32_t _nr_wakeups = 0;
+static uint32_t _total_latency = 0;
+static uint32_t _max_latency = 0;
+
+static uint32_t elapsed_us(struct timeval *start, struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000 +
+		(int32_t)(end->tv_usec - start->tv_usec);
+}
+
+static void *spinner(void *arg)
+{
+	int id = (int)arg;
+
+	while (!_stop) {
+		_loops[id]++;
+	}
+
+	return NULL;
+}
+
+static void *interactive(void *arg)
+{
+	uint32_t latency;
+	struct timeval start, end;
+	struct sched_param param;
+
+	if (_policy != SCHED_OTHER) {
+		param.sched_priority = RT_PRIORITY;
+		if (sched_setscheduler(0, _policy, &param) != 0) {
+			printf("sched_setscheduler failed.\n");
+		}
+	}
+
+	while (!_stop) {
+		gettimeofday(&start, NULL);
+		mtx_sleep(SLEEP_MS);
+		gettimeofday(&end, NULL);
+
+		/* Time beyond the sleep is how long we waited for the CORE */
+		latency = elapsed_us(&start, &end);
+		latency = (latency > SLEEP_MS * 1000) ? latency - SLEEP_MS * 1000 : 0;
+		_total_latency += latency;
+		if (latency > _max_latency) {
+			_max_latency = latency;
+		}
+		_nr_wakeups++;
+	}
+
+	return NULL;
+}
+
+/* A real time thread that never sleeps, throttling keeps the others going */
+static void *hog(void *arg)
+{
+	struct sched_param param;
+
+	param.sched_priority = RT_PRIORITY;
+	if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+		printf("sched_setscheduler failed.\n");
+	}
+
+	while (!_stop) {
+		;
+	}
+
+	return NULL;
+}
+
+/*
+ * Run CPU bound threads together with a thread that sleeps most of the
+ * time. The CPU bound threads should make about the same progress and the
+ * sleeper should get the CORE soon after it wakes up. The sleeper may run
+ * as a real time thread, and a real time hog may be added.
+ */
+int main(int argc, char **argv)
+{
+	int rc = 0, i, nr_threads, nr_extra = 0, secs;
+	uint32_t min, max, total = 0;
+	pthread_t threads[MAX_THREADS + 2];
+
+	if ((argc != 3) && (argc != 4)) {
+		usage();
+		rc = -1;
+		goto out;
+	}
+
+	if (argc == 4) {
+		if (strcmp(argv[3], "fifo") == 0) {
+			_policy = SCHED_FIFO;
+		} else if (strcmp(argv[3], "rr") == 0) {
+			_policy = SCHED_RR;
+		} else if (strcmp(argv[3], "hog") == 0) {
+			_hog = 1;
+		} else {
+			usage();
+			rc = -1;
+			goto out;
+		}
+	}
+
+	nr_threads = atoi(argv[1]);
+	secs = atoi(argv[2]);
+	if ((nr_threads <= 0) || (nr_threads > MAX_THREADS) || (secs <= 0)) {
+		usage();
+		rc = -1;
+		goto out;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		rc = pthread_create(&threads[i], NULL, spinner, (void *)i);
+		if (rc != 0) {
+			printf("pthread_create failed, err(%d).\n", rc);
+			nr_threads = i;
+			goto join;
+		}
+	}
+
+	rc = pthread_create(&threads[nr_threads], NULL, interactive, NULL);
+	if (rc != 0) {
+		printf("pthread_create failed, err(%d).\n", rc);
+		goto join;
+	}
+	nr_extra = 1;
+
+	if (_hog) {
+		rc = pthread_create(&threads[nr_threads + 1], NULL, hog, NULL);
+		if (rc != 0) {
+			printf("pthread_create failed, err(%d).\n", rc);
+			goto join;
+		}
+		nr_extra++;
+	}
+
+	mtx_sleep(secs * 1000);
+
+ join:
+	_stop = 1;
+	for (i = 0; i < nr_threads + nr_extra; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	if (nr_threads == 0) {
+		goto out;
+	}
+
+	min = max = _loops[0];
+	for (i = 0; i < nr_threads; i++) {
+		printf("sched_test: thread %d looped %d times.\n", i, _loops[i]);
+		min = MIN(min, _loops[i]);
+		max = MAX(max, _loops[i]);
+		total += _loops[i];
+	}
+
+	/* Avoid 64 bit division, the counts can be large */
+	printf("sched_test: %d threads, %d loops, min/max %d%%.\n",
+	       nr_threads, total, (max >= 100) ? min / (max / 100) : 100);
+	printf("sched_test: %d wakeups, latency avg %d us, max %d us.\n",
+	       _nr_wakeups, _nr_wakeups ? _total_latency / _nr_wakeups : 0,
+	       _max_latency);
+
+ out:
+	return rc;
+}
+
+void usage()
+{
+	printf("usage: sched_test threads seconds [fifo|rr|hog]\n");
+}
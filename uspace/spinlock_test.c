@@ -0,0 +1,245 @@
+#include <types.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define MAX_THREADS	16
+
+/* Total number of times the lock is taken by all the threads */
+#define NR_ACQUIRES	200000
+
+/* Give up the CORE after spinning this long, the holder may have been
+ * preempted when the threads share a CORE.
+ */
+#define SPINS_BEFORE_YIELD	1000
+
+/*
+ * The two spinlocks below mirror the kernel ones, the old decrement lock
+ * and the ticket lock that replaced it, so that they can be compared with
+ * threads pinned to different COREs.
+ */
+struct dec_lock {
+	volatile int32_t value;
+};
+
+struct ticket_lock {
+	volatile int32_t next;
+	volatile uint32_t serving;
+};
+
+struct thread_stat {
+	uint32_t acquires;	// Times the thread took the lock
+	uint32_t atomics;	// Locked operations on the lock word
+};
+
+static void usage();
+
+static struct dec_lock _dec_lock = { 1 };
+static struct ticket_lock _ticket_lock = { 0, 0 };
+static int _use_ticket = 0;
+
+static volatile uint32_t _total = 0;
+static volatile int _last_owner = -1;
+static uint32_t _handoffs = 0;
+static struct thread_stat _stats[MAX_THREADS];
+
+static int32_t xadd(volatile int32_t *var, int32_t val)
+{
+	asm volatile("lock xaddl %0, %1" : "+r"(val), "+m"(*var) :: "memory");
+	return val;
+}
+
+static void spin_hint(uint32_t *spins)
+{
+	asm volatile("pause" ::: "memory");
+	if (++(*spins) >= SPINS_BEFORE_YIELD) {
+		*spins = 0;
+		sched_yield();
+	}
+}
+
+static void dec_lock(struct dec_lock *l, struct thread_stat *s)
+{
+	uint32_t spins = 0;
+
+	s->atomics++;
+	if (xadd(&l->value, -1) == 1) {
+		return;
+	}
+
+	while (TRUE) {
+		while (l->value != 1) {
+			spin_hint(&spins);
+		}
+		s->atomics++;
+		if (xadd(&l->value, -1) == 1) {
+			break;
+		}
+	}
+}
+
+static void dec_unlock(struct dec_lock *l)
+{
+	asm volatile("" ::: "memory");
+	l->value = 1;
+}
+
+static void ticket_lock(struct ticket_lock *l, struct thread_stat *s)
+{
+	uint32_t ticket, spins = 0;
+
+	s->atomics++;
+	ticket = (uint32_t)xadd(&l->next, 1);
+	while (ticket != l->serving) {
+		spin_hint(&spins);
+	}
+}
+
+static void ticket_unlock(struct ticket_lock *l)
+{
+	asm volatile("" ::: "memory");
+	l->serving = l->serving + 1;
+}
+
+static void *worker(void *arg)
+{
+	int id = (int)arg;
+	boolean_t done = FALSE;
+	struct thread_stat *s = &_stats[id];
+
+	while (!done) {
+		if (_use_ticket) {
+			ticket_lock(&_ticket_lock, s);
+		} else {
+			dec_lock(&_dec_lock, s);
+		}
+
+		if (_total < NR_ACQUIRES) {
+			_total++;
+			s->acquires++;
+
+			/* Each change of the owner moves the lock's cache line */
+			if (_last_owner != id) {
+				_last_owner = id;
+				_handoffs++;
+			}
+		} else {
+			done = TRUE;
+		}
+
+		if (_use_ticket) {
+			ticket_unlock(&_ticket_lock);
+		} else {
+			dec_unlock(&_dec_lock);
+		}
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int rc = 0, i, j, nr_threads, nr_cores = 0;
+	int cores[CPU_SETSIZE];
+	uint32_t usecs, min, max, atomics = 0;
+	pthread_t threads[MAX_THREADS];
+	struct timeval start, end;
+	cpu_set_t all, mask;
+
+	if (argc != 3) {
+		usage();
+		rc = -1;
+		goto out;
+	}
+
+	if (strcmp(argv[1], "ticket") == 0) {
+		_use_ticket = 1;
+	} else if (strcmp(argv[1], "dec") != 0) {
+		usage();
+		rc = -1;
+		goto out;
+	}
+
+	nr_threads = atoi(argv[2]);
+	if ((nr_threads <= 0) || (nr_threads > MAX_THREADS)) {
+		usage();
+		rc = -1;
+		goto out;
+	}
+
+	/* Spread the threads over the COREs we may run on */
+	if (sched_getaffinity(0, sizeof(all), &all) == 0) {
+		for (i = 0; i < CPU_SETSIZE; i++) {
+			if (CPU_ISSET(i, &all)) {
+				cores[nr_cores++] = i;
+			}
+		}
+	}
+
+	memset(_stats, 0, sizeof(_stats));
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < nr_threads; i++) {
+		if (nr_cores > 0) {
+			CPU_ZERO(&mask);
+			CPU_SET(cores[i % nr_cores], &mask);
+			sched_setaffinity(0, sizeof(mask), &mask);
+		}
+
+		/* The new thread inherits the mask we just set */
+		rc = pthread_create(&threads[i], NULL, worker, (void *)i);
+		if (rc != 0) {
+			printf("pthread_create failed, err(%d).\n", rc);
+			nr_threads = i;
+			break;
+		}
+	}
+
+	if (nr_cores > 0) {
+		sched_setaffinity(0, sizeof(all), &all);
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	gettimeofday(&end, NULL);
+
+	usecs = (end.tv_sec - start.tv_sec) * 1000000 +
+		(int32_t)(end.tv_usec - start.tv_usec);
+
+	/* Fairness is the share of the least lucky thread against the
+	 * luckiest one.
+	 */
+	min = max = _stats[0].acquires;
+	for (j = 0; j < nr_threads; j++) {
+		if (_stats[j].acquires < min) {
+			min = _stats[j].acquires;
+		}
+		if (_stats[j].acquires > max) {
+			max = _stats[j].acquires;
+		}
+		atomics += _stats[j].atomics;
+		printf("spinlock_test: thread %d core %d acquires %d atomics %d\n",
+		       j, (nr_cores > 0) ? cores[j % nr_cores] : -1,
+		       _stats[j].acquires, _stats[j].atomics);
+	}
+
+	printf("spinlock_test: %s lock, %d threads on %d cores, %d acquires "
+	       "in %d us, handoffs %d, atomics %d, min/max %d/%d.\n",
+	       argv[1], nr_threads, nr_cores, _total, usecs, _handoffs,
+	       atomics, min, max);
+
+ out:
+	return rc;
+}
+
+void usage()
+{
+	printf("usage: spinlock_test dec|ticket count\n");
+	printf("       count - number of threads, 1 to %d\n", MAX_THREADS);
+}
@@ -0,0 +1,85 @@
+#include <types.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#define MAX_THREADS	16
+
+/* Total amount of work, split evenly between the threads */
+#define NR_ROUNDS	(64 * 1024 * 1024)
+
+static void usage();
+
+static uint32_t _sums[MAX_THREADS];
+
+static void *worker(void *arg)
+{
+	int i = (int)arg;
+	uint32_t n, sum = 0;
+
+	for (n = _sums[i]; n > 0; n--) {
+		sum += n ^ (sum >> 3);
+	}
+	_sums[i] = sum;
+
+	return (void *)i;
+}
+
+int main(int argc, char **argv)
+{
+	int rc = 0, i, nr_threads;
+	void *ret;
+	uint32_t usecs;
+	pthread_t threads[MAX_THREADS];
+	struct timeval start, end;
+
+	if (argc != 2) {
+		usage();
+		rc = -1;
+		goto out;
+	}
+
+	nr_threads = atoi(argv[1]);
+	if ((nr_threads <= 0) || (nr_threads > MAX_THREADS)) {
+		usage();
+		rc = -1;
+		goto out;
+	}
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < nr_threads; i++) {
+		_sums[i] = NR_ROUNDS / nr_threads;
+		rc = pthread_create(&threads[i], NULL, worker, (void *)i);
+		if (rc != 0) {
+			printf("pthread_create failed, err(%d).\n", rc);
+			nr_threads = i;
+			break;
+		}
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i], &ret);
+		if ((int)ret != i) {
+			printf("thread %d returned %d.\n", threads[i], (int)ret);
+			rc = -1;
+		}
+	}
+
+	gettimeofday(&end, NULL);
+
+	usecs = (end.tv_sec - start.tv_sec) * 1000000 +
+		(int32_t)(end.tv_usec - start.tv_usec);
+	printf("thread_test: %d threads in %d us.\n", nr_threads, usecs);
+
+ out:
+	return rc;
+}
+
+void usage()
+{
+	printf("usage: thread_test count\n");
+	printf("       count - number of threads, 1 to %d\n", MAX_THREADS);
+}
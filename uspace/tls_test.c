@@ -0,0 +1,81 @@
+#include <types.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <errno.h>
+#include <syscall.h>
+#include <pthread.h>
+
+#define NR_THREADS	4
+
+/* Number of times each thread updates its TLS */
+#define NR_LOOPS	100000
+
+static __thread int _tls_init = 5;
+static __thread uint32_t _tls_counter;
+
+static int _failed = 0;
+
+static void *worker(void *arg)
+{
+	int i, id = (int)arg;
+
+	/* Every thread starts with the initial image */
+	if ((_tls_init != 5) || (_tls_counter != 0) || (errno != 0)) {
+		printf("tls_test: thread %d got init(%d) counter(%d) errno(%d).\n",
+		       id, _tls_init, _tls_counter, errno);
+		_failed = 1;
+	}
+
+	_tls_init = id;
+	errno = id;
+	for (i = 0; i < NR_LOOPS; i++) {
+		_tls_counter++;
+		if (i % 1000 == 0) {
+			mtx_yield();
+		}
+	}
+
+	/* Other threads must not have touched our copy */
+	if ((_tls_init != id) || (_tls_counter != NR_LOOPS) || (errno != id)) {
+		printf("tls_test: thread %d got init(%d) counter(%d) errno(%d).\n",
+		       id, _tls_init, _tls_counter, errno);
+		_failed = 1;
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int rc = 0, i, nr_threads;
+	pthread_t threads[NR_THREADS];
+
+	errno = -1;
+
+	for (i = 0; i < NR_THREADS; i++) {
+		rc = pthread_create(&threads[i], NULL, worker, (void *)(i + 1));
+		if (rc != 0) {
+			printf("pthread_create failed, err(%d).\n", rc);
+			break;
+		}
+	}
+	nr_threads = i;
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	if ((_tls_init != 5) || (_tls_counter != 0) || (errno != -1)) {
+		printf("tls_test: main thread TLS changed.\n");
+		_failed = 1;
+	}
+
+	if (_failed) {
+		rc = -1;
+	}
+
+	printf("tls_test: %d threads, %s.\n", nr_threads,
+	       _failed ? "failed" : "passed");
+
+	return rc;
+}
@@ -0,0 +1,72 @@
+#include <types.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <div64.h>
+
+/* Number of yields done by each thread */
+#define NR_YIELDS	100000
+
+static uint64_t rdtsc()
+{
+	uint32_t high, low;
+
+	asm volatile("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+}
+
+static void *worker(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NR_YIELDS; i++) {
+		sched_yield();
+	}
+
+	return NULL;
+}
+
+/*
+ * Two threads yield to each other, each yield is a round trip into the
+ * kernel plus a thread switch. Yielding alone first gives the cost of
+ * the system call without the switch.
+ */
+int main(int argc, char **argv)
+{
+	int rc = 0, i;
+	uint32_t alone, pingpong;
+	uint64_t start, end, cycles;
+	pthread_t threads[2];
+
+	start = rdtsc();
+	worker(NULL);
+	end = rdtsc();
+	cycles = end - start;
+	do_div(cycles, NR_YIELDS);
+	alone = (uint32_t)cycles;
+
+	start = rdtsc();
+	for (i = 0; i < 2; i++) {
+		rc = pthread_create(&threads[i], NULL, worker, NULL);
+		if (rc != 0) {
+			printf("pthread_create failed, err(%d).\n", rc);
+			goto out;
+		}
+	}
+	for (i = 0; i < 2; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	end = rdtsc();
+	cycles = end - start;
+	do_div(cycles, 2 * NR_YIELDS);
+	pingpong = (uint32_t)cycles;
+
+	printf("yield_test: yield %d cycles, yield with switch %d cycles, "
+	       "switch %d cycles.\n", alone, pingpong,
+	       (pingpong > alone) ? (pingpong - alone) : 0);
+
+ out:
+	return rc;
+}